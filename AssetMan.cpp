@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <cinttypes>
@@ -21,51 +22,150 @@ namespace Ek
     pAllocator = Allocator;
   }
 
-  Ek::Texture* AssetManager::RequestTexture(const char* FilePath)
+  void AssetManager::Destroy()
   {
-    uint32_t i;
+    while(Textures.size() > 0)
+    {
+      Release(Textures.begin());
+    }
+  }
+
+  TextureHandle AssetManager::RequestTexture(const char* FilePath)
+  {
+    auto Found = Paths.find(FilePath);
 
-    for(i = 0; i < Textures.size(); i++)
+    if(Found != Paths.end())
     {
-      if(strcmp(Textures[i].second.c_str(), FilePath) == 0)
-      {
-        return &Textures[i].first;
-      }
+      TextureEntry& Entry = Textures.at(Found->second);
+
+      Entry.RefCount++;
+      Entry.LastUsed = Frame;
+
+      return Found->second;
     }
 
-    Ek::Texture NewTex;
+    TextureHandle Handle = NextHandle;
+    TextureEntry& Entry = Textures[Handle];
 
-    // textures should have color attachment optimal, because they are used as color storage/textures for objects
     // it is assumed that this will be sampled in a shader to be used as a texture
-    pAllocator->LoadImage(FilePath, NewTex, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT);
+    if(pAllocator->LoadImage(FilePath, Entry.Texture, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT) != VK_SUCCESS)
+    {
+      Textures.erase(Handle);
+      return 0;
+    }
+
+    NextHandle++;
+
+    // covers ours along with whatever was recorded before it
+    Entry.Ready = pAllocator->GetUploadToken();
+    Entry.Path = FilePath;
+    Entry.RefCount = 1;
+    Entry.LastUsed = Frame;
+
+    Paths[Entry.Path] = Handle;
+    ResidentBytes += Entry.Texture.allocSize;
+
+    return Handle;
+  }
+
+  void AssetManager::ReleaseTexture(TextureHandle Handle)
+  {
+    auto Found = Textures.find(Handle);
+
+    // the texture may have been unloaded under the reference
+    if(Found != Textures.end() && Found->second.RefCount > 0)
+    {
+      Found->second.RefCount--;
+    }
+  }
+
+  Ek::Texture* AssetManager::GetTexture(TextureHandle Handle)
+  {
+    auto Found = Textures.find(Handle);
+
+    if(Found == Textures.end())
+    {
+      return nullptr;
+    }
+
+    Found->second.LastUsed = Frame;
+
+    return &Found->second.Texture;
+  }
+
+  void AssetManager::Release(std::unordered_map<TextureHandle, TextureEntry>::iterator Entry)
+  {
+    ResidentBytes -= Entry->second.Texture.allocSize;
 
-    Textures.push_back({NewTex, FilePath});
+    // only an explicit Unload can get here this early, eviction skips textures still uploading
+    pAllocator->WaitUpload(Entry->second.Ready);
+    Entry->second.Texture.Destroy();
 
-    return &Textures[i].first;
+    Paths.erase(Entry->second.Path);
+    Textures.erase(Entry);
   }
 
   void AssetManager::Unload(const char* FilePath)
   {
-    for(uint32_t i = 0; i < Textures.size(); i++)
+    auto Found = Paths.find(FilePath);
+
+    if(Found != Paths.end())
     {
-      if(Textures[i].second.compare(FilePath))
+      Release(Textures.find(Found->second));
+    }
+  }
+
+  void AssetManager::Unload(Ek::Texture& Texture)
+  {
+    for(auto Entry = Textures.begin(); Entry != Textures.end(); Entry++)
+    {
+      if(Entry->second.Texture.Image == Texture.Image)
       {
-        Textures[i].first.Destroy();
-        Textures.erase(Textures.begin()+i);
+        Release(Entry);
+        return;
       }
     }
   }
 
-  void AssetManager::Unload(Ek::Texture& Texture)
+  void AssetManager::Update(uint64_t inFrame)
   {
-    for(uint32_t i = 0; i < Textures.size(); i++)
+    Frame = inFrame;
+
+    if(Budget > 0 && ResidentBytes > Budget)
     {
-      if(Textures[i].first.Image == Texture.Image)
+      EvictUnused(ResidentBytes - Budget);
+    }
+  }
+
+  VkDeviceSize AssetManager::Evict(VkDeviceSize Bytes)
+  {
+    return EvictUnused(Bytes);
+  }
+
+  VkDeviceSize AssetManager::EvictUnused(VkDeviceSize Bytes)
+  {
+    std::vector<std::pair<uint64_t, TextureHandle>> Candidates;
+
+    for(auto Entry = Textures.begin(); Entry != Textures.end(); Entry++)
+    {
+      if(Entry->second.RefCount == 0 && Entry->second.LastUsed < Frame && pAllocator->IsUploadDone(Entry->second.Ready))
       {
-        Textures[i].first.Destroy();
-        Textures.erase(Textures.begin()+i);
+        Candidates.push_back({Entry->second.LastUsed, Entry->first});
       }
     }
+
+    std::sort(Candidates.begin(), Candidates.end());
+
+    VkDeviceSize Freed = 0;
+
+    for(uint32_t i = 0; i < Candidates.size() && Freed < Bytes; i++)
+    {
+      auto Entry = Textures.find(Candidates[i].second);
+
+      Freed += Entry->second.Texture.allocSize;
+      Release(Entry);
+    }
+
+    return Freed;
   }
 }
-
@@ -2,11 +2,15 @@
 
 #include <vector>
 #include <string>
+#include <unordered_map>
 
 #include "Memory.h"
 
 namespace Ek
 {
+  // names a texture in an AssetManager. Never reused, so a handle to something that has been evicted stays invalid. 0 is none
+  typedef uint64_t TextureHandle;
+
   class AssetInterface
   {
     public:
@@ -15,21 +19,70 @@ namespace Ek
 
       virtual void Unload(Ek::Texture& Texture) = 0;
       virtual void Unload(const char* FilePath) = 0;
+
+      // called at the start of every frame, once the last one has finished with everything
+      virtual void Update(uint64_t Frame) = 0;
+
+      // called when memory runs low, frees at least Bytes if it can and returns how much it freed
+      virtual VkDeviceSize Evict(VkDeviceSize Bytes) = 0;
   };
 
+  /*
+    Textures by path, each loaded once and shared. RequestTexture takes a reference that ReleaseTexture gives back.
+    Textures nobody holds a reference to stay loaded as a cache until they have to make room: Update evicts them least
+    recently used first while we're over Budget, Evict when the device runs low on memory. A texture used this frame is
+    never evicted, the frame before it has finished by the time Update runs.
+    Only textures loaded through here can be evicted. Meshes load their albedo themselves (or through the TextureStreamer),
+    so until something registers a manager with vulkanInterface::RegisterAssets the budget eviction has nothing to do.
+  */
   class AssetManager : public AssetInterface
   {
     public:
       void Init(EkBackend::AllocateInterface* Allocator);
+      void Destroy();
 
-      Ek::Texture* RequestTexture(const char* FilePath);
+      // 0 if FilePath can't be loaded
+      TextureHandle RequestTexture(const char* FilePath);
+      void ReleaseTexture(TextureHandle Handle);
 
+      // nullptr once the texture has been evicted or unloaded. Counts as a use this frame
+      Ek::Texture* GetTexture(TextureHandle Handle);
+
+      // drop the texture now, references or not
       void Unload(Ek::Texture& Texture);
       void Unload(const char* FilePath);
 
+      void Update(uint64_t Frame);
+      VkDeviceSize Evict(VkDeviceSize Bytes);
+
+      VkDeviceSize GetResidentBytes() { return ResidentBytes; }
+
+      // bytes of textures we keep around, unreferenced ones are evicted past it. 0 keeps everything until memory runs low
+      VkDeviceSize Budget = 0;
+
     private:
-      // associative array of Texure/FilePath pairs
-      std::vector<std::pair<Ek::Texture, std::string>> Textures;
+      struct TextureEntry
+      {
+        // map nodes never move, so the allocator can keep pointing at it
+        Ek::Texture Texture;
+        std::string Path;
+        uint32_t RefCount = 0;
+        uint64_t LastUsed = 0;
+        // the copy into Texture, it can't be destroyed before the upload queue is done with it
+        Ek::UploadToken Ready = 0;
+      };
+
+      void Release(std::unordered_map<TextureHandle, TextureEntry>::iterator Entry);
+
+      // unreferenced textures not used this frame whose upload has landed, least recently used first
+      VkDeviceSize EvictUnused(VkDeviceSize Bytes);
+
+      std::unordered_map<TextureHandle, TextureEntry> Textures;
+      std::unordered_map<std::string, TextureHandle> Paths;
+
+      TextureHandle NextHandle = 1;
+      uint64_t Frame = 0;
+      VkDeviceSize ResidentBytes = 0;
 
       EkBackend::AllocateInterface* pAllocator;
   };
@@ -41,4 +94,3 @@ class TextureInterface
 {}
 
 */
-
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+
+namespace EkBench
+{
+  /*
+    A MemoryBackend without a device. Memory handles are just counters, binds and destroys do nothing and
+    mapping hands out plain host memory. HeapSize caps how much it gives out so out of memory paths can be hit.
+    Any thread can call it like a real device, the counters are only meant to be read once they're all done.
+  */
+  class FakeBackend : public EkBackend::MemoryBackend
+  {
+    public:
+      ~FakeBackend()
+      {
+        for(auto& Mapping : Mapped)
+        {
+          delete[] Mapping.second;
+        }
+      }
+
+      VkResult AllocateMemory(uint32_t TypeIndex, VkDeviceSize Size, VkImage DedicatedImage, VkBuffer DedicatedBuffer, VkDeviceMemory& Memory)
+      {
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        if(AllocatedBytes + Size > HeapSize)
+        {
+          return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+
+        Memory = (VkDeviceMemory)(uintptr_t)NextHandle++;
+
+        Sizes[Memory] = Size;
+        AllocatedBytes += Size;
+        AllocateCount++;
+
+        if(AllocatedBytes > PeakBytes)
+        {
+          PeakBytes = AllocatedBytes;
+        }
+
+        return VK_SUCCESS;
+      }
+
+      void FreeMemory(VkDeviceMemory Memory)
+      {
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        AllocatedBytes -= Sizes[Memory];
+        Sizes.erase(Memory);
+
+        Unmap(Memory);
+      }
+
+      VkResult MapMemory(VkDeviceMemory Memory, VkDeviceSize Size, void** ppData)
+      {
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        char* Data = new char[Size];
+        Mapped[Memory] = Data;
+
+        *ppData = Data;
+        return VK_SUCCESS;
+      }
+
+      void UnmapMemory(VkDeviceMemory Memory)
+      {
+        std::lock_guard<std::mutex> Guard(Lock);
+
+        Unmap(Memory);
+      }
+
+      void FlushMemory(VkDeviceMemory Memory) {}
+      void InvalidateMemory(VkDeviceMemory Memory) {}
+
+      // the bench always passes its own requirements, these only exist for completeness
+      void GetBufferRequirements(VkBuffer Buffer, VkMemoryRequirements& MemReq) { MemReq = {256, 256, ~0u}; }
+      void GetImageRequirements(VkImage Image, VkMemoryRequirements& MemReq) { MemReq = {65536, 65536, ~0u}; }
+
+      VkResult BindBuffer(VkBuffer Buffer, VkDeviceMemory Memory, VkDeviceSize Offset) { return VK_SUCCESS; }
+      VkResult BindImage(VkImage Image, VkDeviceMemory Memory, VkDeviceSize Offset) { return VK_SUCCESS; }
+
+      void DestroyBuffer(VkBuffer Buffer) {}
+      void DestroyImage(VkImage Image) {}
+
+      bool GetHeapBudgets(VkDeviceSize* pBudgets, VkDeviceSize* pUsages) { return false; }
+
+      VkDeviceSize HeapSize = UINT64_MAX;
+
+      VkDeviceSize AllocatedBytes = 0;
+      VkDeviceSize PeakBytes = 0;
+      uint64_t AllocateCount = 0;
+
+    private:
+      // UnmapMemory without taking Lock
+      void Unmap(VkDeviceMemory Memory)
+      {
+        auto Mapping = Mapped.find(Memory);
+
+        if(Mapping != Mapped.end())
+        {
+          delete[] Mapping->second;
+          Mapped.erase(Mapping);
+        }
+      }
+
+      std::mutex Lock;
+      uint64_t NextHandle = 1;
+
+      std::unordered_map<VkDeviceMemory, VkDeviceSize> Sizes;
+      std::unordered_map<VkDeviceMemory, char*> Mapped;
+  };
+}
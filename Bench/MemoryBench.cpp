@@ -0,0 +1,748 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "FakeBackend.h"
+#include "Memory.h"
+
+/*
+  memory_bench, runs EkBackend::MemoryPool against a fake device.
+
+    memory_bench [--seed N] [--ops N] [--granularity N] [--check] [--threads N] [--trace file]...
+
+  Without --trace it runs the synthetic workloads, with it only the given traces. A trace is what the renderer writes
+  to EK_MEMORY_TRACE, one operation per line:
+
+    a <memory type> <id> <size> <alignment> <linear 0/1>
+    f <memory type> <id>
+
+  Fragmentation is 100 - largest free range * 100 / free bytes over the shared blocks of all pools, the same measure
+  MemoryBlock::AssessFrag uses for one block. Wasted bytes are device memory held minus the bytes the workload asked for.
+  --check validates every live allocation (alignment and overlap) each time stats are sampled and fails on the first error.
+  --threads N replays N synthetic workloads on N threads against the same pools instead, see RunThreaded.
+*/
+
+namespace EkBench
+{
+  struct Op
+  {
+    bool bFree;
+    uint32_t Type;
+    uint64_t Id;
+    VkDeviceSize Size;
+    VkDeviceSize Alignment;
+    bool bLinear;
+  };
+
+  struct Workload
+  {
+    std::string Name;
+    std::vector<Op> Ops;
+  };
+
+  struct Options
+  {
+    uint64_t Seed = 1;
+    uint32_t OpCount = 200000;
+    uint32_t Granularity = 1024;
+    bool bCheck = false;
+    uint32_t Threads = 0;
+    std::vector<std::string> Traces;
+  };
+
+  struct Result
+  {
+    uint64_t Ops = 0;
+    double Ns = 0.0;
+    uint32_t PeakFrag = 0;
+    uint64_t PeakWaste = 0;
+    uint64_t PeakDevice = 0;
+    uint32_t PeakBlocks = 0;
+    uint32_t PeakDedicated = 0;
+    uint64_t Failed = 0;
+    bool bValid = true;
+  };
+
+  // ops are timed in chunks this big, stats are sampled between them
+  static const uint32_t ChunkSize = 1024;
+
+/* Workloads */
+  // hands out ids and keeps track of which are live so frees can pick one at random
+  class LiveSet
+  {
+    public:
+      uint64_t Add()
+      {
+        Ids.push_back(NextId);
+        return NextId++;
+      }
+
+      uint64_t RemoveRandom(std::mt19937_64& Rng)
+      {
+        uint32_t Index = std::uniform_int_distribution<uint32_t>(0, Ids.size() - 1)(Rng);
+        uint64_t Ret = Ids[Index];
+
+        Ids[Index] = Ids.back();
+        Ids.pop_back();
+
+        return Ret;
+      }
+
+      uint32_t Size() { return Ids.size(); }
+
+    private:
+      std::vector<uint64_t> Ids;
+      uint64_t NextId = 1;
+  };
+
+  static Op MakeAlloc(uint64_t Id, VkDeviceSize Size, bool bLinear)
+  {
+    Op Ret;
+    Ret.bFree = false;
+    Ret.Type = 0;
+    Ret.Id = Id;
+    Ret.Size = Size;
+    Ret.bLinear = bLinear;
+
+    // roughly what drivers ask for, buffers want little alignment and images a lot
+    if(bLinear)
+    {
+      Ret.Alignment = 256;
+    }
+    else
+    {
+      Ret.Alignment = (Size > 65536) ? 65536 : 4096;
+    }
+
+    return Ret;
+  }
+
+  static Op MakeFree(uint64_t Id)
+  {
+    Op Ret{};
+    Ret.bFree = true;
+    Ret.Id = Id;
+
+    return Ret;
+  }
+
+  // sizes between MinSize and MaxSize where small ones are far more common, like a scene full of small meshes and a few big textures
+  static uint32_t PowerLawSize(std::mt19937_64& Rng, double Alpha, uint32_t MinSize, uint32_t MaxSize)
+  {
+    double U = std::uniform_real_distribution<double>(1e-9, 1.0)(Rng);
+    double Size = MinSize / std::pow(U, 1.0 / Alpha);
+
+    return (Size > MaxSize) ? MaxSize : (uint32_t)Size;
+  }
+
+  // uniform sizes from 256B to 256KB, random allocs and frees around a steady number of live allocations
+  static Workload Uniform(std::mt19937_64& Rng, uint32_t OpCount)
+  {
+    Workload Ret;
+    Ret.Name = "uniform";
+
+    LiveSet Live;
+    std::uniform_int_distribution<uint32_t> SizeDist(256, 256 * 1024);
+    std::bernoulli_distribution Coin(0.5);
+
+    while(Ret.Ops.size() < OpCount)
+    {
+      double AllocChance = (Live.Size() < 4000) ? 0.6 : 0.4;
+
+      if(Live.Size() == 0 || std::bernoulli_distribution(AllocChance)(Rng))
+      {
+        Ret.Ops.push_back(MakeAlloc(Live.Add(), SizeDist(Rng), Coin(Rng)));
+      }
+      else
+      {
+        Ret.Ops.push_back(MakeFree(Live.RemoveRandom(Rng)));
+      }
+    }
+
+    return Ret;
+  }
+
+  // power law sizes from 512B to 64MB, same steady state as Uniform
+  static Workload PowerLaw(std::mt19937_64& Rng, uint32_t OpCount)
+  {
+    Workload Ret;
+    Ret.Name = "powerlaw";
+
+    LiveSet Live;
+    std::bernoulli_distribution Coin(0.5);
+
+    while(Ret.Ops.size() < OpCount)
+    {
+      double AllocChance = (Live.Size() < 2000) ? 0.6 : 0.4;
+
+      if(Live.Size() == 0 || std::bernoulli_distribution(AllocChance)(Rng))
+      {
+        Ret.Ops.push_back(MakeAlloc(Live.Add(), PowerLawSize(Rng, 1.2, 512, 64000000), Coin(Rng)));
+      }
+      else
+      {
+        Ret.Ops.push_back(MakeFree(Live.RemoveRandom(Rng)));
+      }
+    }
+
+    return Ret;
+  }
+
+  // level loads, every round unloads half of what's resident and streams in as much new content
+  static Workload Churn(std::mt19937_64& Rng, uint32_t OpCount)
+  {
+    Workload Ret;
+    Ret.Name = "churn";
+
+    LiveSet Live;
+    const uint32_t LevelSize = 1500;
+
+    // mostly textures, a mesh has one vertex and one index buffer
+    std::bernoulli_distribution Linear(0.3);
+
+    for(uint32_t i = 0; i < LevelSize; i++)
+    {
+      Ret.Ops.push_back(MakeAlloc(Live.Add(), PowerLawSize(Rng, 1.1, 4096, 32000000), Linear(Rng)));
+    }
+
+    while(Ret.Ops.size() < OpCount)
+    {
+      for(uint32_t i = 0; i < LevelSize / 2; i++)
+      {
+        Ret.Ops.push_back(MakeFree(Live.RemoveRandom(Rng)));
+      }
+
+      for(uint32_t i = 0; i < LevelSize / 2; i++)
+      {
+        Ret.Ops.push_back(MakeAlloc(Live.Add(), PowerLawSize(Rng, 1.1, 4096, 32000000), Linear(Rng)));
+      }
+    }
+
+    return Ret;
+  }
+
+  static bool LoadTrace(const std::string& Path, Workload& Out)
+  {
+    std::ifstream File(Path);
+
+    if(!File.is_open())
+    {
+      return false;
+    }
+
+    Out.Name = Path.substr(Path.find_last_of('/') + 1);
+
+    std::string Kind;
+
+    while(File >> Kind)
+    {
+      Op Curr{};
+
+      if(Kind == "a")
+      {
+        uint32_t Linear;
+        File >> Curr.Type >> Curr.Id >> Curr.Size >> Curr.Alignment >> Linear;
+
+        Curr.bLinear = Linear != 0;
+      }
+      else if(Kind == "f")
+      {
+        Curr.bFree = true;
+        File >> Curr.Type >> Curr.Id;
+      }
+      else
+      {
+        std::printf("%s: unknown operation '%s'\n", Path.c_str(), Kind.c_str());
+        return false;
+      }
+
+      Out.Ops.push_back(Curr);
+    }
+
+    return true;
+  }
+/* Workloads */
+
+/* Replay */
+  struct Slot
+  {
+    Ek::Buffer Buff;
+    Ek::Texture Tex;
+
+    VkDeviceSize Size;
+    VkDeviceSize Alignment;
+    bool bLinear;
+
+    Ek::AllocatedObject& Object() { return bLinear ? (Ek::AllocatedObject&)Buff : (Ek::AllocatedObject&)Tex; }
+  };
+
+  // the objects one replay has live, each thread of --threads has its own
+  struct ReplayState
+  {
+    // pointers into a deque stay valid as it grows, the blocks keep pointers to the objects
+    std::deque<Slot> Slots;
+    std::vector<uint32_t> FreeSlots;
+    std::unordered_map<uint64_t, uint32_t> Live;
+
+    uint64_t LiveBytes = 0;
+    uint64_t Failed = 0;
+  };
+
+  // alignment and overlap of every live allocation, across all of States
+  static bool Validate(const std::vector<ReplayState*>& States)
+  {
+    std::vector<std::pair<std::pair<VkDeviceMemory, uint64_t>, uint64_t>> Ranges;
+
+    for(ReplayState* pState : States)
+    {
+      for(auto& Entry : pState->Live)
+      {
+        Slot& Curr = pState->Slots[Entry.second];
+        Ek::AllocatedObject& Object = Curr.Object();
+
+        if(Object.allocOffset % Curr.Alignment != 0)
+        {
+          std::printf("allocation %llu at %llu isn't aligned to %llu\n", (unsigned long long)Entry.first, (unsigned long long)Object.allocOffset, (unsigned long long)Curr.Alignment);
+          return false;
+        }
+
+        if(Object.allocSize < Curr.Size)
+        {
+          std::printf("allocation %llu got %llu bytes but asked for %llu\n", (unsigned long long)Entry.first, (unsigned long long)Object.allocSize, (unsigned long long)Curr.Size);
+          return false;
+        }
+
+        Ranges.push_back({{Object.GetDeviceMemory(), Object.allocOffset}, Object.allocSize});
+      }
+    }
+
+    std::sort(Ranges.begin(), Ranges.end());
+
+    for(uint32_t i = 1; i < Ranges.size(); i++)
+    {
+      if(Ranges[i].first.first == Ranges[i-1].first.first && Ranges[i-1].first.second + Ranges[i-1].second > Ranges[i].first.second)
+      {
+        std::printf("allocations overlap at offset %llu\n", (unsigned long long)Ranges[i].first.second);
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static void Free(ReplayState& State, const Op& Curr)
+  {
+    auto Entry = State.Live.find(Curr.Id);
+
+    // its allocation failed, or the trace started after it was made
+    if(Entry == State.Live.end())
+    {
+      return;
+    }
+
+    Slot& Freed = State.Slots[Entry->second];
+    Freed.Object().Destroy();
+
+    State.LiveBytes -= Freed.Size;
+    State.FreeSlots.push_back(Entry->second);
+    State.Live.erase(Entry);
+  }
+
+  // HandleBase keeps the fake handles of different threads apart
+  static void Allocate(ReplayState& State, EkBackend::MemoryPool* Pool, const Op& Curr, uint64_t HandleBase)
+  {
+    uint32_t Index;
+
+    if(State.FreeSlots.size() > 0)
+    {
+      Index = State.FreeSlots.back();
+      State.FreeSlots.pop_back();
+    }
+    else
+    {
+      Index = State.Slots.size();
+      State.Slots.emplace_back();
+    }
+
+    Slot& New = State.Slots[Index];
+    New.Size = Curr.Size;
+    New.Alignment = Curr.Alignment;
+    New.bLinear = Curr.bLinear;
+
+    VkMemoryRequirements MemReq{};
+    MemReq.size = Curr.Size;
+    MemReq.alignment = Curr.Alignment;
+    MemReq.memoryTypeBits = ~0u;
+
+    bool bAllocated;
+
+    if(Curr.bLinear)
+    {
+      New.Buff.Buffer = (VkBuffer)(uintptr_t)(HandleBase + Index + 1);
+      bAllocated = Pool->AllocateBuffer(New.Buff, MemReq);
+    }
+    else
+    {
+      New.Tex.Image = (VkImage)(uintptr_t)(HandleBase + Index + 1);
+      bAllocated = Pool->AllocateTexture(New.Tex, MemReq);
+    }
+
+    if(!bAllocated)
+    {
+      State.Failed++;
+      State.FreeSlots.push_back(Index);
+      return;
+    }
+
+    State.LiveBytes += Curr.Size;
+    State.Live[Curr.Id] = Index;
+  }
+
+  static void Sample(std::map<uint32_t, EkBackend::MemoryPool*>& Pools, uint64_t Frame, Result& Ret)
+  {
+    EkBackend::MemoryPool::Stats Total;
+
+    for(auto& Entry : Pools)
+    {
+      Entry.second->Trim(Frame);
+
+      EkBackend::MemoryPool::Stats PoolStats;
+      Entry.second->GetStats(PoolStats);
+
+      Total.BlockCount += PoolStats.BlockCount;
+      Total.DedicatedCount += PoolStats.DedicatedCount;
+      Total.FreeBytes += PoolStats.FreeBytes;
+      Total.LargestFree = std::max(Total.LargestFree, PoolStats.LargestFree);
+    }
+
+    if(Total.FreeBytes > 0)
+    {
+      Ret.PeakFrag = std::max<uint32_t>(Ret.PeakFrag, 100 - (uint32_t)((Total.LargestFree * 100) / Total.FreeBytes));
+    }
+
+    Ret.PeakBlocks = std::max(Ret.PeakBlocks, Total.BlockCount);
+    Ret.PeakDedicated = std::max(Ret.PeakDedicated, Total.DedicatedCount);
+  }
+
+  static EkBackend::MemoryPool* NewPool(FakeBackend& Backend, uint32_t Type, const Options& Opts)
+  {
+    EkBackend::MemoryPool* Pool = new EkBackend::MemoryPool;
+    Pool->Init(&Backend, Type, 0, Opts.Granularity);
+
+    // a chunk stands in for a lot of frames, keep empty blocks around for a few chunks instead of 600
+    Pool->EmptyFrameThreshold = 4;
+
+    return Pool;
+  }
+
+  static Result Run(Workload& Load, const Options& Opts)
+  {
+    Result Ret;
+
+    FakeBackend Backend;
+    std::map<uint32_t, EkBackend::MemoryPool*> Pools;
+
+    ReplayState State;
+    uint64_t Frame = 0;
+
+    for(uint32_t Start = 0; Start < Load.Ops.size(); Start += ChunkSize)
+    {
+      uint32_t End = std::min<uint32_t>(Start + ChunkSize, Load.Ops.size());
+
+      std::chrono::steady_clock::time_point Begin = std::chrono::steady_clock::now();
+
+      for(uint32_t i = Start; i < End; i++)
+      {
+        Op& Curr = Load.Ops[i];
+
+        if(Curr.bFree)
+        {
+          Free(State, Curr);
+          continue;
+        }
+
+        EkBackend::MemoryPool*& Pool = Pools[Curr.Type];
+
+        if(Pool == nullptr)
+        {
+          Pool = NewPool(Backend, Curr.Type, Opts);
+        }
+
+        Allocate(State, Pool, Curr, 0);
+      }
+
+      Ret.Ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - Begin).count();
+      Ret.Ops += End - Start;
+
+      Frame++;
+      Sample(Pools, Frame, Ret);
+
+      Ret.PeakWaste = std::max<uint64_t>(Ret.PeakWaste, Backend.AllocatedBytes - State.LiveBytes);
+
+      if(Opts.bCheck && !Validate({&State}))
+      {
+        Ret.bValid = false;
+        break;
+      }
+    }
+
+    Ret.PeakDevice = Backend.PeakBytes;
+    Ret.Failed = State.Failed;
+
+    // synthetic workloads end in their steady state, whatever is left goes outside the timing
+    for(auto& Entry : State.Live)
+    {
+      State.Slots[Entry.second].Object().Destroy();
+    }
+
+    for(auto& Entry : Pools)
+    {
+      Entry.second->Destroy();
+      delete Entry.second;
+    }
+
+    return Ret;
+  }
+
+  /*
+    Every workload at once, each on its own thread against the same pools, while this thread trims and samples them the way
+    the render thread would. Meant to be built with -fsanitize=thread to check the pool's locking. ns/op is wall time over
+    all the threads' ops and waste isn't measured, the threads' live bytes are only known once they're done.
+    With --check every thread validates its own allocations between chunks, and all of them together at the end.
+  */
+  static Result RunThreaded(std::vector<Workload>& Loads, const Options& Opts)
+  {
+    Result Ret;
+
+    FakeBackend Backend;
+    std::map<uint32_t, EkBackend::MemoryPool*> Pools;
+
+    // created up front, the map isn't safe to grow while the threads look things up in it
+    for(Workload& Load : Loads)
+    {
+      for(Op& Curr : Load.Ops)
+      {
+        if(!Curr.bFree && Pools.find(Curr.Type) == Pools.end())
+        {
+          Pools[Curr.Type] = NewPool(Backend, Curr.Type, Opts);
+        }
+      }
+    }
+
+    std::vector<ReplayState> States(Loads.size());
+    std::atomic<uint32_t> Running(Loads.size());
+    std::atomic<bool> bValid(true);
+    std::vector<std::thread> Threads;
+
+    std::chrono::steady_clock::time_point Begin = std::chrono::steady_clock::now();
+
+    for(uint32_t t = 0; t < Loads.size(); t++)
+    {
+      Threads.emplace_back([&, t]()
+      {
+        ReplayState& State = States[t];
+        std::vector<Op>& Ops = Loads[t].Ops;
+
+        for(uint32_t i = 0; i < Ops.size() && bValid; i++)
+        {
+          if(Ops[i].bFree)
+          {
+            Free(State, Ops[i]);
+          }
+          else
+          {
+            Allocate(State, Pools.at(Ops[i].Type), Ops[i], (uint64_t)t << 32);
+          }
+
+          if(Opts.bCheck && i % ChunkSize == ChunkSize - 1 && !Validate({&State}))
+          {
+            bValid = false;
+          }
+        }
+
+        Running--;
+      });
+    }
+
+    uint64_t Frame = 0;
+
+    // a frame is a lot longer than this, but the point is to have Trim run while the threads are busy
+    while(Running > 0)
+    {
+      Frame++;
+      Sample(Pools, Frame, Ret);
+
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    for(uint32_t t = 0; t < Threads.size(); t++)
+    {
+      Threads[t].join();
+    }
+
+    Ret.Ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - Begin).count();
+
+    std::vector<ReplayState*> All;
+
+    for(uint32_t t = 0; t < Loads.size(); t++)
+    {
+      Ret.Ops += Loads[t].Ops.size();
+      Ret.Failed += States[t].Failed;
+
+      All.push_back(&States[t]);
+    }
+
+    Ret.bValid = bValid && (!Opts.bCheck || Validate(All));
+    Ret.PeakDevice = Backend.PeakBytes;
+
+    for(ReplayState& State : States)
+    {
+      for(auto& Entry : State.Live)
+      {
+        State.Slots[Entry.second].Object().Destroy();
+      }
+    }
+
+    for(auto& Entry : Pools)
+    {
+      Entry.second->Destroy();
+      delete Entry.second;
+    }
+
+    return Ret;
+  }
+/* Replay */
+}
+
+int main(int argc, char** argv)
+{
+  EkBench::Options Opts;
+
+  for(int i = 1; i < argc; i++)
+  {
+    bool bHasValue = i + 1 < argc;
+
+    if(strcmp(argv[i], "--seed") == 0 && bHasValue)
+    {
+      Opts.Seed = std::stoull(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--ops") == 0 && bHasValue)
+    {
+      Opts.OpCount = std::stoul(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--granularity") == 0 && bHasValue)
+    {
+      Opts.Granularity = std::stoul(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--trace") == 0 && bHasValue)
+    {
+      Opts.Traces.push_back(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && bHasValue)
+    {
+      Opts.Threads = std::stoul(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--check") == 0)
+    {
+      Opts.bCheck = true;
+    }
+    else
+    {
+      std::printf("usage: %s [--seed N] [--ops N] [--granularity N] [--check] [--threads N] [--trace file]...\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if(Opts.Threads > 0 && Opts.Traces.size() > 0)
+  {
+    std::printf("--threads only runs the synthetic workloads\n");
+    return 1;
+  }
+
+  std::vector<EkBench::Workload> Workloads;
+
+  if(Opts.Traces.size() > 0)
+  {
+    for(uint32_t i = 0; i < Opts.Traces.size(); i++)
+    {
+      EkBench::Workload Load;
+
+      if(!EkBench::LoadTrace(Opts.Traces[i], Load))
+      {
+        std::printf("failed to read trace %s\n", Opts.Traces[i].c_str());
+        return 1;
+      }
+
+      Workloads.push_back(Load);
+    }
+  }
+  else if(Opts.Threads > 0)
+  {
+    // a mix, so small allocations go through the thread chunks while big ones grow the pool and make dedicated blocks
+    for(uint32_t t = 0; t < Opts.Threads; t++)
+    {
+      std::mt19937_64 Rng(Opts.Seed + t);
+
+      switch(t % 3)
+      {
+        case 0: Workloads.push_back(EkBench::Uniform(Rng, Opts.OpCount)); break;
+        case 1: Workloads.push_back(EkBench::PowerLaw(Rng, Opts.OpCount)); break;
+        case 2: Workloads.push_back(EkBench::Churn(Rng, Opts.OpCount)); break;
+      }
+    }
+  }
+  else
+  {
+    std::mt19937_64 Rng(Opts.Seed);
+
+    Workloads.push_back(EkBench::Uniform(Rng, Opts.OpCount));
+    Workloads.push_back(EkBench::PowerLaw(Rng, Opts.OpCount));
+    Workloads.push_back(EkBench::Churn(Rng, Opts.OpCount));
+  }
+
+  std::printf("%-12s %10s %8s %10s %12s %12s %7s %10s %7s\n", "workload", "ops", "ns/op", "peak frag", "peak waste", "peak device", "blocks", "dedicated", "failed");
+
+  int Ret = 0;
+
+  if(Opts.Threads > 0)
+  {
+    EkBench::Result Res = EkBench::RunThreaded(Workloads, Opts);
+    std::string Name = "threads/" + std::to_string(Opts.Threads);
+
+    std::printf("%-12s %10llu %8.1f %9u%% %12s %10.1fMB %7u %10u %7llu\n", Name.c_str(), (unsigned long long)Res.Ops, Res.Ns / std::max<uint64_t>(Res.Ops, 1), Res.PeakFrag, "-", Res.PeakDevice / 1e6, Res.PeakBlocks, Res.PeakDedicated, (unsigned long long)Res.Failed);
+
+    if(!Res.bValid)
+    {
+      std::printf("%s: allocator state is invalid\n", Name.c_str());
+      return 1;
+    }
+
+    return 0;
+  }
+
+  for(uint32_t i = 0; i < Workloads.size(); i++)
+  {
+    EkBench::Result Res = EkBench::Run(Workloads[i], Opts);
+
+    std::printf("%-12s %10llu %8.1f %9u%% %10.1fMB %10.1fMB %7u %10u %7llu\n", Workloads[i].Name.c_str(), (unsigned long long)Res.Ops, Res.Ns / std::max<uint64_t>(Res.Ops, 1), Res.PeakFrag, Res.PeakWaste / 1e6, Res.PeakDevice / 1e6, Res.PeakBlocks, Res.PeakDedicated, (unsigned long long)Res.Failed);
+
+    if(!Res.bValid)
+    {
+      std::printf("%s: allocator state is invalid\n", Workloads[i].Name.c_str());
+      Ret = 1;
+    }
+  }
+
+  return Ret;
+}
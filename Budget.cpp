@@ -0,0 +1,161 @@
+#include "Budget.h"
+
+#include <vulkan/vulkan_core.h>
+
+namespace EkBackend
+{
+  void MemoryBudget::Init(MemoryBackend* inBackend, const VkPhysicalDeviceMemoryProperties& Properties)
+  {
+    pBackend = inBackend;
+    HeapCount = Properties.memoryHeapCount;
+
+    for(uint32_t i = 0; i < HeapCount; i++)
+    {
+      Heaps[i].Budget = 0;
+      Heaps[i].Usage = 0;
+      Heaps[i].BlockBytes = 0;
+      Heaps[i].AllocationBytes = 0;
+      Heaps[i].PolledUsage = 0;
+      Heaps[i].PolledBlockBytes = 0;
+
+      for(uint32_t x = 0; x < Ek::eMemoryCategoryCount; x++)
+      {
+        Heaps[i].Categories[x] = 0;
+      }
+
+      Heaps[i].Size = Properties.memoryHeaps[i].size;
+      Heaps[i].bDeviceLocal = Properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+    }
+
+    Update();
+  }
+
+  void MemoryBudget::Update()
+  {
+    VkDeviceSize Budgets[VK_MAX_MEMORY_HEAPS] = {};
+    VkDeviceSize Usages[VK_MAX_MEMORY_HEAPS] = {};
+
+    bool bPolled = pBackend->GetHeapBudgets(Budgets, Usages);
+
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    bMemoryBudget = bPolled;
+
+    if(!bMemoryBudget)
+    {
+      for(uint32_t i = 0; i < HeapCount; i++)
+      {
+        Heaps[i].Budget = Heaps[i].Size / 10 * 8;
+        Heaps[i].Usage = Heaps[i].BlockBytes;
+      }
+
+      return;
+    }
+
+    for(uint32_t i = 0; i < HeapCount; i++)
+    {
+      // some drivers report 0 for heaps they don't track, the heap size is the best we can do then
+      Heaps[i].Budget = (Budgets[i] != 0) ? Budgets[i] : Heaps[i].Size / 10 * 8;
+
+      Heaps[i].PolledUsage = Usages[i];
+      Heaps[i].PolledBlockBytes = Heaps[i].BlockBytes;
+      Heaps[i].Usage = Heaps[i].PolledUsage;
+    }
+  }
+
+  void MemoryBudget::TrackBlock(uint32_t HeapIndex, VkDeviceSize Size, bool bFreed)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    HeapInfo& Heap = Heaps[HeapIndex];
+
+    Heap.BlockBytes = bFreed ? Heap.BlockBytes - Size : Heap.BlockBytes + Size;
+
+    if(!bMemoryBudget)
+    {
+      Heap.Usage = Heap.BlockBytes;
+      return;
+    }
+
+    // the driver's number is a frame old, adjust it by what we did since
+    int64_t Delta = (int64_t)Heap.BlockBytes - (int64_t)Heap.PolledBlockBytes;
+
+    Heap.Usage = ((int64_t)Heap.PolledUsage + Delta > 0) ? Heap.PolledUsage + Delta : 0;
+  }
+
+  void MemoryBudget::TrackAllocation(uint32_t HeapIndex, Ek::eMemoryCategory Category, VkDeviceSize Size, bool bFreed)
+  {
+    HeapInfo& Heap = Heaps[HeapIndex];
+
+    if(bFreed)
+    {
+      Heap.AllocationBytes -= Size;
+      Heap.Categories[Category] -= Size;
+    }
+    else
+    {
+      Heap.AllocationBytes += Size;
+      Heap.Categories[Category] += Size;
+    }
+  }
+
+  bool MemoryBudget::Fits(uint32_t HeapIndex, VkDeviceSize Size)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return Heaps[HeapIndex].Usage + Size <= Heaps[HeapIndex].Budget;
+  }
+
+  float MemoryBudget::GetPressure()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    float Ret = 0.f;
+
+    for(uint32_t i = 0; i < HeapCount; i++)
+    {
+      if(Heaps[i].bDeviceLocal && Heaps[i].Budget > 0)
+      {
+        float Pressure = (float)Heaps[i].Usage / (float)Heaps[i].Budget;
+
+        if(Pressure > Ret)
+        {
+          Ret = Pressure;
+        }
+      }
+    }
+
+    return Ret;
+  }
+
+  VkDeviceSize MemoryBudget::GetExcess(float Fraction)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    VkDeviceSize Ret = 0;
+
+    for(uint32_t i = 0; i < HeapCount; i++)
+    {
+      VkDeviceSize Target = (VkDeviceSize)(Heaps[i].Budget * Fraction);
+
+      if(Heaps[i].bDeviceLocal && Heaps[i].Usage > Target)
+      {
+        Ret += Heaps[i].Usage - Target;
+      }
+    }
+
+    return Ret;
+  }
+
+  VkDeviceSize MemoryBudget::GetCategoryUsage(Ek::eMemoryCategory Category)
+  {
+    VkDeviceSize Ret = 0;
+
+    for(uint32_t i = 0; i < HeapCount; i++)
+    {
+      Ret += Heaps[i].Categories[Category];
+    }
+
+    return Ret;
+  }
+}
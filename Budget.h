@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+
+namespace EkBackend
+{
+  /*
+    Keeps track of how much memory every heap has to give and how much of it we are using.
+    With VK_EXT_memory_budget the driver tells us the budget and the process wide usage (through MemoryBackend::GetHeapBudgets),
+    which includes memory that isn't ours like the swapchain. Update() polls it once a frame, the blocks allocated in
+    between are added on top so the numbers don't lag a frame behind.
+    Without the extension the budget is 80% of the heap size and the usage is what our own blocks add up to.
+    Usage per category only counts bytes handed out to resources, not the free space inside blocks.
+    Allocations can be tracked from any thread. Those counters are atomics, everything else is behind Lock.
+  */
+  class MemoryBudget
+  {
+    public:
+      struct HeapInfo
+      {
+        VkDeviceSize Size = 0;
+        VkDeviceSize Budget = 0;
+        VkDeviceSize Usage = 0;
+
+        // VkDeviceMemory we allocated, and how much of it is handed out to resources
+        VkDeviceSize BlockBytes = 0;
+        std::atomic<VkDeviceSize> AllocationBytes{0};
+        std::atomic<VkDeviceSize> Categories[Ek::eMemoryCategoryCount] = {};
+
+        bool bDeviceLocal = false;
+
+        // driver usage and our block bytes at the last poll
+        VkDeviceSize PolledUsage = 0;
+        VkDeviceSize PolledBlockBytes = 0;
+      };
+
+      void Init(MemoryBackend* inBackend, const VkPhysicalDeviceMemoryProperties& Properties);
+      void Update();
+
+      void TrackBlock(uint32_t HeapIndex, VkDeviceSize Size, bool bFreed);
+      void TrackAllocation(uint32_t HeapIndex, Ek::eMemoryCategory Category, VkDeviceSize Size, bool bFreed);
+
+      // whether a new block of Size still fits in the heap's budget
+      bool Fits(uint32_t HeapIndex, VkDeviceSize Size);
+
+      // highest Usage / Budget of the device local heaps
+      float GetPressure();
+      // bytes the device local heaps need to shed to get every one of them down to Fraction of its budget
+      VkDeviceSize GetExcess(float Fraction);
+
+      VkDeviceSize GetCategoryUsage(Ek::eMemoryCategory Category);
+
+      uint32_t GetHeapCount() { return HeapCount; }
+      const HeapInfo& GetHeap(uint32_t HeapIndex) { return Heaps[HeapIndex]; }
+
+    private:
+      MemoryBackend* pBackend;
+      bool bMemoryBudget = false;
+
+      std::mutex Lock;
+
+      uint32_t HeapCount = 0;
+      HeapInfo Heaps[VK_MAX_MEMORY_HEAPS];
+  };
+}
@@ -23,7 +23,7 @@ namespace Ek
     Position = glm::vec3(0.f);
   }
 
-  VkResult Camera::Init(VkDevice& inDevice, VkExtent2D CameraSize, VkDescriptorSet& inShaderDescriptor, uint32_t Binding, EkBackend::MemoryBlock& Memory)
+  VkResult Camera::Init(VkDevice& inDevice, VkExtent2D CameraSize, VkDescriptorSet& inShaderDescriptor, uint32_t Binding, EkBackend::AllocateInterface* pAlloc)
   {
     VkResult Err;
 
@@ -61,7 +61,8 @@ namespace Ek
         return Err;
       }
 
-      Memory.AllocateBuffer(CameraBuffer);
+      // rewritten every frame, so we want it device local and mappable if the device allows
+      pAlloc->AllocateBuffer(CameraBuffer, Ek::eGpuMapped);
     }
 
     // Set update structures
@@ -140,7 +141,8 @@ namespace Ek
 
     MVP.View = glm::inverse(CameraMat);
 
-    MVP.Projection = glm::perspective(glm::radians(70.f), (float)Width/(float)Height, 0.1f, 1000.f);
+    // the sky sphere's node scales it to a radius of about 3600, the far plane has to be past that from anywhere near the middle
+    MVP.Projection = glm::perspective(glm::radians(70.f), (float)Width/(float)Height, 0.1f, 5000.f);
     MVP.Projection[1][1] *= -1;
 
     MVP.NormalMatrix = glm::transpose(glm::inverse(MVP.World));
@@ -148,6 +150,7 @@ namespace Ek
     MVP.Position = Position;
 
     memcpy(BufferMemory, &MVP, sizeof(MVP));
+    CameraBuffer.Flush(); // no-op unless we landed in non-coherent memory
 
     wvpResource->Update();
     posResource->Update();
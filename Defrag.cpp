@@ -0,0 +1,274 @@
+#include "Interface.h"
+#include "Memory.h"
+#include "Wrappers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vulkan/vulkan_core.h>
+
+/*
+  Incremental defragmentation.
+  Every call picks movable allocations out of the emptiest block of each fragmented pool, gives them a new handle in a
+  fuller block (or lower in the same block), copies the contents over on the graphics queue and then swaps the new
+  handle into the owning Ek::Buffer/Ek::Texture. Owners that hold views or descriptors are told through their MoveListener.
+  The copies go on the graphics queue because that is the family that owns resources once their upload has been acquired.
+*/
+
+namespace Ek
+{
+  namespace
+  {
+    struct DefragMove
+    {
+      Ek::AllocatedObject* pObject;
+      EkBackend::MemoryBlock* pDst;
+      uint32_t DstId;
+
+      // only one of these is set
+      VkBuffer NewBuffer = VK_NULL_HANDLE;
+      VkImage NewImage = VK_NULL_HANDLE;
+    };
+  }
+
+  void vulkanInterface::Defragment(uint32_t BudgetUs)
+  {
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+    auto Elapsed = [&Start]()
+    {
+      return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+    };
+
+    if(!bDefragCmd)
+    {
+      DefragCmd = GetCommandBuffer(Ek::eGraphics);
+      bDefragCmd = true;
+    }
+
+    DefragStalled.resize(MemoryPools.size(), UINT64_MAX);
+
+    std::vector<DefragMove> Moves;
+    std::vector<EkBackend::MemHeader*> Skipped;
+    uint64_t Bytes = 0;
+
+    for(uint32_t i = 0; i < MemoryPools.size() && Elapsed() < BudgetUs && Bytes < DefragBytes; i++)
+    {
+      EkBackend::MemoryPool* Pool = MemoryPools[i];
+
+      if(Pool == nullptr || DefragStalled[i] == Pool->GetVersion() || !Pool->NeedsDefrag(DefragThreshold))
+      {
+        continue;
+      }
+
+      uint32_t PoolMoves = 0;
+      bool bExhausted = false;
+
+      while(Elapsed() < BudgetUs && Bytes < DefragBytes)
+      {
+        EkBackend::MemoryBlock* pSrc;
+        EkBackend::MemHeader* Header = Pool->FindMoveCandidate(pSrc);
+
+        if(Header == nullptr)
+        {
+          bExhausted = true;
+          break;
+        }
+
+        // one big move shouldn't blow the budget, unless it's the only thing we'd do this frame
+        if(Header->MemorySize > DefragBytes - Bytes && Moves.size() > 0)
+        {
+          Skipped.push_back(Header);
+          continue;
+        }
+
+        DefragMove Move;
+        Move.pObject = Header->pObject;
+
+        VkMemoryRequirements MemReq;
+
+        if(Header->bLinear)
+        {
+          Ek::Buffer* pBuff = dynamic_cast<Ek::Buffer*>(Header->pObject);
+          Ek::Buffer NewBuff;
+
+          if(pBuff == nullptr || (pBuff->Usage & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)) != (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT) || CreateBuffer(NewBuff, pBuff->Size, pBuff->Usage) != VK_SUCCESS)
+          {
+            Skipped.push_back(Header);
+            continue;
+          }
+
+          Move.NewBuffer = NewBuff.Buffer;
+          vkGetBufferMemoryRequirements(Device, Move.NewBuffer, &MemReq);
+        }
+        else
+        {
+          Ek::Texture* pTex = dynamic_cast<Ek::Texture*>(Header->pObject);
+          Ek::Texture NewTex;
+
+          // an image that was never written has no layout to go back to, and depth images would need their own aspect
+          if(pTex == nullptr || pTex->Layout == VK_IMAGE_LAYOUT_UNDEFINED || (pTex->Usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT) || (pTex->Usage & (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT)) != (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT) || CreateImage(NewTex, pTex->Format, pTex->Extent, pTex->Usage, pTex->MipLevels) != VK_SUCCESS)
+          {
+            Skipped.push_back(Header);
+            continue;
+          }
+
+          Move.NewImage = NewTex.Image;
+          vkGetImageMemoryRequirements(Device, Move.NewImage, &MemReq);
+        }
+
+        Move.pDst = Pool->ReserveMove(pSrc, Header, MemReq, Move.DstId);
+
+        if(Move.pDst == nullptr)
+        {
+          if(Move.NewBuffer != VK_NULL_HANDLE)
+          {
+            vkDestroyBuffer(Device, Move.NewBuffer, nullptr);
+          }
+          else
+          {
+            vkDestroyImage(Device, Move.NewImage, nullptr);
+          }
+
+          Skipped.push_back(Header);
+          continue;
+        }
+
+        if(Moves.size() == 0)
+        {
+          DefragCmd.BeginCommand();
+        }
+
+        if(Move.NewBuffer != VK_NULL_HANDLE)
+        {
+          Ek::Buffer* pBuff = (Ek::Buffer*)Move.pObject;
+
+          vkBindBufferMemory(Device, Move.NewBuffer, Move.pDst->GetAllocation(), Move.pDst->GetOffset(Move.DstId));
+
+          VkBufferCopy CopyInfo{};
+          CopyInfo.size = pBuff->Size;
+
+          vkCmdCopyBuffer(DefragCmd.Buffer, pBuff->Buffer, Move.NewBuffer, 1, &CopyInfo);
+        }
+        else
+        {
+          Ek::Texture* pTex = (Ek::Texture*)Move.pObject;
+
+          vkBindImageMemory(Device, Move.NewImage, Move.pDst->GetAllocation(), Move.pDst->GetOffset(Move.DstId));
+
+          VkImageMemoryBarrier Barriers[2]{};
+
+          for(uint32_t x = 0; x < 2; x++)
+          {
+            Barriers[x].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            Barriers[x].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            Barriers[x].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            Barriers[x].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            Barriers[x].subresourceRange.baseMipLevel = pTex->BaseLevel;
+            Barriers[x].subresourceRange.levelCount = pTex->MipLevels - pTex->BaseLevel;
+            Barriers[x].subresourceRange.layerCount = 1;
+          }
+
+          Barriers[0].image = pTex->Image;
+          Barriers[0].oldLayout = pTex->Layout;
+          Barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+          Barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+          Barriers[1].image = Move.NewImage;
+          Barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+          Barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+          Barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+          vkCmdPipelineBarrier(DefragCmd.Buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, Barriers);
+
+          // levels a streamed texture doesn't have yet hold nothing worth copying
+          std::vector<VkImageCopy> Copies(pTex->MipLevels - pTex->BaseLevel);
+
+          for(uint32_t i = 0; i < Copies.size(); i++)
+          {
+            uint32_t Level = pTex->BaseLevel + i;
+
+            Copies[i].srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            Copies[i].srcSubresource.mipLevel = Level;
+            Copies[i].srcSubresource.layerCount = 1;
+            Copies[i].dstSubresource = Copies[i].srcSubresource;
+            Copies[i].extent = VkExtent3D{std::max(pTex->Extent.width >> Level, 1u), std::max(pTex->Extent.height >> Level, 1u), 1};
+          }
+
+          vkCmdCopyImage(DefragCmd.Buffer, pTex->Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, Move.NewImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, Copies.size(), Copies.data());
+
+          // the new image takes over the layout the old one had
+          Barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+          Barriers[1].newLayout = pTex->Layout;
+          Barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          Barriers[1].dstAccessMask = 0;
+
+          vkCmdPipelineBarrier(DefragCmd.Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barriers[1]);
+        }
+
+        Bytes += Header->MemorySize;
+        Moves.push_back(Move);
+        PoolMoves++;
+      }
+
+      if(bExhausted && PoolMoves == 0)
+      {
+        DefragStalled[i] = Pool->GetVersion();
+      }
+    }
+
+    // headers we looked at but didn't move can be picked again next frame
+    for(uint32_t i = 0; i < Skipped.size(); i++)
+    {
+      Skipped[i]->bMoving = false;
+    }
+
+    if(Moves.size() == 0)
+    {
+      return;
+    }
+
+    DefragCmd.EndComand();
+    DefragCmd.FenceWait();
+
+    for(uint32_t i = 0; i < Moves.size(); i++)
+    {
+      if(Moves[i].NewBuffer != VK_NULL_HANDLE)
+      {
+        Ek::Buffer* pBuff = (Ek::Buffer*)Moves[i].pObject;
+        VkBuffer Old = pBuff->Buffer;
+
+        pBuff->Buffer = Moves[i].NewBuffer;
+        Moves[i].pDst->Adopt(*pBuff, Moves[i].DstId);
+
+        vkDestroyBuffer(Device, Old, nullptr);
+      }
+      else
+      {
+        Ek::Texture* pTex = (Ek::Texture*)Moves[i].pObject;
+        VkImage Old = pTex->Image;
+
+        pTex->Image = Moves[i].NewImage;
+        Moves[i].pDst->Adopt(*pTex, Moves[i].DstId);
+
+        vkDestroyImage(Device, Old, nullptr);
+      }
+
+      if(Moves[i].pObject->pMoveListener != nullptr)
+      {
+        Moves[i].pObject->pMoveListener->OnMove(Moves[i].pObject);
+      }
+    }
+
+    // the copies are the slow part, so scale how much we copy per call to what the budget allows
+    uint64_t Took = Elapsed();
+
+    if(Took > BudgetUs && DefragBytes > 256000)
+    {
+      DefragBytes /= 2;
+    }
+    else if(Took < BudgetUs / 2 && Bytes >= DefragBytes && DefragBytes < 64000000)
+    {
+      DefragBytes *= 2;
+    }
+  }
+}
@@ -0,0 +1,263 @@
+#include "Geometry.h"
+
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+namespace EkBackend
+{
+  static const VkBufferUsageFlags VertexUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  static const VkBufferUsageFlags IndexUsage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  VkResult GeometryArena::Init(VkDevice& inDevice, AllocateInterface* inAlloc, VkQueue& GraphicsQueue, uint32_t inGraphicsFamily, uint32_t inVertexStride, VkDeviceSize VertexBytes, VkDeviceSize IndexBytes)
+  {
+    VkResult Err;
+
+    pDevice = &inDevice;
+    pAlloc = inAlloc;
+    pGraphicsQueue = &GraphicsQueue;
+    GraphicsFamily = inGraphicsFamily;
+
+    VertexStride = inVertexStride;
+
+    // whole vertices only, so a range can't end in the middle of one
+    VertexBytes -= VertexBytes % VertexStride;
+
+    pVertexBuffer = new Ek::Buffer;
+    pIndexBuffer = new Ek::Buffer;
+
+    pVertexBuffer->Category = Ek::eMemoryMesh;
+    pIndexBuffer->Category = Ek::eMemoryMesh;
+
+    if((Err = pAlloc->CreateBuffer(*pVertexBuffer, VertexBytes, VertexUsage)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    if((Err = pAlloc->CreateBuffer(*pIndexBuffer, IndexBytes, IndexUsage)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    pAlloc->AllocateBuffer(*pVertexBuffer, Ek::eGpuOnly);
+    pAlloc->AllocateBuffer(*pIndexBuffer, Ek::eGpuOnly);
+
+    VertexHeap.Init(VertexBytes, 1);
+    IndexHeap.Init(IndexBytes, 1);
+
+    return VK_SUCCESS;
+  }
+
+  void GeometryArena::Destroy()
+  {
+    if(pVertexBuffer == nullptr)
+    {
+      return;
+    }
+
+    pVertexBuffer->Destroy();
+    pIndexBuffer->Destroy();
+
+    delete pVertexBuffer;
+    delete pIndexBuffer;
+
+    pVertexBuffer = nullptr;
+    pIndexBuffer = nullptr;
+
+    ReleaseRetired();
+
+    VertexHeap.Destroy();
+    IndexHeap.Destroy();
+  }
+
+  Ek::GeometryRange GeometryArena::Allocate(uint32_t VertexCount, uint32_t IndexCount, VkIndexType IndexType)
+  {
+    Ek::GeometryRange Ret;
+
+    VkDeviceSize VertexBytes = (VkDeviceSize)VertexCount * VertexStride;
+    VkDeviceSize IndexBytes = (VkDeviceSize)IndexCount * GetIndexSize(IndexType);
+
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(VertexCount > 0)
+    {
+      if((Ret.pVertices = VertexHeap.Allocate(VertexBytes, VertexStride, true)) == nullptr)
+      {
+        Grow(pVertexBuffer, VertexHeap, VertexBytes + VertexStride, VertexStride);
+
+        if((Ret.pVertices = VertexHeap.Allocate(VertexBytes, VertexStride, true)) == nullptr)
+        {
+          throw std::runtime_error("failed to allocate " + std::to_string(VertexBytes) + " bytes of vertex data from the geometry arena");
+        }
+      }
+
+      Ret.VertexOffset = (uint32_t)(Ret.pVertices->Start / VertexStride);
+      Ret.VertexCount = VertexCount;
+    }
+
+    if(IndexCount > 0)
+    {
+      if((Ret.pIndices = IndexHeap.Allocate(IndexBytes, sizeof(uint32_t), true)) == nullptr)
+      {
+        Grow(pIndexBuffer, IndexHeap, IndexBytes + sizeof(uint32_t), sizeof(uint32_t));
+
+        if((Ret.pIndices = IndexHeap.Allocate(IndexBytes, sizeof(uint32_t), true)) == nullptr)
+        {
+          throw std::runtime_error("failed to allocate " + std::to_string(IndexBytes) + " bytes of index data from the geometry arena");
+        }
+      }
+
+      Ret.FirstIndex = (uint32_t)(Ret.pIndices->Start / GetIndexSize(IndexType));
+      Ret.IndexCount = IndexCount;
+      Ret.IndexType = IndexType;
+    }
+
+    return Ret;
+  }
+
+  void GeometryArena::Free(Ek::GeometryRange& Range)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(Range.pVertices != nullptr)
+    {
+      VertexHeap.Free(Range.pVertices);
+    }
+
+    if(Range.pIndices != nullptr)
+    {
+      IndexHeap.Free(Range.pIndices);
+    }
+
+    Range = Ek::GeometryRange();
+  }
+
+  Ek::UploadToken GeometryArena::Upload(Ek::GeometryRange& Range, const void* pVertices, const void* pIndices)
+  {
+    // a Grow on another thread would swap the buffers out from under the copy
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(Range.pVertices != nullptr)
+    {
+      pAlloc->UploadBuffer(*pVertexBuffer, pVertices, (VkDeviceSize)Range.VertexCount * VertexStride, Range.pVertices->Start);
+    }
+
+    if(Range.pIndices != nullptr)
+    {
+      pAlloc->UploadBuffer(*pIndexBuffer, pIndices, (VkDeviceSize)Range.IndexCount * GetIndexSize(Range.IndexType), Range.pIndices->Start);
+    }
+
+    return pAlloc->GetUploadToken();
+  }
+
+  void GeometryArena::Bind(VkCommandBuffer cmdBuffer)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    VkDeviceSize Offset = 0;
+    vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &pVertexBuffer->Buffer, &Offset);
+    vkCmdBindIndexBuffer(cmdBuffer, pIndexBuffer->Buffer, 0, VK_INDEX_TYPE_UINT32);
+  }
+
+  void GeometryArena::BindIndices(VkCommandBuffer cmdBuffer, VkIndexType IndexType)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    vkCmdBindIndexBuffer(cmdBuffer, pIndexBuffer->Buffer, 0, IndexType);
+  }
+
+  void GeometryArena::ReleaseRetired()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    for(uint32_t i = 0; i < Retired.size(); i++)
+    {
+      Retired[i]->Destroy();
+      delete Retired[i];
+    }
+
+    Retired.clear();
+  }
+
+  void GeometryArena::Grow(Ek::Buffer*& pBuffer, TlsfHeap& Heap, VkDeviceSize Needed, VkDeviceSize Alignment)
+  {
+    VkResult Err;
+
+    VkDeviceSize NewSize = Heap.Size * 2;
+
+    // doubling might not be enough for one really big mesh, the free lists round requests up so leave some slack
+    if(NewSize < Heap.Size + Needed)
+    {
+      NewSize = Heap.Size + Needed * 2;
+    }
+
+    NewSize -= NewSize % Alignment;
+
+    // offsets go into vkCmdDrawIndexed as a vertex/index count, the signed vertexOffset is the tighter of the two
+    if(NewSize / Alignment > INT32_MAX)
+    {
+      throw std::runtime_error("geometry arena can't grow past " + std::to_string((VkDeviceSize)INT32_MAX * Alignment) + " bytes");
+    }
+
+    // nothing may still be writing into the old buffer. Frames can keep reading it while we copy, it stays alive until
+    // ReleaseRetired
+    pAlloc->WaitUpload(pAlloc->GetUploadToken());
+
+    Ek::Buffer* pNew = new Ek::Buffer;
+    pNew->Category = Ek::eMemoryMesh;
+
+    if((Err = pAlloc->CreateBuffer(*pNew, NewSize, pBuffer->Usage)) != VK_SUCCESS)
+    {
+      delete pNew;
+      throw std::runtime_error("Failed to grow the geometry arena: " + std::to_string(Err));
+    }
+
+    pAlloc->AllocateBuffer(*pNew, Ek::eGpuOnly);
+
+    // we might be on a loader thread, the render thread's command pool isn't ours to touch
+    VkCommandPoolCreateInfo PoolCI{};
+    PoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    PoolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    PoolCI.queueFamilyIndex = GraphicsFamily;
+
+    VkCommandPool CopyPool;
+
+    if((Err = vkCreateCommandPool(*pDevice, &PoolCI, nullptr, &CopyPool)) != VK_SUCCESS)
+    {
+      pNew->Destroy();
+      delete pNew;
+      throw std::runtime_error("Failed to grow the geometry arena: " + std::to_string(Err));
+    }
+
+    Ek::Wrappers::CommandBuffer cmdCopy;
+    cmdCopy.Allocate(*pDevice, *pGraphicsQueue, CopyPool, Ek::eGraphics);
+
+    cmdCopy.BeginCommand();
+      VkMemoryBarrier Barrier{};
+      Barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      Barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+      vkCmdPipelineBarrier(cmdCopy.Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+
+      VkBufferCopy CopyInfo{};
+      CopyInfo.size = Heap.Size;
+
+      vkCmdCopyBuffer(cmdCopy.Buffer, pBuffer->Buffer, pNew->Buffer, 1, &CopyInfo);
+
+      Barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+      vkCmdPipelineBarrier(cmdCopy.Buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+    cmdCopy.EndComand();
+
+    cmdCopy.FenceWait();
+    cmdCopy.Delete();
+
+    vkDestroyCommandPool(*pDevice, CopyPool, nullptr);
+
+    Retired.push_back(pBuffer);
+
+    pBuffer = pNew;
+    Heap.Grow(NewSize);
+  }
+}
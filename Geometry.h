@@ -0,0 +1,83 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+#include "Wrappers.h"
+
+namespace Ek
+{
+  // a mesh's slice of the geometry arena, offsets are in vertices/indices so they go straight into vkCmdDrawIndexed.
+  // FirstIndex and IndexCount are in IndexType sized units, with the index buffer bound at offset 0
+  struct GeometryRange
+  {
+    uint32_t VertexOffset = 0;
+    uint32_t VertexCount = 0;
+    uint32_t FirstIndex = 0;
+    uint32_t IndexCount = 0;
+    VkIndexType IndexType = VK_INDEX_TYPE_UINT32;
+
+    EkBackend::MemHeader* pVertices = nullptr;
+    EkBackend::MemHeader* pIndices = nullptr;
+  };
+}
+
+namespace EkBackend
+{
+  /*
+    One vertex buffer and one index buffer that every mesh lives in, so they only get bound once per frame.
+    Each buffer is suballocated by its own TlsfHeap, vertex ranges are aligned to the vertex stride so a range's start
+    is a whole number of vertices. When a buffer runs out of room it is replaced by one twice the size and the old
+    contents are copied over, offsets handed out before stay valid but the buffer handle changes. A frame that is being
+    recorded may have bound the old buffer already, so it's only destroyed by the ReleaseRetired after that frame is done.
+    Allocate, Free and Upload can be called from loader threads, growing uses a command pool of its own for that reason.
+  */
+  class GeometryArena
+  {
+    public:
+      VkResult Init(VkDevice& inDevice, AllocateInterface* inAlloc, VkQueue& GraphicsQueue, uint32_t inGraphicsFamily, uint32_t inVertexStride, VkDeviceSize VertexBytes, VkDeviceSize IndexBytes);
+      void Destroy();
+
+      // throws if the arena can't grow far enough. Growing waits for pending uploads and its own copy, not for frames.
+      // Index ranges always start 4 byte aligned, so a 16 bit range can hold 32 bit indices too as long as they're aligned inside it
+      Ek::GeometryRange Allocate(uint32_t VertexCount, uint32_t IndexCount, VkIndexType IndexType = VK_INDEX_TYPE_UINT32);
+      void Free(Ek::GeometryRange& Range);
+
+      // uploads through the allocator's upload queue, the range is drawable once the token is done
+      Ek::UploadToken Upload(Ek::GeometryRange& Range, const void* pVertices, const void* pIndices);
+
+      // 32 bit indices, the vertex offset is applied per draw
+      void Bind(VkCommandBuffer cmdBuffer);
+      // rebinds the index buffer for ranges of another index type
+      void BindIndices(VkCommandBuffer cmdBuffer, VkIndexType IndexType);
+
+      // destroys the buffers Grow replaced, once every frame recorded before now has finished
+      void ReleaseRetired();
+
+      static uint32_t GetIndexSize(VkIndexType IndexType) { return (IndexType == VK_INDEX_TYPE_UINT16) ? 2 : 4; }
+
+    private:
+      void Grow(Ek::Buffer*& pBuffer, TlsfHeap& Heap, VkDeviceSize Needed, VkDeviceSize Alignment);
+
+      VkDevice* pDevice;
+      AllocateInterface* pAlloc;
+      VkQueue* pGraphicsQueue;
+      uint32_t GraphicsFamily;
+
+      uint32_t VertexStride;
+
+      std::mutex Lock;
+
+      // heap allocated, the memory headers point back at them
+      Ek::Buffer* pVertexBuffer = nullptr;
+      Ek::Buffer* pIndexBuffer = nullptr;
+      // replaced by Grow, frames still in flight may be reading them
+      std::vector<Ek::Buffer*> Retired;
+
+      TlsfHeap VertexHeap;
+      TlsfHeap IndexHeap;
+  };
+}
@@ -1,5 +1,8 @@
 #include "Interface.h"
 #include "Memory.h"
+#include "MeshCache.h"
+#include "MipGenerator.h"
+#include "TextureCooker.h"
 #include "Wrappers.h"
 
 #include <sail-c++/sail-c++.h>
@@ -66,7 +69,7 @@ namespace Ek
 
     for(uint32_t i = 0; i < DevExtensionProperties.size(); i++)
     {
-      if(strcmp(DevExtensionProperties[i].extensionName, pExtension))
+      if(strcmp(DevExtensionProperties[i].extensionName, pExtension) == 0)
       {
         DeviceExtensions.push_back(pExtension);
         return true;
@@ -85,28 +88,201 @@ namespace Ek
 /* Framebuffer/Renderpass */
 
 /* Allocations */
-  void vulkanInterface::AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryType MemType)
+  uint32_t vulkanInterface::FindMemoryType(uint32_t TypeBits, Ek::eMemoryUsage Usage)
   {
-    if(MemType == Ek::eLocalMemory)
+    VkMemoryPropertyFlags Required = 0;
+    VkMemoryPropertyFlags Preferred = 0;
+    VkMemoryPropertyFlags NotPreferred = 0;
+
+    switch(Usage)
     {
-      LocalMemory.AllocateTexture(inTexture);
+      case Ek::eGpuOnly:
+        Preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        NotPreferred = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT; // leave the mappable heaps to resources that need them
+        break;
+
+      case Ek::eUpload:
+        Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        NotPreferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+
+      case Ek::eReadback:
+        Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        Preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        NotPreferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        break;
+
+      case Ek::eGpuMapped:
+        Required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        Preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        break;
+
+      case Ek::eTransient:
+        // lazily allocated memory is only backed once the tile can't hold the attachment, on desktop there is none and we end up in vram
+        Preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+        NotPreferred = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        break;
+
+      default:
+        break;
     }
-    else
+
+    // types with these need special handling, ordinary resources shouldn't land in them
+    VkMemoryPropertyFlags Excluded = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT | VK_MEMORY_PROPERTY_PROTECTED_BIT | VK_MEMORY_PROPERTY_DEVICE_COHERENT_BIT_AMD;
+
+    if(Usage == Ek::eTransient)
     {
-      HostMemory.AllocateTexture(inTexture);
+      Excluded &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    }
+
+    uint32_t BestIndex = UINT32_MAX;
+    uint32_t BestCost = UINT32_MAX;
+
+    for(uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++)
+    {
+      VkMemoryPropertyFlags Flags = MemoryProperties.memoryTypes[i].propertyFlags;
+
+      if(!(TypeBits & (1u << i)) || (Flags & Required) != Required || (Flags & Excluded))
+      {
+        continue;
+      }
+
+      // one point for every preferred flag we're missing and every flag we'd rather not have
+      uint32_t Cost = __builtin_popcount(Preferred & ~Flags) + __builtin_popcount(NotPreferred & Flags);
+
+      if(Cost < BestCost)
+      {
+        BestIndex = i;
+        BestCost = Cost;
+      }
     }
+
+    return BestIndex;
   }
 
-  void vulkanInterface::AllocateBuffer(Ek::Buffer& inBuff, Ek::eMemoryType MemType)
+  EkBackend::MemoryPool* vulkanInterface::GetMemoryPool(uint32_t TypeIndex)
   {
-    if(MemType == Ek::eLocalMemory)
+    // pools are never removed before shutdown, so once one is there we don't need the lock
+    EkBackend::MemoryPool* Ret = MemoryPools[TypeIndex];
+
+    if(Ret != nullptr)
     {
-      LocalMemory.AllocateBuffer(inBuff);
+      return Ret;
     }
-    else
+
+    std::lock_guard<std::mutex> Guard(PoolLock);
+
+    if(MemoryPools[TypeIndex] == nullptr)
     {
-      HostMemory.AllocateBuffer(inBuff);
+      EkBackend::MemoryPool* Pool = new EkBackend::MemoryPool;
+
+      if(MemoryTrace.is_open())
+      {
+        Pool->pTrace = &MemoryTrace;
+      }
+
+      // on big heaps a handful of large blocks beats hundreds of 256MB ones, AddBlock halves the size again if the driver says no
+      VkDeviceSize HeapSize = MemoryProperties.memoryHeaps[MemoryProperties.memoryTypes[TypeIndex].heapIndex].size;
+      Pool->MaxBlockSize = std::max<VkDeviceSize>(Pool->MaxBlockSize, HeapSize / 16);
+
+      if(!Pool->Init(&MemBackend, TypeIndex, MemoryProperties.memoryTypes[TypeIndex].propertyFlags, BufferImageGranularity, MemoryProperties.memoryTypes[TypeIndex].heapIndex, &Budget))
+      {
+        delete Pool;
+        return nullptr;
+      }
+
+      MemoryPools[TypeIndex] = Pool;
     }
+
+    return MemoryPools[TypeIndex];
+  }
+
+  void vulkanInterface::AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryUsage Usage)
+  {
+    // ask the driver whether it would rather give this image memory of its own, render targets usually do
+    VkMemoryDedicatedRequirements DedicatedReq{};
+    DedicatedReq.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 MemReq2{};
+    MemReq2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    MemReq2.pNext = &DedicatedReq;
+
+    VkImageMemoryRequirementsInfo2 ReqInfo{};
+    ReqInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+    ReqInfo.image = inTexture.Image;
+
+    vkGetImageMemoryRequirements2(Device, &ReqInfo, &MemReq2);
+
+    VkMemoryRequirements& MemReq = MemReq2.memoryRequirements;
+    bool bDedicated = DedicatedReq.prefersDedicatedAllocation || DedicatedReq.requiresDedicatedAllocation;
+
+    uint32_t TypeBits = MemReq.memoryTypeBits;
+
+    // if the best type's heap is full we fall back to the next best type the image supports
+    while(TypeBits != 0)
+    {
+      uint32_t TypeIndex = FindMemoryType(TypeBits, Usage);
+
+      if(TypeIndex == UINT32_MAX)
+      {
+        break;
+      }
+
+      EkBackend::MemoryPool* Pool = GetMemoryPool(TypeIndex);
+
+      if(Pool != nullptr && Pool->AllocateTexture(inTexture, MemReq, bDedicated))
+      {
+        inTexture.allocMemoryUsage = Usage;
+        return;
+      }
+
+      TypeBits &= ~(1u << TypeIndex);
+    }
+
+    throw std::runtime_error("failed to allocate texture memory, no compatible memory type has room left");
+  }
+
+  void vulkanInterface::AllocateBuffer(Ek::Buffer& inBuff, Ek::eMemoryUsage Usage)
+  {
+    VkMemoryDedicatedRequirements DedicatedReq{};
+    DedicatedReq.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 MemReq2{};
+    MemReq2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    MemReq2.pNext = &DedicatedReq;
+
+    VkBufferMemoryRequirementsInfo2 ReqInfo{};
+    ReqInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+    ReqInfo.buffer = inBuff.Buffer;
+
+    vkGetBufferMemoryRequirements2(Device, &ReqInfo, &MemReq2);
+
+    VkMemoryRequirements& MemReq = MemReq2.memoryRequirements;
+    bool bDedicated = DedicatedReq.prefersDedicatedAllocation || DedicatedReq.requiresDedicatedAllocation;
+
+    uint32_t TypeBits = MemReq.memoryTypeBits;
+
+    while(TypeBits != 0)
+    {
+      uint32_t TypeIndex = FindMemoryType(TypeBits, Usage);
+
+      if(TypeIndex == UINT32_MAX)
+      {
+        break;
+      }
+
+      EkBackend::MemoryPool* Pool = GetMemoryPool(TypeIndex);
+
+      if(Pool != nullptr && Pool->AllocateBuffer(inBuff, MemReq, bDedicated))
+      {
+        inBuff.allocMemoryUsage = Usage;
+        return;
+      }
+
+      TypeBits &= ~(1u << TypeIndex);
+    }
+
+    throw std::runtime_error("failed to allocate buffer memory, no compatible memory type has room left");
   }
 /* Allocations */
 
@@ -121,11 +297,55 @@ namespace Ek
   {
     Ek::Mesh* Ret = new Ek::Mesh();
 
-    Ret->Load(this, Device, ShaderResources, MeshPath);
+    Ret->Read(this, MeshPath, VertexFormat, bMeshletCulling);
+    Ret->CreateTexture(Device, ShaderResources, bTextureStreaming ? &Streamer : nullptr);
+    Ret->Allocate(&Geometry, bMeshletCulling ? &Culler : nullptr);
 
-    Ek::Wrappers::CommandBuffer cmdBuffer = GetCommandBuffer(Ek::eTransfer);
+    return Ret;
+  }
 
-    Ret->Allocate(cmdBuffer);
+  std::vector<Ek::Mesh*> vulkanInterface::CreateMeshes(const std::vector<std::string>& MeshPaths)
+  {
+    std::vector<Ek::Mesh*> Ret(MeshPaths.size());
+    std::vector<std::future<void>> Reads(MeshPaths.size());
+
+    for(uint32_t i = 0; i < MeshPaths.size(); i++)
+    {
+      Ek::Mesh* pMesh = new Ek::Mesh();
+      std::string Path = MeshPaths[i];
+
+      Ret[i] = pMesh;
+      Reads[i] = Loaders.Push([this, pMesh, Path]{ pMesh->Read(this, Path, VertexFormat, bMeshletCulling); });
+    }
+
+    // in order, so the upload ring fills the same way CreateMesh one at a time would
+    uint32_t Done = 0;
+
+    try
+    {
+      for(; Done < Ret.size(); Done++)
+      {
+        Reads[Done].get();
+
+        Ret[Done]->CreateTexture(Device, ShaderResources, bTextureStreaming ? &Streamer : nullptr);
+        Ret[Done]->Allocate(&Geometry, bMeshletCulling ? &Culler : nullptr);
+      }
+    }
+    catch(...)
+    {
+      // the loaders still hold pointers to the meshes we didn't get to
+      for(uint32_t i = Done + 1; i < Reads.size(); i++)
+      {
+        Reads[i].wait();
+      }
+
+      for(uint32_t i = 0; i < Ret.size(); i++)
+      {
+        delete Ret[i];
+      }
+
+      throw;
+    }
 
     return Ret;
   }
@@ -135,22 +355,26 @@ namespace Ek
     PipelineInterface* Ret = new PipelineInterface();
 
     Ret->SetDescriptorLayout(ShaderResources.DescriptorLayout);
-    Ret->Init(Device, Mat, Attachments.data(), Attachments.size(), PipeOffset, PipeExtent, RenderPass, 0, bDepthEnabled);
+    Ret->Init(Device, Mat, Attachments.data(), Attachments.size(), PipeOffset, PipeExtent, RenderPass, 0, bDepthEnabled, VertexFormat);
 
     return Ret;
   }
 
   void vulkanInterface::CreateCamera(Camera* pCam, uint32_t Binding)
   {
-    pCam->Init(Device, WindowExtent, ShaderResources.Descriptor, Binding, HostMemory);
+    pCam->Init(Device, WindowExtent, ShaderResources.Descriptor, Binding, this);
   }
 
-  VkResult vulkanInterface::CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage)
+  VkResult vulkanInterface::CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage, uint32_t MipLevels)
   {
     VkResult Err;
 
     inTex.Format = Format;
     inTex.Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    inTex.Extent = ImageExtent;
+    inTex.Usage = Usage;
+    inTex.MipLevels = MipLevels;
+    inTex.BaseLevel = 0;
 
     VkImageCreateInfo ImageCI{};
     ImageCI.sType  = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -160,7 +384,7 @@ namespace Ek
     ImageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
     ImageCI.samples = VK_SAMPLE_COUNT_1_BIT;
     ImageCI.imageType = VK_IMAGE_TYPE_2D;
-    ImageCI.mipLevels = 1;
+    ImageCI.mipLevels = MipLevels;
     ImageCI.arrayLayers = 1;
     ImageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     ImageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -190,8 +414,8 @@ namespace Ek
 
     ViewCI.subresourceRange.aspectMask = Aspects;
     ViewCI.subresourceRange.layerCount = 1;
-    ViewCI.subresourceRange.levelCount = 1;
-    ViewCI.subresourceRange.baseMipLevel = 0;
+    ViewCI.subresourceRange.levelCount = Texture.MipLevels - Texture.BaseLevel;
+    ViewCI.subresourceRange.baseMipLevel = Texture.BaseLevel;
     ViewCI.subresourceRange.baseArrayLayer = 0;
 
     if((Err = vkCreateImageView(Device, &ViewCI, nullptr, &View)) != VK_SUCCESS)
@@ -202,6 +426,27 @@ namespace Ek
     return VK_SUCCESS;
   }
 
+  VkResult vulkanInterface::CreateBuffer(Ek::Buffer& inBuff, VkDeviceSize Size, VkBufferUsageFlags Usage)
+  {
+    VkResult Err;
+
+    inBuff.Size = Size;
+    inBuff.Usage = Usage;
+
+    VkBufferCreateInfo BufferCI{};
+    BufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    BufferCI.size = Size;
+    BufferCI.usage = Usage;
+    BufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if((Err = vkCreateBuffer(Device, &BufferCI, nullptr, &inBuff.Buffer)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    return VK_SUCCESS;
+  }
+
   Ek::Wrappers::CommandBuffer vulkanInterface::GetCommandBuffer(Ek::eCommandType cmdType)
   {
     Ek::Wrappers::CommandBuffer Ret;
@@ -237,8 +482,101 @@ namespace Ek
 /* Producers */
 
 /* Rendering */
+  void vulkanInterface::CullMeshes(Ek::Wrappers::CommandBuffer& cmdBuffer, Camera* pCam, const std::vector<Ek::Mesh*>& Meshes)
+  {
+    if(!bMeshletCulling)
+    {
+      return;
+    }
+
+    std::vector<Ek::MeshletRange*> Ranges;
+    Ranges.reserve(Meshes.size());
+
+    // meshes still uploading draw nothing anyway
+    for(uint32_t i = 0; i < Meshes.size(); i++)
+    {
+      Ek::MeshletRange* pRange = Meshes[i]->GetMeshlets();
+
+      if(pRange != nullptr)
+      {
+        Ranges.push_back(pRange);
+      }
+    }
+
+    if(Ranges.empty())
+    {
+      return;
+    }
+
+    Culler.Cull(cmdBuffer.Buffer, Ranges, pCam->MVP.World, pCam->MVP.View, pCam->MVP.Projection);
+  }
+
+  void vulkanInterface::SelectLods(Camera* pCam, const std::vector<Ek::Mesh*>& Meshes)
+  {
+    glm::mat4 WorldView = pCam->MVP.View * pCam->MVP.World;
+
+    // Projection[1][1] is cot(fov / 2), negative since we flip y for vulkan
+    float PixelsPerUnit = glm::abs(pCam->MVP.Projection[1][1]) * pCam->Height * 0.5f;
+
+    for(uint32_t i = 0; i < Meshes.size(); i++)
+    {
+      Meshes[i]->SelectLod(WorldView, PixelsPerUnit, LodBias);
+
+      if(bTextureStreaming)
+      {
+        Meshes[i]->RequestTexture(WorldView, pCam->MVP.Projection, PixelsPerUnit);
+      }
+    }
+  }
+
   void vulkanInterface::BeginRender(Ek::Wrappers::CommandBuffer& cmdBuffer)
   {
+    FrameIndex++;
+
+    // the last frame has been waited on, so nothing we'd move is in use. Anything still uploading isn't ours to move yet
+    if(DefragBudget > 0 && Uploads.IsDone(Uploads.GetToken()))
+    {
+      Defragment(DefragBudget);
+    }
+
+    // send off this frame's uploads and take ownership of the ones that landed, has to happen outside the renderpass
+    Uploads.Process(cmdBuffer.Buffer);
+
+    // after Process, so whatever level landed has been acquired by the time its view is swapped in
+    if(bTextureStreaming)
+    {
+      Streamer.Update();
+    }
+
+    Budget.Update();
+
+    bool bPressure = Budget.GetPressure() >= EvictFraction;
+
+    // the last frame is done with everything, so this is the one point where textures can go away safely
+    if(pAssets != nullptr)
+    {
+      pAssets->Update(FrameIndex);
+
+      if(bPressure)
+      {
+        pAssets->Evict(Budget.GetExcess(EvictFraction));
+      }
+    }
+
+    // a frame may have bound the arena's old buffers before it grew, that frame is done now
+    Geometry.ReleaseRetired();
+
+    // give back memory blocks that have been sitting empty, right away if we're short on memory
+    for(uint32_t i = 0; i < MemoryPools.size(); i++)
+    {
+      EkBackend::MemoryPool* Pool = MemoryPools[i];
+
+      if(Pool != nullptr)
+      {
+        Pool->Trim(FrameIndex, bPressure);
+      }
+    }
+
     if(AcquireFence == VK_NULL_HANDLE)
     {
       VkFenceCreateInfo FenceCI{};
@@ -288,6 +626,9 @@ namespace Ek
     BeginInfo.framebuffer = FrameBuffers[ImageIndex];
 
     vkCmdBeginRenderPass(cmdBuffer.Buffer, &BeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+    // vertex/index bindings don't care about the pipeline, so every mesh this frame draws out of these
+    Geometry.Bind(cmdBuffer.Buffer);
   }
 
   void vulkanInterface::BindShaderResources(Ek::Wrappers::CommandBuffer& cmdBuffer, PipelineInterface* Pipeline)
@@ -330,67 +671,153 @@ namespace Ek
         throw std::runtime_error("Failed to present: Tried to present with type-less command buffer\n");
     }
 
+    std::lock_guard<std::mutex> Guard(Ek::Wrappers::CommandBuffer::QueueLock);
     vkQueuePresentKHR(*Queue, &PresentInfo);
   }
 /* Rendering */
 
 /* Mem ops */
   VkResult vulkanInterface::LoadImage(const char* Path, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage)
+  {
+    Ek::ImageData Image;
+
+    if(!DecodeImage(Path, Image))
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    return LoadImage(Image, inTex, Layout, Usage);
+  }
+
+  VkResult vulkanInterface::LoadImage(const Ek::ImageData& Image, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage)
   {
     VkResult Err;
-    sail::image imgFile(Path);
 
-    // Load Image into GPU memory
+    uint32_t MipLevels = EkBackend::MipGenerator::GetLevelCount(Image.Extent);
+    bool bBlit = CanBlitMips(Image.Format);
+
+    // the upload queue blits the rest of the chain from the last level we have, which reads and writes the image
+    VkImageUsageFlags MipUsage = (Image.MipLevels < MipLevels && bBlit) ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0;
+
+    // block compressed images can only be sampled and copied
+    if(EkBackend::MipGenerator::IsBlockCompressed(Image.Format))
     {
+      Usage &= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
 
-      if((Err = CreateImage(inTex, VK_FORMAT_R8G8B8A8_UNORM, VkExtent2D{imgFile.width(), imgFile.height()}, VK_IMAGE_USAGE_TRANSFER_DST_BIT | Usage)) != VK_SUCCESS)
-      {
-        return Err;
-      }
+    if((Err = CreateImage(inTex, Image.Format, Image.Extent, VK_IMAGE_USAGE_TRANSFER_DST_BIT | MipUsage | Usage, MipLevels)) != VK_SUCCESS)
+    {
+      return Err;
+    }
 
-      AllocateTexture(inTex, Ek::eLocalMemory);
+    if(inTex.Category == Ek::eMemoryOther)
+    {
+      inTex.Category = Ek::eMemoryTexture;
+    }
 
-      void* TransferMemory;
-      TransferBuffer.Map(&TransferMemory);
+    AllocateTexture(inTex, Ek::eGpuOnly);
 
-      memcpy(TransferMemory, imgFile.pixels(), imgFile.pixels_size());
+    // the copy runs on the transfer queue, the image is usable once IsUploadDone(GetUploadToken()) says so
+    if(Image.MipLevels < MipLevels && !bBlit)
+    {
+      // DecodeImage makes the chain on the loader thread already, this is for images that didn't come through it
+      Ek::ImageData Chain = Image;
+      EkBackend::MipGenerator::Generate(Chain);
+
+      Uploads.UploadImage(inTex, Chain, Layout);
+    }
+    else
+    {
+      Uploads.UploadImage(inTex, Image, Layout);
     }
 
-    VkBufferImageCopy CopyInfo{};
-    CopyInfo.imageExtent = {imgFile.width(), imgFile.height(), 1};
-    CopyInfo.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    CopyInfo.imageSubresource.mipLevel = 0;
-    CopyInfo.imageSubresource.layerCount = 1;
-    CopyInfo.imageSubresource.baseArrayLayer = 0;
+    return VK_SUCCESS;
+  }
 
+  bool vulkanInterface::DecodeImage(const char* Path, Ek::ImageData& Image, bool bNormalMap)
+  {
+    // BC7 for colors, BC5 keeps the two channels a normal map needs. Anything else stays RGBA8
+    VkFormat Format = VK_FORMAT_UNDEFINED;
+
+    if(bTextureCompressionBC)
     {
-      VkImageMemoryBarrier toDst{};
-      VkImageMemoryBarrier graphicsToDesired{};
-      VkImageMemoryBarrier transferToDesired{};
+      Format = Ek::Query::GetBestFormat(PDevice, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                        bNormalMap ? Ek::Query::eRG : Ek::Query::eRGBA, Ek::Query::uNorm | Ek::Query::Compressed);
+    }
 
-      toDst = inTex.Barrier(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, 0);
-      graphicsToDesired = inTex.Barrier(VK_IMAGE_ASPECT_COLOR_BIT, Layout, 0, VK_ACCESS_SHADER_READ_BIT);
+    bool bCompressed = EkBackend::MipGenerator::IsBlockCompressed(Format);
 
-      Ek::Wrappers::CommandBuffer cmdMemOps = GetCommandBuffer(Ek::eTransfer);
-      Ek::Wrappers::CommandBuffer cmdGraphics = GetCommandBuffer(Ek::eGraphics);
+    std::string CachePath = std::string(Path) + ".ktx2";
+    uint64_t SourceHash = bCompressed ? EkBackend::MeshCache::HashFile(Path) : 0;
 
-      cmdMemOps.BeginCommand();
-        vkCmdPipelineBarrier(cmdMemOps.Buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toDst);
-        vkCmdCopyBufferToImage(cmdMemOps.Buffer, TransferBuffer.Buffer, inTex.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &CopyInfo);
-      cmdMemOps.EndComand();
+    if(SourceHash != 0 && EkBackend::TextureCooker::Read(CachePath, SourceHash, Format, Image))
+    {
+      return true;
+    }
 
-      cmdMemOps.FenceWait();
+    sail::image imgFile(Path);
 
-      cmdGraphics.BeginCommand();
-        vkCmdPipelineBarrier(cmdGraphics.Buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &graphicsToDesired);
-      cmdGraphics.EndComand();
+    if(!imgFile.is_valid())
+    {
+      std::cout << "failed to decode image " << Path << '\n';
+      return false;
+    }
+
+    Image = Ek::ImageData();
+    Image.Extent = VkExtent2D{imgFile.width(), imgFile.height()};
+    Image.RowPitch = imgFile.bytes_per_line();
+    Image.Pixels.assign((const uint8_t*)imgFile.pixels(), (const uint8_t*)imgFile.pixels() + imgFile.pixels_size());
 
-      cmdMemOps.Delete();
-      cmdGraphics.FenceWait();
-      cmdGraphics.Delete();
+    // without a blit LoadImage would have to make the chain on the render thread, we're usually on a loader thread here
+    if(bCompressed || !CanBlitMips(VK_FORMAT_R8G8B8A8_UNORM))
+    {
+      EkBackend::MipGenerator::Generate(Image);
     }
 
-    return VK_SUCCESS;
+    if(bCompressed)
+    {
+      Ek::ImageData Cooked;
+      EkBackend::TextureCooker::Encode(Image, Format, Cooked);
+
+      Image = std::move(Cooked);
+
+      if(SourceHash != 0 && !EkBackend::TextureCooker::Write(CachePath, SourceHash, Image))
+      {
+        std::cout << "failed to write cooked texture " << CachePath << '\n';
+      }
+    }
+
+    return true;
+  }
+
+  bool vulkanInterface::CanBlitMips(VkFormat Format)
+  {
+    VkFormatProperties Properties;
+    vkGetPhysicalDeviceFormatProperties(PDevice, Format, &Properties);
+
+    VkFormatFeatureFlags Needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    return (Properties.optimalTilingFeatures & Needed) == Needed;
+  }
+
+  Ek::UploadToken vulkanInterface::UploadBuffer(Ek::Buffer& Dst, const void* pData, VkDeviceSize Size, VkDeviceSize DstOffset)
+  {
+    return Uploads.UploadBuffer(Dst, pData, Size, DstOffset);
+  }
+
+  Ek::UploadToken vulkanInterface::GetUploadToken()
+  {
+    return Uploads.GetToken();
+  }
+
+  bool vulkanInterface::IsUploadDone(Ek::UploadToken Token)
+  {
+    return Uploads.IsDone(Token);
+  }
+
+  void vulkanInterface::WaitUpload(Ek::UploadToken Token)
+  {
+    Uploads.Wait(Token);
   }
 
   void vulkanInterface::PipelineBarrier(Ek::Wrappers::CommandBuffer& cmdBuffer, uint32_t ImgCount, VkImageMemoryBarrier* ImgBarriers, VkPipelineStageFlags Src, VkPipelineStageFlags Dst)
@@ -1,6 +1,7 @@
 #include "Interface.h"
 #include "Memory.h"
 
+#include <cstdlib>
 #include <fstream>
 
 #include <stdexcept>
@@ -44,8 +45,16 @@ namespace Ek
       std::cout << InstanceExtensions[i] << '\n';
     }
 
+    // 1.1 gives us vkGet*MemoryRequirements2 and dedicated allocations without extensions
+    VkApplicationInfo AppInfo{};
+    AppInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    AppInfo.pApplicationName = "my game";
+    AppInfo.pEngineName = "QuickRender";
+    AppInfo.apiVersion = VK_API_VERSION_1_1;
+
     VkInstanceCreateInfo InstanceCI{};
     InstanceCI.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    InstanceCI.pApplicationInfo = &AppInfo;
     InstanceCI.enabledLayerCount = InstanceLayers.size();
     InstanceCI.ppEnabledLayerNames = InstanceLayers.data();
     InstanceCI.enabledExtensionCount = InstanceExtensions.size();
@@ -83,23 +92,14 @@ namespace Ek
       PDevice = PDevices[0];
     }
 
-    VkPhysicalDeviceMemoryProperties MemoryProperties;
-    vkGetPhysicalDeviceMemoryProperties(PDevice, &MemoryProperties);
+    VkPhysicalDeviceProperties DeviceProperties;
+    vkGetPhysicalDeviceProperties(PDevice, &DeviceProperties);
 
-    HostIndex = -1;
-    VRamIndex = -1;
+    // linear and optimal resources in the same VkDeviceMemory have to be at least this far apart
+    BufferImageGranularity = DeviceProperties.limits.bufferImageGranularity;
 
-    for(uint32_t i = 0; i < MemoryProperties.memoryTypeCount; i++)
-    {
-      if(MemoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT && VRamIndex == -1)
-      {
-        VRamIndex = i;
-      }
-      else if(MemoryProperties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT && HostIndex == -1)
-      {
-        HostIndex = i;
-      }
-    }
+    // memory types are picked per resource from this, see FindMemoryType
+    vkGetPhysicalDeviceMemoryProperties(PDevice, &MemoryProperties);
 
     uint32_t FamilyCount;
     vkGetPhysicalDeviceQueueFamilyProperties(PDevice, &FamilyCount, nullptr);
@@ -112,6 +112,16 @@ namespace Ek
     ComputeIndex = -1;
     TransferIndex = -1;
 
+    // a family that can only do transfers is the gpu's copy engine, uploads on it run alongside rendering
+    for(uint32_t i = 0; i < FamilyCount; i++)
+    {
+      if(FamilyProperties[i].queueFlags & VK_QUEUE_TRANSFER_BIT && !(FamilyProperties[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+      {
+        TransferIndex = i;
+        break;
+      }
+    }
+
     for(uint32_t i = 0; i < FamilyCount; i++)
     {
       if(FamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT && GraphicsIndex == -1)
@@ -149,6 +159,10 @@ namespace Ek
     VkResult Err;
 
     std::vector<VkDeviceQueueCreateInfo> Queues;
+    float Priorities[2] = { 1.f, 1.f };
+
+    // optional, without it the budget is guessed from the heap sizes
+    bMemoryBudget = AddDevExtension(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
     if(TransferIndex == GraphicsIndex || TransferIndex == ComputeIndex)
     {
@@ -180,8 +194,22 @@ namespace Ek
       Queues[2].queueFamilyIndex = TransferIndex;
     }
 
+    for(uint32_t i = 0; i < Queues.size(); i++)
+    {
+      Queues[i].pQueuePriorities = Priorities;
+    }
+
+    // BC textures when the device has them, DecodeImage sticks to RGBA8 otherwise
+    VkPhysicalDeviceFeatures Supported;
+    vkGetPhysicalDeviceFeatures(PDevice, &Supported);
+
+    VkPhysicalDeviceFeatures Features{};
+    Features.textureCompressionBC = Supported.textureCompressionBC;
+    bTextureCompressionBC = Supported.textureCompressionBC == VK_TRUE;
+
     VkDeviceCreateInfo DevCI{};
     DevCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    DevCI.pEnabledFeatures = &Features;
     DevCI.enabledExtensionCount = DeviceExtensions.size();
     DevCI.ppEnabledExtensionNames = DeviceExtensions.data();
     DevCI.queueCreateInfoCount = Queues.size();
@@ -199,20 +227,20 @@ namespace Ek
     vkGetDeviceQueue(Device, TransferIndex, (TransferIndex == GraphicsIndex || TransferIndex == ComputeIndex) ? 1 : 0, &TransferQueue);
     // if the Transfer queue family is the same as graphics or compute then we use index 1 instead of 0.
 
-    if(!HostMemory.Init(Device, HostIndex, 128000000))
+    MemoryPools = std::vector<std::atomic<EkBackend::MemoryPool*>>(MemoryProperties.memoryTypeCount);
+
+    for(uint32_t i = 0; i < MemoryPools.size(); i++)
     {
-      return VK_ERROR_OUT_OF_HOST_MEMORY;
+      MemoryPools[i] = nullptr;
     }
 
-    HostMemory.MemType = Ek::eHostMemory;
-    HostMemory.Map();
+    MemBackend.Init(Device, PDevice, bMemoryBudget);
 
-    if(!LocalMemory.Init(Device, VRamIndex, 256000000))
+    if(const char* TracePath = getenv("EK_MEMORY_TRACE"))
     {
-      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+      MemoryTrace.open(TracePath);
     }
-
-    LocalMemory.MemType = Ek::eLocalMemory;
+    Budget.Init(&MemBackend, MemoryProperties);
 
     if((Err = CreateCommandPool()) != VK_SUCCESS)
     {
@@ -220,18 +248,31 @@ namespace Ek
     }
 
 
-    VkBufferCreateInfo TransferCI{};
-    TransferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    TransferCI.size = 50000000;
-    TransferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    TransferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // uploads stream through a 64MB ring, anything bigger than a quarter of it gets split into chunks
+    if((Err = Uploads.Init(Device, this, TransferQueue, TransferPool, TransferIndex, GraphicsQueue, GraphicsIndex, 64000000)) != VK_SUCCESS)
+    {
+      return Err;
+    }
 
-    if((Err = vkCreateBuffer(Device, &TransferCI, nullptr, &TransferBuffer.Buffer)) != VK_SUCCESS)
+    // 32MB of vertices and 16MB of indices to start with, the arena doubles whatever runs out
+    if((Err = Geometry.Init(Device, this, GraphicsQueue, GraphicsIndex, Vertex::GetStride(VertexFormat), 32000000, 16000000)) != VK_SUCCESS)
     {
       return Err;
     }
 
-    AllocateBuffer(TransferBuffer, Ek::eHostMemory);
+    // 8MB of meshlets and 16MB of culled indices, enough for the same amount of indices the arena starts with
+    if(bMeshletCulling && (Err = Culler.Init(Device, this, "Shaders/MeshletCull.spv", 8000000, 16000000)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    // levels up to 128 texels across go up with the mesh, then up to 8MB of detail a frame
+    if(bTextureStreaming)
+    {
+      Streamer.Init(this, &Uploads, 128, 8000000);
+    }
+
+    Loaders.Init();
 
     return VK_SUCCESS;
   }
@@ -401,9 +442,9 @@ namespace Ek
         Descriptions[i].format = Attachments[i].Format;
         Descriptions[i].initialLayout = Attachments[i].InitialLayout;
         Descriptions[i].finalLayout = Attachments[i].FinalLayout;
-        Descriptions[i].stencilStoreOp = Attachments[i].StencilStoreOp;
+        Descriptions[i].stencilStoreOp = Attachments[i].bTransient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : Attachments[i].StencilStoreOp;
         Descriptions[i].stencilLoadOp = Attachments[i].StencilLoadOp;
-        Descriptions[i].storeOp = Attachments[i].StoreOp;
+        Descriptions[i].storeOp = Attachments[i].bTransient ? VK_ATTACHMENT_STORE_OP_DONT_CARE : Attachments[i].StoreOp;
         Descriptions[i].loadOp = Attachments[i].LoadOp;
         Descriptions[i].samples = VK_SAMPLE_COUNT_1_BIT;
 
@@ -476,7 +517,7 @@ namespace Ek
 
     for(uint32_t i = 0; i < Attachments.size(); i++)
     {
-      if(Attachments[i].Usage == VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+      if(Attachments[i].Usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
       {
         DepthEnabled = true;
       }
@@ -503,6 +544,26 @@ namespace Ek
       }
     }
 
+    // transient attachments of every framebuffer share memory, so the previous frame has to be done writing before this one starts
+    std::vector<VkSubpassDependency> Dependencies(0);
+
+    for(uint32_t i = 0; i < Attachments.size(); i++)
+    {
+      if(Attachments[i].bTransient)
+      {
+        VkSubpassDependency Dependency{};
+        Dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        Dependency.dstSubpass = 0;
+        Dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        Dependency.dstStageMask = Dependency.srcStageMask;
+        Dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        Dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        Dependencies.push_back(Dependency);
+        break;
+      }
+    }
+
     // create renderpass
     {
       VkRenderPassCreateInfo RenderpassCI{};
@@ -511,6 +572,8 @@ namespace Ek
       RenderpassCI.pSubpasses = Subpasses.data();
       RenderpassCI.attachmentCount = Descriptions.size();
       RenderpassCI.pAttachments = Descriptions.data();
+      RenderpassCI.dependencyCount = Dependencies.size();
+      RenderpassCI.pDependencies = Dependencies.data();
 
       std::cout << Attachments.size() << '\n';
 
@@ -545,11 +608,25 @@ namespace Ek
         // x starts at 1 so we can ignore the swapchain image. (it's already created with the swapchain)
         for(uint32_t x = 1; x < Attachments.size(); x++)
         {
-          CreateImage(FrameBufferImages[i][x], Attachments[x].Format, WindowExtent, Attachments[x].Usage);
+          if(!Attachments[x].bTransient)
+          {
+            CreateImage(FrameBufferImages[i][x], Attachments[x].Format, WindowExtent, Attachments[x].Usage);
+
+            FrameBufferImages[i][x].Category = Ek::eMemoryRenderTarget;
+
+            AllocateTexture(FrameBufferImages[i][x], Ek::eGpuOnly);
+            continue;
+          }
 
-          if(!LocalMemory.AllocateTexture(FrameBufferImages[i][x]))
+          CreateImage(FrameBufferImages[i][x], Attachments[x].Format, WindowExtent, Attachments[x].Usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+
+          FrameBufferImages[i][x].Category = Ek::eMemoryRenderTarget;
+
+          // frames go through the graphics queue one after another, so every framebuffer can use the first one's memory.
+          // Unless the driver wanted that in a dedicated allocation, which nothing else may be bound to
+          if(i == 0 || FrameBufferImages[i][x].Alias(FrameBufferImages[0][x]) != VK_SUCCESS)
           {
-            throw std::runtime_error("failed to allocate texture for frame buffer\n");
+            AllocateTexture(FrameBufferImages[i][x], Ek::eTransient);
           }
         }
 
@@ -582,6 +659,12 @@ namespace Ek
       {
         for(uint32_t x = 0; x < Attachments.size(); x++)
         {
+          // nothing to transition to, the renderpass takes it from undefined itself
+          if(Attachments[x].InitialLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+          {
+            continue;
+          }
+
           // +1 to ignore the Swapchain image attachment
           Barriers.push_back(FrameBufferImages[i][x].Barrier(Attachments[x].Aspect, Attachments[x].InitialLayout, 0, 0));
         }
@@ -696,13 +779,32 @@ namespace Ek
       vkDestroyFence(Device, AcquireFence, nullptr);
     }
 
+    if(bDefragCmd)
+    {
+      DefragCmd.Delete();
+    }
+
     vkDestroyCommandPool(Device, GraphicsPool, nullptr);
     vkDestroyCommandPool(Device, ComputePool, nullptr);
+
+    Loaders.Destroy();
+    Streamer.Destroy();
+    Uploads.Destroy();
+    Geometry.Destroy();
+    Culler.Destroy();
+
     vkDestroyCommandPool(Device, TransferPool, nullptr);
 
-    TransferBuffer.Destroy();
-    HostMemory.Destroy();
-    LocalMemory.Destroy();
+    for(uint32_t i = 0; i < MemoryPools.size(); i++)
+    {
+      EkBackend::MemoryPool* Pool = MemoryPools[i];
+
+      if(Pool != nullptr)
+      {
+        Pool->Destroy();
+        delete Pool;
+      }
+    }
 
     glfwDestroyWindow(Window);
     vkDestroySurfaceKHR(Instance, Surface, nullptr);
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <cwchar>
+#include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -14,7 +17,14 @@
 
 #include "Mesh.h"
 #include "AssetMan.h"
+#include "Budget.h"
+#include "VulkanBackend.h"
 #include "ShaderResources.h"
+#include "Geometry.h"
+#include "MeshletCull.h"
+#include "Upload.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
 
 namespace Ek
 {
@@ -37,7 +47,8 @@ namespace Ek
       sInt    = 8,
       uScaled = 16,
       sScaled = 32,
-      Packed = 64
+      Packed = 64,
+      Compressed = 128  // with uNorm, puts the block compressed format first: BC7 for eRGBA, BC5 for eRG
     };
 
     typedef uint32_t ColorSpace;
@@ -103,7 +114,7 @@ namespace Ek
 
       void Bind(Ek::Wrappers::CommandBuffer& cmdBuffer);
       void SetDescriptorLayout(VkDescriptorSetLayout DescLayout);
-      VkResult Init(VkDevice& Device, Material& Mat, Ek::Wrappers::FrameBufferAttachment* FrameBufferAttachments, uint32_t FrameBufferAttachmentCount, VkOffset2D Offset, VkExtent2D Resolution, VkRenderPass& RenderPass, uint32_t Subpass, bool bDepthEnable);
+      VkResult Init(VkDevice& Device, Material& Mat, Ek::Wrappers::FrameBufferAttachment* FrameBufferAttachments, uint32_t FrameBufferAttachmentCount, VkOffset2D Offset, VkExtent2D Resolution, VkRenderPass& RenderPass, uint32_t Subpass, bool bDepthEnable, Ek::eVertexFormat VertexFormat = Ek::eVertexFloat);
 
     private:
       VkDescriptorSetLayout DescriptorLayout;
@@ -138,7 +149,7 @@ namespace Ek
       void camUpdate();
 
     protected:
-      VkResult Init(VkDevice& Device, VkExtent2D CameraSize, VkDescriptorSet& ShaderDescriptor, uint32_t Binding, EkBackend::MemoryBlock& Memory);
+      VkResult Init(VkDevice& Device, VkExtent2D CameraSize, VkDescriptorSet& ShaderDescriptor, uint32_t Binding, EkBackend::AllocateInterface* pAlloc);
 
       VkDevice* pDevice;
 
@@ -167,14 +178,29 @@ namespace Ek
         VkResult CreateCommandPool();
       /* Implementation in Interface.cpp */
 
+      /* Implementation in Helpers.cpp */
+        EkBackend::MemoryPool* GetMemoryPool(uint32_t TypeIndex);
+        // optimal tiling images of Format can be blitted into themselves with a linear filter
+        bool CanBlitMips(VkFormat Format);
+      /* Implementation in Helpers.cpp */
+
     public:
       /* Allocator */
         /* Implementation in Helpers */
           VkResult LoadImage(const char* Path, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage);
-          VkResult CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage);
+          VkResult LoadImage(const Ek::ImageData& Image, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage);
+          bool DecodeImage(const char* Path, Ek::ImageData& Image, bool bNormalMap = false);
+          VkResult CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage, uint32_t MipLevels = 1);
           VkResult CreateImageView(VkImageView& View, Ek::Texture& Texture, VkImageAspectFlags Aspects);
-          void AllocateBuffer(Ek::Buffer& inBuff, Ek::eMemoryType MemType);
-          void AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryType MemType);
+          VkResult CreateBuffer(Ek::Buffer& inBuff, VkDeviceSize Size, VkBufferUsageFlags Usage);
+          void AllocateBuffer(Ek::Buffer& inBuff, Ek::eMemoryUsage Usage);
+          void AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryUsage Usage);
+          uint32_t FindMemoryType(uint32_t TypeBits, Ek::eMemoryUsage Usage);
+
+          Ek::UploadToken UploadBuffer(Ek::Buffer& Dst, const void* pData, VkDeviceSize Size, VkDeviceSize DstOffset = 0);
+          Ek::UploadToken GetUploadToken();
+          bool IsUploadDone(Ek::UploadToken Token);
+          void WaitUpload(Ek::UploadToken Token);
         /* Implementation in Helpers */
       /* Allocator */
 
@@ -190,6 +216,8 @@ namespace Ek
 
         Material CreateMaterial();
         Mesh* CreateMesh(const char* MeshPath);
+        // parsing, vertex conversion and texture decoding run on the loader threads, the uploads are recorded here in order
+        std::vector<Mesh*> CreateMeshes(const std::vector<std::string>& MeshPaths);
         PipelineInterface* CreatePipeline(Material& Mat, VkOffset2D PipeOffset, VkExtent2D PipeExtent, bool bDepthEnable);
         void CreateCamera(Camera* pCam, uint32_t Binding);
 
@@ -215,12 +243,52 @@ namespace Ek
       /* Implementation in Interface.cpp */
 
       /* Implementation in Helpers.cpp */
+        // culls the meshlets of every mesh that has them against pCam, before BeginRender since it can't run inside the renderpass.
+        // Culled meshes draw what survived from then on, so call it every frame once you started
+        void CullMeshes(Ek::Wrappers::CommandBuffer& cmdBuffer, Camera* pCam, const std::vector<Ek::Mesh*>& Meshes);
+        // picks every mesh's level of detail by how big it is on pCam's screen. Before CullMeshes, only level 0 gets culled
+        void SelectLods(Camera* pCam, const std::vector<Ek::Mesh*>& Meshes);
         void BeginRender(Ek::Wrappers::CommandBuffer& cmdBuffer);
         void BindShaderResources(Ek::Wrappers::CommandBuffer& cmdBuffer, PipelineInterface* Pipeline);
         void EndRender(Ek::Wrappers::CommandBuffer& cmdBuffer);
         void Present(Ek::Wrappers::CommandBuffer& cmdBuffer);
       /* Implementation in Helpers.cpp */
 
+      /* Implementation in Defrag.cpp */
+        // moves movable buffers and textures into compact ranges, spending roughly BudgetUs microseconds on it.
+        // nothing that gets moved may be used by a pending command buffer, BeginRender calls this once the last frame has finished
+        void Defragment(uint32_t BudgetUs);
+      /* Implementation in Defrag.cpp */
+
+      // AssetManager (or anything else that can let go of memory) that gets asked to evict when we run low. Only what it owns
+      // can be evicted, mesh albedos are loaded by the meshes themselves and stay put. Nothing registers one yet, so under
+      // pressure all we do for now is Trim
+      void RegisterAssets(Ek::AssetInterface* inAssets) { pAssets = inAssets; }
+      // heap budgets and where our memory goes, updated every BeginRender
+      EkBackend::MemoryBudget& GetBudget() { return Budget; }
+
+      // once a device local heap uses this much of its budget the registered assets are asked to evict down to it
+      float EvictFraction = 0.9f;
+
+      // layout of every mesh's vertices, set before CreateDevice. The packed formats need Shaders/VertPacked.spv and each
+      // mesh's GetDequant() pushed to the vertex stage at offset 16
+      Ek::eVertexFormat VertexFormat = Ek::eVertexFloat;
+
+      // how many pixels of simplification error SelectLods lets through, higher switches to coarser levels sooner
+      float LodBias = 1.f;
+
+      // split meshes into meshlets and let CullMeshes cull them on the gpu, set before CreateDevice. Needs Shaders/MeshletCull.spv
+      bool bMeshletCulling = false;
+
+      // meshes start with only the smallest mips of their albedo and the rest streams in as SelectLods finds them on screen,
+      // set before CreateDevice
+      bool bTextureStreaming = false;
+
+      // per frame defragmentation budget in microseconds, 0 turns it off
+      uint32_t DefragBudget = 1000;
+      // AssessFrag() percentage a block needs before its pool gets compacted
+      uint32_t DefragThreshold = 30;
+
 
     public:
       // Window
@@ -244,8 +312,8 @@ namespace Ek
         uint32_t GraphicsIndex;
         uint32_t ComputeIndex;
         uint32_t TransferIndex;
-        uint32_t VRamIndex;
-        uint32_t HostIndex;
+        VkDeviceSize BufferImageGranularity;
+        VkPhysicalDeviceMemoryProperties MemoryProperties;
         std::vector<VkExtensionProperties> DevExtensionProperties;
         std::vector<const char*> DeviceExtensions;
 
@@ -285,12 +353,39 @@ namespace Ek
         EkBackend::DescriptorSet ShaderResources;
 
       // Memory
-        EkBackend::MemoryBlock HostMemory;
-        EkBackend::MemoryBlock LocalMemory;
-        Ek::Buffer TransferBuffer;
+        // one pool per memory type index, created the first time a resource picks that type. Any thread can create one
+        // so they're atomic, PoolLock only makes sure two threads don't create the same pool
+        std::vector<std::atomic<EkBackend::MemoryPool*>> MemoryPools;
+        std::mutex PoolLock;
+        EkBackend::VulkanMemoryBackend MemBackend;
+        EkBackend::MemoryBudget Budget;
+        // set EK_MEMORY_TRACE to a path to record every allocation for Bench/memory_bench
+        std::ofstream MemoryTrace;
+        bool bMemoryBudget = false;
+        bool bTextureCompressionBC = false;
+        Ek::AssetInterface* pAssets = nullptr;
+        // every upload goes through here, asynchronously on the transfer queue
+        EkBackend::UploadQueue Uploads;
+        // vertex and index data of every mesh, bound once per frame in BeginRender
+        EkBackend::GeometryArena Geometry;
+        // the cpu half of CreateMeshes
+        EkBackend::ThreadPool Loaders;
+        // only initialized with bMeshletCulling
+        EkBackend::MeshletCuller Culler;
+        // only initialized with bTextureStreaming
+        EkBackend::TextureStreamer Streamer;
+
+      // Defragmentation
+        Ek::Wrappers::CommandBuffer DefragCmd;
+        bool bDefragCmd = false;
+        // bytes we copy per Defragment() call, adjusted to keep the call inside its budget
+        uint64_t DefragBytes = 8000000;
+        // pool version the last time a pass over it couldn't move anything, we leave it alone until it changes
+        std::vector<uint64_t> DefragStalled;
 
       // Render tools
         uint32_t ImageIndex;
+        uint64_t FrameIndex = 0;
         VkFence AcquireFence = VK_NULL_HANDLE;
   };
 }
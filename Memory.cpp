@@ -1,371 +1,1613 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <cmath>
+#include <mutex>
+#include <ostream>
 #include <string>
+#include <unordered_set>
 #include <vulkan/vulkan_core.h>
 
 #include "Memory.h"
+#include "Budget.h"
 
 using namespace std;
 
 namespace EkBackend
 {
-  bool MemoryBlock::Init(VkDevice& inDevice, uint32_t inMemoryIndex, uint32_t DesiredSize)
+  // index of the highest/lowest set bit, Value must not be 0
+  static uint32_t BitScanReverse(uint64_t Value)
+  {
+    return 63 - __builtin_clzll(Value);
+  }
+
+  static uint32_t BitScanForward(uint64_t Value)
+  {
+    return __builtin_ctzll(Value);
+  }
+
+  static VkDeviceSize AlignUp(VkDeviceSize Value, VkDeviceSize Alignment)
+  {
+    return ((Value + Alignment - 1) / Alignment) * Alignment;
+  }
+
+  // every block of every pool can write to the same trace
+  static std::mutex TraceLock;
+
+  // serials of the pools that are alive, so an exiting thread knows which of its chunks it can still hand back
+  static std::mutex LivePoolLock;
+  static std::unordered_set<uint64_t> LivePools;
+  static std::atomic<uint64_t> NextPoolSerial{1};
+
+  // the chunk every thread allocates from, per memory type. Serial says which pool it belongs to
+  struct CachedChunk
+  {
+    uint64_t Serial = 0;
+    ThreadChunk* pChunk = nullptr;
+  };
+
+  struct ThreadChunks
+  {
+    CachedChunk Entries[VK_MAX_MEMORY_TYPES];
+
+    // a loader thread that goes away would otherwise keep its chunks forever
+    ~ThreadChunks()
+    {
+      std::lock_guard<std::mutex> Guard(LivePoolLock);
+
+      for(uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++)
+      {
+        if(Entries[i].Serial != 0 && LivePools.count(Entries[i].Serial) > 0)
+        {
+          Entries[i].pChunk->Disown();
+        }
+      }
+    }
+  };
+
+  static thread_local ThreadChunks ChunkCache;
+
+/* TlsfHeap */
+  void TlsfHeap::Init(VkDeviceSize inSize, VkDeviceSize inGranularity)
+  {
+    Size = inSize;
+    FreeSize = inSize;
+    Granularity = (inGranularity == 0) ? 1 : inGranularity;
+
+    First = new MemHeader;
+    First->Start = 0;
+    First->MemorySize = inSize;
+
+    InsertFree(First);
+  }
+
+  void TlsfHeap::Destroy()
+  {
+    MemHeader* Curr = First;
+
+    while(Curr != nullptr)
+    {
+      MemHeader* Next = Curr->NextPhys;
+      delete Curr;
+      Curr = Next;
+    }
+
+    First = nullptr;
+    FlBitmap = 0;
+
+    for(uint32_t i = 0; i < FlCount; i++)
+    {
+      SlBitmap[i] = 0;
+
+      for(uint32_t x = 0; x < SlCount; x++)
+      {
+        FreeLists[i][x] = nullptr;
+      }
+    }
+  }
+
+  void TlsfHeap::Mapping(VkDeviceSize inSize, uint32_t& Fl, uint32_t& Sl)
+  {
+    if(inSize < SmallBlock)
+    {
+      // small sizes get a list per byte count
+      Fl = 0;
+      Sl = (uint32_t)inSize;
+    }
+    else
+    {
+      uint32_t Msb = BitScanReverse(inSize);
+      Sl = (uint32_t)(inSize >> (Msb - SlLog2)) ^ SlCount;
+      Fl = Msb - (FlShift - 1);
+    }
+  }
+
+  MemHeader* TlsfHeap::FindFree(VkDeviceSize inSize)
+  {
+    // round the request up to the next list boundary, so any range in the list we land on is big enough
+    if(inSize >= SmallBlock)
+    {
+      VkDeviceSize Round = (1ull << (BitScanReverse(inSize) - SlLog2)) - 1;
+
+      if(inSize + Round < inSize)
+      {
+        return nullptr;
+      }
+
+      inSize += Round;
+    }
+
+    uint32_t Fl, Sl;
+    Mapping(inSize, Fl, Sl);
+
+    if(Fl >= FlCount)
+    {
+      return nullptr;
+    }
+
+    uint32_t SlMap = SlBitmap[Fl] & (~0u << Sl);
+
+    if(SlMap == 0)
+    {
+      uint64_t FlMap = (Fl + 1 < FlCount) ? FlBitmap & (~0ull << (Fl + 1)) : 0;
+
+      if(FlMap == 0)
+      {
+        return nullptr;
+      }
+
+      Fl = BitScanForward(FlMap);
+      SlMap = SlBitmap[Fl];
+    }
+
+    Sl = BitScanForward(SlMap);
+
+    return FreeLists[Fl][Sl];
+  }
+
+  void TlsfHeap::InsertFree(MemHeader* Header)
+  {
+    uint32_t Fl, Sl;
+    Mapping(Header->MemorySize, Fl, Sl);
+
+    Header->bFree = true;
+    Header->pObject = nullptr;
+    Header->ID = 0;
+    Header->PrevFree = nullptr;
+    Header->NextFree = FreeLists[Fl][Sl];
+
+    if(Header->NextFree != nullptr)
+    {
+      Header->NextFree->PrevFree = Header;
+    }
+
+    FreeLists[Fl][Sl] = Header;
+
+    FlBitmap |= 1ull << Fl;
+    SlBitmap[Fl] |= 1u << Sl;
+  }
+
+  void TlsfHeap::RemoveFree(MemHeader* Header)
+  {
+    uint32_t Fl, Sl;
+    Mapping(Header->MemorySize, Fl, Sl);
+
+    if(Header->PrevFree != nullptr)
+    {
+      Header->PrevFree->NextFree = Header->NextFree;
+    }
+    else
+    {
+      FreeLists[Fl][Sl] = Header->NextFree;
+    }
+
+    if(Header->NextFree != nullptr)
+    {
+      Header->NextFree->PrevFree = Header->PrevFree;
+    }
+
+    if(FreeLists[Fl][Sl] == nullptr)
+    {
+      SlBitmap[Fl] &= ~(1u << Sl);
+
+      if(SlBitmap[Fl] == 0)
+      {
+        FlBitmap &= ~(1ull << Fl);
+      }
+    }
+
+    Header->bFree = false;
+    Header->PrevFree = nullptr;
+    Header->NextFree = nullptr;
+  }
+
+  // works out where an allocation would land inside a free range, returns false if it doesn't fit.
+  // linear and optimal resources may not share a bufferImageGranularity sized page, so we push the start/end apart when a neighbour is of the other kind.
+  bool TlsfHeap::Place(MemHeader* Header, VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear, VkDeviceSize& Offset)
+  {
+    VkDeviceSize RangeEnd = Header->Start + Header->MemorySize;
+
+    Offset = AlignUp(Header->Start, ReqAlignment);
+
+    if(Granularity > 1)
+    {
+      MemHeader* Prev = Header->PrevPhys;
+
+      if(Prev != nullptr && !Prev->bFree && Prev->bLinear != bLinear)
+      {
+        VkDeviceSize PrevEnd = Prev->Start + Prev->MemorySize;
+
+        if((PrevEnd - 1) / Granularity == Offset / Granularity)
+        {
+          Offset = AlignUp(AlignUp(Offset, Granularity), ReqAlignment);
+        }
+      }
+    }
+
+    VkDeviceSize End = Offset + ReqSize;
+
+    if(End > RangeEnd)
+    {
+      return false;
+    }
+
+    if(Granularity > 1)
+    {
+      MemHeader* Next = Header->NextPhys;
+
+      if(Next != nullptr && !Next->bFree && Next->bLinear != bLinear)
+      {
+        if((End - 1) / Granularity == Next->Start / Granularity)
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  MemHeader* TlsfHeap::Allocate(VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear)
+  {
+    if(ReqSize == 0)
+    {
+      return nullptr;
+    }
+
+    if(ReqAlignment == 0)
+    {
+      ReqAlignment = 1;
+    }
+
+    // nothing that big can be in a heap anyway
+    if(ReqSize > Size || ReqAlignment > Size)
+    {
+      return nullptr;
+    }
+
+    VkDeviceSize Search = ReqSize + ReqAlignment - 1;
+    VkDeviceSize Offset = 0;
+    MemHeader* Header = FindFree(Search);
+
+    if(Header != nullptr && !Place(Header, ReqSize, ReqAlignment, bLinear, Offset))
+    {
+      Header = nullptr;
+    }
+
+    if(Header == nullptr && Granularity > 1)
+    {
+      // the first candidate collided with a neighbour of the other tiling, reserve enough room to pad a page on both sides
+      Search += 2 * Granularity;
+      Header = FindFree(Search);
+
+      if(Header != nullptr && !Place(Header, ReqSize, ReqAlignment, bLinear, Offset))
+      {
+        Header = nullptr;
+      }
+    }
+
+    if(Header == nullptr)
+    {
+      return nullptr;
+    }
+
+    RemoveFree(Header);
+
+    // split off the padding in front of the allocation
+    if(Offset > Header->Start)
+    {
+      MemHeader* Front = new MemHeader;
+      Front->Start = Header->Start;
+      Front->MemorySize = Offset - Header->Start;
+
+      Front->PrevPhys = Header->PrevPhys;
+      Front->NextPhys = Header;
+
+      if(Front->PrevPhys != nullptr)
+      {
+        Front->PrevPhys->NextPhys = Front;
+      }
+      else
+      {
+        First = Front;
+      }
+
+      Header->PrevPhys = Front;
+      Header->Start = Offset;
+      Header->MemorySize -= Front->MemorySize;
+
+      InsertFree(Front);
+    }
+
+    // and whatever is left over behind it
+    if(Header->MemorySize > ReqSize)
+    {
+      MemHeader* Back = new MemHeader;
+      Back->Start = Header->Start + ReqSize;
+      Back->MemorySize = Header->MemorySize - ReqSize;
+
+      Back->PrevPhys = Header;
+      Back->NextPhys = Header->NextPhys;
+
+      if(Back->NextPhys != nullptr)
+      {
+        Back->NextPhys->PrevPhys = Back;
+      }
+
+      Header->NextPhys = Back;
+      Header->MemorySize = ReqSize;
+
+      InsertFree(Back);
+    }
+
+    Header->bFree = false;
+    Header->bLinear = bLinear;
+
+    FreeSize -= Header->MemorySize;
+
+    return Header;
+  }
+
+  void TlsfHeap::Free(MemHeader* Header)
+  {
+    FreeSize += Header->MemorySize;
+
+    // merge with free neighbours so the free ranges stay as large as possible
+    MemHeader* Prev = Header->PrevPhys;
+
+    if(Prev != nullptr && Prev->bFree)
+    {
+      RemoveFree(Prev);
+
+      Prev->MemorySize += Header->MemorySize;
+      Prev->NextPhys = Header->NextPhys;
+
+      if(Prev->NextPhys != nullptr)
+      {
+        Prev->NextPhys->PrevPhys = Prev;
+      }
+
+      delete Header;
+      Header = Prev;
+    }
+
+    MemHeader* Next = Header->NextPhys;
+
+    if(Next != nullptr && Next->bFree)
+    {
+      RemoveFree(Next);
+
+      Header->MemorySize += Next->MemorySize;
+      Header->NextPhys = Next->NextPhys;
+
+      if(Header->NextPhys != nullptr)
+      {
+        Header->NextPhys->PrevPhys = Header;
+      }
+
+      delete Next;
+    }
+
+    InsertFree(Header);
+  }
+
+  void TlsfHeap::Grow(VkDeviceSize NewSize)
+  {
+    if(NewSize <= Size)
+    {
+      return;
+    }
+
+    VkDeviceSize Added = NewSize - Size;
+
+    MemHeader* Last = First;
+
+    while(Last->NextPhys != nullptr)
+    {
+      Last = Last->NextPhys;
+    }
+
+    if(Last->bFree)
+    {
+      RemoveFree(Last);
+      Last->MemorySize += Added;
+      InsertFree(Last);
+    }
+    else
+    {
+      MemHeader* Back = new MemHeader;
+      Back->Start = Size;
+      Back->MemorySize = Added;
+      Back->PrevPhys = Last;
+
+      Last->NextPhys = Back;
+
+      InsertFree(Back);
+    }
+
+    Size = NewSize;
+    FreeSize += Added;
+  }
+
+  VkDeviceSize TlsfHeap::GetLargestFree()
+  {
+    if(FlBitmap == 0)
+    {
+      return 0;
+    }
+
+    // the largest free range has to be in the highest non-empty list, ranges in one list differ in size so we still walk it
+    uint32_t Fl = BitScanReverse(FlBitmap);
+    uint32_t Sl = BitScanReverse(SlBitmap[Fl]);
+
+    VkDeviceSize Largest = 0;
+
+    for(MemHeader* Curr = FreeLists[Fl][Sl]; Curr != nullptr; Curr = Curr->NextFree)
+    {
+      if(Curr->MemorySize > Largest)
+      {
+        Largest = Curr->MemorySize;
+      }
+    }
+
+    return Largest;
+  }
+/* TlsfHeap */
+
+/* MemoryBlock */
+  bool MemoryBlock::Init(MemoryBackend* inBackend, uint32_t inMemoryIndex, VkDeviceSize DesiredSize, VkDeviceSize BufferImageGranularity, VkImage DedicatedImage, VkBuffer DedicatedBuffer)
   {
     VkResult Err;
 
-    pDevice = &inDevice;
-    MemoryIndex = inMemoryIndex;
+    pBackend = inBackend;
+    MemoryIndex = inMemoryIndex;
+    Mapped = false;
+
+    bDedicated = DedicatedImage != VK_NULL_HANDLE || DedicatedBuffer != VK_NULL_HANDLE;
+
+    if((Err = pBackend->AllocateMemory(MemoryIndex, DesiredSize, DedicatedImage, DedicatedBuffer, Allocation)) != VK_SUCCESS)
+    {
+      cout << "failed to allocate memory block with " << to_string(Err) << '\n';
+      return false;
+    }
+
+    Size = DesiredSize;
+
+    Heap.Init(Size, BufferImageGranularity);
+
+    // slot 0 is the invalid ID
+    Allocations.assign(1, nullptr);
+    FreeIds.clear();
+
+    UsedSize = 0;
+
+    return true;
+  }
+
+  void MemoryBlock::Destroy()
+  {
+    // Destroy() on the object destroys the vulkan handle and releases its ID through Delete()
+    // ranges without an object belong to chunks, the pool destroys those before its blocks
+    for(uint32_t i = 1; i < Allocations.size(); i++)
+    {
+      if(Allocations[i] != nullptr && Allocations[i]->pObject != nullptr)
+      {
+        Allocations[i]->pObject->Destroy();
+      }
+    }
+
+    Allocations.clear();
+    FreeIds.clear();
+
+    Heap.Destroy();
+
+    pBackend->FreeMemory(Allocation);
+
+    if(pBudget != nullptr)
+    {
+      pBudget->TrackBlock(HeapIndex, Size, true);
+    }
+  }
+
+  void MemoryBlock::Map()
+  {
+    VkResult Err;
+
+    if((Err = pBackend->MapMemory(Allocation, Size, &Memory)) != VK_SUCCESS)
+    {
+      std::cout << "Mapping memory but failed with " << std::to_string(Err) << '\n';
+    }
+
+    Mapped = true;
+  }
+
+  void* MemoryBlock::GetMemory(VkDeviceSize Offset)
+  {
+    if(Mapped)
+    {
+      // pointer arithmetic, we add the offset to the address of the memory to move forward in memory by (offset)bytes
+      return ((byte*)Memory)+Offset;
+    }
+    else
+    {
+      cout << "Something has attempted to retrieve a memory pointer from Memory block with memory type " << MemoryIndex << " and failed due to the fact that the memory is not mapped\n";
+      return nullptr;
+    }
+  }
+
+  void MemoryBlock::unMap()
+  {
+    pBackend->UnmapMemory(Allocation);
+    Mapped = false;
+  }
+
+  // non-coherent memory needs explicit flushes/invalidates, we do the whole block so we don't have to round to nonCoherentAtomSize
+  void MemoryBlock::Flush()
+  {
+    if(Coherent || !Mapped)
+    {
+      return;
+    }
+
+    pBackend->FlushMemory(Allocation);
+  }
+
+  void MemoryBlock::Invalidate()
+  {
+    if(Coherent || !Mapped)
+    {
+      return;
+    }
+
+    pBackend->InvalidateMemory(Allocation);
+  }
+
+  MemHeader* MemoryBlock::Allocate(VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear, Ek::AllocatedObject* pObject)
+  {
+    MemHeader* Header = Heap.Allocate(ReqSize, ReqAlignment, bLinear);
+
+    if(Header == nullptr)
+    {
+      return nullptr;
+    }
+
+    if(FreeIds.size() > 0)
+    {
+      Header->ID = FreeIds.back();
+      FreeIds.pop_back();
+
+      Allocations[Header->ID] = Header;
+    }
+    else
+    {
+      Header->ID = Allocations.size();
+      Allocations.push_back(Header);
+    }
+
+    Header->pObject = pObject;
+    Header->bMovable = pObject != nullptr && pObject->bMovable;
+    Header->bMoving = false;
+    Header->Category = (pObject != nullptr) ? pObject->Category : Ek::eMemoryOther;
+
+    Record(Header, ReqSize, ReqAlignment, false);
+
+    UsedSize = Heap.Size - Heap.FreeSize;
+    Version++;
+
+    return Header;
+  }
+
+  void MemoryBlock::Release(uint32_t AllocId)
+  {
+    Record(Allocations[AllocId], 0, 0, true);
+
+    Heap.Free(Allocations[AllocId]);
+
+    Allocations[AllocId] = nullptr;
+    FreeIds.push_back(AllocId);
+
+    UsedSize = Heap.Size - Heap.FreeSize;
+    Version++;
+  }
+
+  void MemoryBlock::Record(const MemHeader* Header, VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bFreed)
+  {
+    if(Header->pObject == nullptr)
+    {
+      return;
+    }
+
+    if(pBudget != nullptr)
+    {
+      pBudget->TrackAllocation(HeapIndex, Header->Category, Header->MemorySize, bFreed);
+    }
+
+    // headers are unique while they're in use, so their address makes a fine id
+    if(pTrace != nullptr)
+    {
+      std::lock_guard<std::mutex> Guard(TraceLock);
+
+      if(bFreed)
+      {
+        *pTrace << "f " << MemoryIndex << ' ' << (uintptr_t)Header << '\n';
+      }
+      else
+      {
+        *pTrace << "a " << MemoryIndex << ' ' << (uintptr_t)Header << ' ' << ReqSize << ' ' << ReqAlignment << ' ' << Header->bLinear << '\n';
+      }
+    }
+  }
+
+  void MemoryBlock::Delete(uint32_t AllocId)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(AllocId == 0 || AllocId >= Allocations.size() || Allocations[AllocId] == nullptr)
+    {
+      cout << "Tried to delete Allocation with invalid ID : " << AllocId << '\n';
+      return;
+    }
+
+    Release(AllocId);
+  }
+
+  uint32_t MemoryBlock::ReserveChunk(VkDeviceSize inSize, VkDeviceSize Alignment, VkDeviceSize& Offset)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    MemHeader* Header = Allocate(inSize, Alignment, true, nullptr);
+
+    if(Header == nullptr)
+    {
+      return 0;
+    }
+
+    Offset = Header->Start;
+
+    return Header->ID;
+  }
+
+  bool MemoryBlock::IsEmpty()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return Heap.FreeSize == Heap.Size;
+  }
+
+  VkDeviceSize MemoryBlock::GetLargestFree()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return Heap.GetLargestFree();
+  }
+
+  VkDeviceSize MemoryBlock::GetOffset(uint32_t AllocId)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return Allocations[AllocId]->Start;
+  }
+
+  uint32_t MemoryBlock::AssessFrag()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(Heap.FreeSize == 0)
+    {
+      return 0;
+    }
+
+    VkDeviceSize Largest = Heap.GetLargestFree();
+
+    return 100 - (uint32_t)((Largest * 100) / Heap.FreeSize);
+  }
+
+  uint32_t MemoryBlock::Reserve(const VkMemoryRequirements& MemReq, bool bLinear, Ek::AllocatedObject* pObject, VkDeviceSize Below)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    MemHeader* Header = Allocate(MemReq.size, MemReq.alignment, bLinear, pObject);
+
+    if(Header == nullptr)
+    {
+      return 0;
+    }
+
+    // moving up or sideways in the same block doesn't compact anything
+    if(Header->Start >= Below)
+    {
+      Release(Header->ID);
+      return 0;
+    }
+
+    // the range gets filled by a copy, nobody should pick it as a move source in the meantime
+    Header->bMoving = true;
+
+    return Header->ID;
+  }
+
+  void MemoryBlock::Adopt(Ek::AllocatedObject& Object, uint32_t AllocId)
+  {
+    // release the old range first, it may be in this block
+    Object.pAllocator->Delete(Object.AllocationID);
+
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    MemHeader* Header = Allocations[AllocId];
+    Header->bMoving = false;
+
+    Object.pAllocator = this;
+    Object.pChunk = nullptr;
+    Object.AllocationID = AllocId;
+    Object.allocSize = Header->MemorySize;
+    Object.allocOffset = Header->Start;
+    Object.allocMemory = Allocation;
+    Object.allocMemoryIndex = MemoryIndex;
+  }
+
+  MemHeader* MemoryBlock::PickMovable()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    MemHeader* Last = Heap.GetFirst();
+
+    while(Last != nullptr && Last->NextPhys != nullptr)
+    {
+      Last = Last->NextPhys;
+    }
+
+    // walk backwards so allocations at the end of the block move down first
+    for(MemHeader* Curr = Last; Curr != nullptr; Curr = Curr->PrevPhys)
+    {
+      if(!Curr->bFree && Curr->bMovable && !Curr->bMoving)
+      {
+        Curr->bMoving = true;
+        return Curr;
+      }
+    }
+
+    return nullptr;
+  }
+
+  bool MemoryBlock::AllocateBuffer(Ek::Buffer& inBuff)
+  {
+    VkMemoryRequirements MemReq;
+    pBackend->GetBufferRequirements(inBuff.Buffer, MemReq);
+
+    return AllocateBuffer(inBuff, MemReq);
+  }
+
+  bool MemoryBlock::AllocateBuffer(Ek::Buffer& inBuff, const VkMemoryRequirements& MemReq)
+  {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+
+      MemHeader* Header = Allocate(MemReq.size, MemReq.alignment, true, &inBuff);
+
+      if(Header == nullptr)
+      {
+        return false;
+      }
+
+      inBuff.pBackend = pBackend;
+      inBuff.pAllocator = this;
+      inBuff.pChunk = nullptr;
+      inBuff.allocSize = Header->MemorySize;
+      inBuff.allocOffset = Header->Start;
+      inBuff.allocMemory = Allocation;
+      inBuff.allocMemoryIndex = MemoryIndex;
+      inBuff.AllocationID = Header->ID;
+    }
+
+    pBackend->BindBuffer(inBuff.Buffer, inBuff.allocMemory, inBuff.allocOffset);
+
+    return true;
+  }
+
+  bool MemoryBlock::AllocateTexture(Ek::Texture& inTex)
+  {
+    VkMemoryRequirements MemReq;
+    pBackend->GetImageRequirements(inTex.Image, MemReq);
+
+    return AllocateTexture(inTex, MemReq);
+  }
+
+  bool MemoryBlock::AllocateTexture(Ek::Texture& inTex, const VkMemoryRequirements& MemReq)
+  {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+
+      // every image we create uses VK_IMAGE_TILING_OPTIMAL, so they're never linear
+      MemHeader* Header = Allocate(MemReq.size, MemReq.alignment, false, &inTex);
+
+      if(Header == nullptr)
+      {
+        return false;
+      }
+
+      inTex.pBackend = pBackend;
+      inTex.pAllocator = this;
+      inTex.pChunk = nullptr;
+      inTex.allocSize = Header->MemorySize;
+      inTex.allocOffset = Header->Start;
+      inTex.allocMemory = Allocation;
+      inTex.allocMemoryIndex = MemoryIndex;
+      inTex.AllocationID = Header->ID;
+    }
+
+    pBackend->BindImage(inTex.Image, inTex.allocMemory, inTex.allocOffset);
+
+    return true;
+  }
+/* MemoryBlock */
+
+/* ThreadChunk */
+  void ThreadChunk::Init(MemoryPool* inPool, MemoryBlock* inBlock, uint32_t inBlockId, VkDeviceSize inStart, VkDeviceSize inSize, VkDeviceSize Granularity)
+  {
+    pPool = inPool;
+    pBlock = inBlock;
+    BlockId = inBlockId;
+    Start = inStart;
+
+    // Start sits on a granularity page, so offsets inside the chunk fall on the same pages as in the block
+    Heap.Init(inSize, Granularity);
+
+    Allocations.assign(1, nullptr);
+    FreeIds.clear();
+  }
+
+  void ThreadChunk::Destroy()
+  {
+    // freeing the last object mustn't hand us back to the block while we're being torn down
+    bOwned = true;
+
+    for(uint32_t i = 1; i < Allocations.size(); i++)
+    {
+      if(Allocations[i] != nullptr)
+      {
+        Allocations[i]->pObject->Destroy();
+      }
+    }
+
+    Allocations.clear();
+    FreeIds.clear();
+
+    Heap.Destroy();
+  }
+
+  bool ThreadChunk::Allocate(Ek::AllocatedObject& Object, const VkMemoryRequirements& MemReq, bool bLinear)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    MemHeader* Header = Heap.Allocate(MemReq.size, MemReq.alignment, bLinear);
+
+    if(Header == nullptr)
+    {
+      return false;
+    }
+
+    if(FreeIds.size() > 0)
+    {
+      Header->ID = FreeIds.back();
+      FreeIds.pop_back();
+
+      Allocations[Header->ID] = Header;
+    }
+    else
+    {
+      Header->ID = Allocations.size();
+      Allocations.push_back(Header);
+    }
+
+    Header->pObject = &Object;
+    Header->Category = Object.Category;
+
+    pBlock->Record(Header, MemReq.size, MemReq.alignment, false);
+
+    Object.pBackend = pBlock->pBackend;
+    Object.pAllocator = pBlock;
+    Object.pChunk = this;
+    Object.allocSize = Header->MemorySize;
+    Object.allocOffset = Start + Header->Start;
+    Object.allocMemory = pBlock->Allocation;
+    Object.allocMemoryIndex = pBlock->MemoryIndex;
+    Object.AllocationID = Header->ID;
+
+    return true;
+  }
+
+  bool ThreadChunk::AllocateBuffer(Ek::Buffer& inBuff, const VkMemoryRequirements& MemReq)
+  {
+    if(!Allocate(inBuff, MemReq, true))
+    {
+      return false;
+    }
+
+    inBuff.pBackend->BindBuffer(inBuff.Buffer, inBuff.allocMemory, inBuff.allocOffset);
+
+    return true;
+  }
+
+  bool ThreadChunk::AllocateTexture(Ek::Texture& inTex, const VkMemoryRequirements& MemReq)
+  {
+    if(!Allocate(inTex, MemReq, false))
+    {
+      return false;
+    }
+
+    inTex.pBackend->BindImage(inTex.Image, inTex.allocMemory, inTex.allocOffset);
+
+    return true;
+  }
+
+  void ThreadChunk::Delete(uint32_t AllocId)
+  {
+    bool bRelease;
+
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+
+      if(AllocId == 0 || AllocId >= Allocations.size() || Allocations[AllocId] == nullptr)
+      {
+        cout << "Tried to delete chunk allocation with invalid ID : " << AllocId << '\n';
+        return;
+      }
+
+      pBlock->Record(Allocations[AllocId], 0, 0, true);
+
+      Heap.Free(Allocations[AllocId]);
+
+      Allocations[AllocId] = nullptr;
+      FreeIds.push_back(AllocId);
+
+      bRelease = !bOwned && !bReleasing && Heap.FreeSize == Heap.Size;
+      bReleasing |= bRelease;
+    }
+
+    // with nothing left in it and nobody able to adopt it, we're the last one to touch it
+    if(bRelease)
+    {
+      pPool->ReleaseChunk(this);
+    }
+  }
+
+  void ThreadChunk::Disown()
+  {
+    bool bRelease;
+
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
 
-    VkMemoryAllocateInfo AllocInfo{};
-    AllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    AllocInfo.allocationSize = DesiredSize;
-    AllocInfo.memoryTypeIndex = MemoryIndex;
+      bOwned = false;
+      bRelease = Heap.FreeSize == Heap.Size;
+      bReleasing = bRelease;
+    }
 
-    if((Err = vkAllocateMemory(inDevice, &AllocInfo, nullptr, &Allocation)) != VK_SUCCESS)
+    if(bRelease)
+    {
+      pPool->ReleaseChunk(this);
+    }
+  }
+
+  bool ThreadChunk::Adopt(VkDeviceSize MinFree)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(bOwned || bReleasing || Heap.FreeSize < MinFree)
     {
-      cout << "failed to allocate memory block with " << to_string(Err) << '\n';
       return false;
     }
 
-    Size = DesiredSize;
+    bOwned = true;
 
     return true;
   }
+/* ThreadChunk */
 
-  void MemoryBlock::Destroy()
+/* MemoryPool */
+  bool MemoryPool::Init(MemoryBackend* inBackend, uint32_t inMemoryIndex, VkMemoryPropertyFlags inProperties, VkDeviceSize inGranularity, uint32_t inHeapIndex, MemoryBudget* inBudget)
   {
-    if(Header != nullptr)
-    {
-      MemHeader* Next = Header;
-      MemHeader* Current = Header;
+    pBackend = inBackend;
+    MemoryIndex = inMemoryIndex;
+    Properties = inProperties;
+    Granularity = inGranularity;
+    HeapIndex = inHeapIndex;
+    pBudget = inBudget;
 
-      while(Current != nullptr)
-      {
-        if(Current->Next == nullptr)
-        {
-          Current->pObject->Destroy();
-          break;
-        }
-        else
-        {
-          Next = Current->Next;
-          Current->pObject->Destroy(); // Destroy function destroys object and it's memheader
-          Current = Next;
-          break;
-        }
-      }
+    Serial = NextPoolSerial++;
+
+    {
+      std::lock_guard<std::mutex> Guard(LivePoolLock);
+      LivePools.insert(Serial);
     }
 
-    vkFreeMemory(*pDevice, Allocation, nullptr);
+    // start with one block so the first few allocations don't have to wait on vkAllocateMemory
+    return AddBlock(0) != nullptr;
   }
 
-  void MemoryBlock::Map()
+  void MemoryPool::Destroy()
   {
-    VkResult Err;
+    {
+      std::lock_guard<std::mutex> Guard(LivePoolLock);
+      LivePools.erase(Serial);
+    }
 
-    if((Err = vkMapMemory(*pDevice, Allocation, 0, Size, 0, &Memory)) != VK_SUCCESS)
+    // chunks first, their ranges in the blocks have no object the blocks could destroy
+    for(uint32_t i = 0; i < Chunks.size(); i++)
     {
-      std::cout << "Mapping memory but failed with " << std::to_string(Err) << '\n';
+      Chunks[i]->Destroy();
+      delete Chunks[i];
     }
 
-    Mapped = true;
-  }
+    Chunks.clear();
 
-  void* MemoryBlock::GetMemory(uint32_t Offset)
-  {
-    if(Mapped)
+    // no thread's cached chunk matches us any more
+    Serial = 0;
+
+    for(uint32_t i = 0; i < Blocks.size(); i++)
     {
-      // pointer arithmetic, we add the offset to the address of the memory to move forward in memory by (offset)bytes
-      return ((byte*)Memory)+Offset;
+      Blocks[i]->Destroy();
+      delete Blocks[i];
     }
-    else
+
+    for(uint32_t i = 0; i < Dedicated.size(); i++)
     {
-      cout << "Something has attempted to retrieve a memory pointer from Memory block with MemType of " << MemType << " and failed due to the fact that the memory is not mapped\n";
-      return nullptr;
+      Dedicated[i]->Destroy();
+      delete Dedicated[i];
     }
-  }
 
-  void MemoryBlock::unMap()
-  {
-    vkUnmapMemory(*pDevice, Allocation);
-    Mapped = false;
+    Blocks.clear();
+    Dedicated.clear();
   }
 
-  void MemoryBlock::Delete(uint32_t AllocId)
+  MemoryBlock* MemoryPool::AddBlock(VkDeviceSize MinSize)
   {
-    MemHeader* TargetHeader;
+    // every block we add doubles the size of the next one
+    VkDeviceSize BlockSize = BaseBlockSize;
 
-    if(Header->ID == AllocId)
+    for(uint32_t i = 0; i < Blocks.size() && BlockSize < MaxBlockSize; i++)
     {
-      if(Header->Next != nullptr)
-      {
-        TargetHeader = Header->Next;
-        delete Header;
-        Header = TargetHeader;
-      }
-      else
-      {
-        Header = nullptr;
-        delete Header;
-      }
-
-      return;
+      BlockSize *= 2;
     }
 
-    TargetHeader = Header;
+    if(BlockSize > MaxBlockSize)
+    {
+      BlockSize = MaxBlockSize;
+    }
 
-    while(TargetHeader->Next != nullptr)
+    if(BlockSize < MinSize)
     {
-      if(TargetHeader->Next->ID == AllocId)
-      {
-        MemHeader* Temp = TargetHeader->Next;
+      BlockSize = MinSize;
+    }
 
-        TargetHeader->Next = Temp->Next;
+    // close to the budget we'd rather have a few more small blocks than push the heap over
+    while(pBudget != nullptr && !pBudget->Fits(HeapIndex, BlockSize) && BlockSize / 2 >= MinSize && BlockSize / 2 >= BaseBlockSize / 8)
+    {
+      BlockSize /= 2;
+    }
 
-        delete Temp;
+    MemoryBlock* Block = new MemoryBlock;
 
-        return;
+    // if the driver can't give us that much, back off towards the size we actually need
+    while(!Block->Init(pBackend, MemoryIndex, BlockSize, Granularity))
+    {
+      if(BlockSize / 2 < MinSize || BlockSize / 2 < BaseBlockSize / 8)
+      {
+        delete Block;
+        return nullptr;
       }
 
-      TargetHeader = TargetHeader->Next;
+      BlockSize /= 2;
     }
 
-    cout << "Tried to delete Allocation with invalid ID : " << AllocId << '\n';
+    SetupBlock(Block);
+    Blocks.push_back(Block);
 
-    return;
+    return Block;
   }
 
-  bool MemoryBlock::AllocateBuffer(Ek::Buffer& inBuff)
+  MemoryBlock* MemoryPool::AddDedicated(VkDeviceSize inSize, VkImage Image, VkBuffer Buffer, const std::function<bool(MemoryBlock*)>& TryBlock)
   {
-    VkMemoryRequirements MemReq;
-    vkGetBufferMemoryRequirements(*pDevice, inBuff.Buffer, &MemReq);
+    MemoryBlock* Block = new MemoryBlock;
 
-    uint32_t ReqSize = MemReq.size;
-    uint32_t ReqAlignment = MemReq.alignment;
+    // nothing else is ever placed in it, so there is no neighbour to keep a granularity page away from
+    if(!Block->Init(pBackend, MemoryIndex, inSize, 1, Image, Buffer))
+    {
+      delete Block;
+      return nullptr;
+    }
 
-    inBuff.pDevice = pDevice;
-    inBuff.pAllocator = this;
-    inBuff.allocSize = ReqSize;
-    inBuff.allocMemory = Allocation;
-    inBuff.allocMemoryType = MemType;
+    SetupBlock(Block);
 
-    // if the base header isn't used, use it
-    if(Header == nullptr)
+    // filled before anyone else can see it, Trim would free it while it's still empty
+    if(!TryBlock(Block))
     {
-      Header = new MemHeader;
+      Block->Destroy();
+      delete Block;
+      return nullptr;
+    }
 
-      Header->Start = 0;
-      Header->MemorySize = ReqSize;
-      Header->pObject = &inBuff;
-      Header->ID = IdIndex;
+    std::unique_lock<std::shared_mutex> Guard(BlockLock);
+    Dedicated.push_back(Block);
+
+    return Block;
+  }
 
-      inBuff.allocOffset = 0;
-      inBuff.AllocationID = IdIndex;
+  void MemoryPool::SetupBlock(MemoryBlock* Block)
+  {
+    Block->pBudget = pBudget;
+    Block->HeapIndex = HeapIndex;
+    Block->pTrace = pTrace;
 
-      vkBindBufferMemory(*pDevice, inBuff.Buffer, Allocation, inBuff.allocOffset);
+    if(pBudget != nullptr)
+    {
+      pBudget->TrackBlock(HeapIndex, Block->GetSize(), false);
+    }
 
-      IdIndex++;
+    Block->Coherent = Properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 
-      return true;
+    // host visible blocks stay mapped for their whole life
+    if(Properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+      Block->Map();
     }
+  }
 
-    MemHeader* Curr = Header;
-    MemHeader* NewHeader = new MemHeader;
-    NewHeader->pObject = &inBuff;
+  MemoryBlock* MemoryPool::Place(const std::function<bool(MemoryBlock*)>& TryBlock, VkDeviceSize MinSize)
+  {
+    uint32_t Seen;
 
-    while(Curr)
     {
-      uint32_t Offset = Curr->Start + Curr->MemorySize;
+      std::shared_lock<std::shared_mutex> Guard(BlockLock);
 
-      if(Curr->Next)
+      for(uint32_t i = 0; i < Blocks.size(); i++)
       {
-        uint32_t Free = Curr->Next->Start - Offset;
-
-        if(Free >= ReqSize)
+        if(TryBlock(Blocks[i]))
         {
-          if(Offset % ReqAlignment > 0)
-          {
-            Offset = ReqAlignment * ceil((float)Offset/(float)ReqAlignment);
-          }
+          return Blocks[i];
+        }
+      }
 
-          NewHeader->MemorySize = ReqSize;
-          NewHeader->Start= Offset;
-          NewHeader->ID = IdIndex;
+      Seen = Blocks.size();
+    }
 
-          // Insert NewHeader between curr and next
-          NewHeader->Next = Curr->Next;
-          Curr->Next = NewHeader;
+    // only growing needs the pool to itself
+    std::unique_lock<std::shared_mutex> Guard(BlockLock);
 
-          inBuff.allocOffset = Offset;
-          inBuff.AllocationID = IdIndex;
+    // another thread may have grown the pool while we waited for the lock
+    for(uint32_t i = Seen; i < Blocks.size(); i++)
+    {
+      if(TryBlock(Blocks[i]))
+      {
+        return Blocks[i];
+      }
+    }
 
-          vkBindBufferMemory(*pDevice, inBuff.Buffer, inBuff.allocMemory, inBuff.allocOffset);
+    MemoryBlock* Block = AddBlock(MinSize);
 
-          IdIndex++;
+    return (Block != nullptr && TryBlock(Block)) ? Block : nullptr;
+  }
 
-          return true;
-        }
-      }
-      else
-      {
-        uint32_t Free = Size - Offset;
+  VkDeviceSize MemoryPool::GetChunkAlignment()
+  {
+    // chunk ranges take whole granularity pages, so they never share one with a neighbour of the other tiling
+    return std::max<VkDeviceSize>(65536, Granularity);
+  }
 
-        if(Free >= ReqSize)
-        {
-          if(Offset % ReqAlignment > 0)
-          {
-            Offset = ReqAlignment * ceil((float)Offset/(float)ReqAlignment);
-          }
+  ThreadChunk* MemoryPool::GetChunk(const VkMemoryRequirements& MemReq, bool bFull)
+  {
+    if(MemReq.size > ChunkAllocSize || MemReq.alignment > GetChunkAlignment() || MemoryIndex >= VK_MAX_MEMORY_TYPES)
+    {
+      return nullptr;
+    }
+
+    CachedChunk& Cache = ChunkCache.Entries[MemoryIndex];
 
-          NewHeader->MemorySize = ReqSize;
-          NewHeader->Start = Offset;
-          NewHeader->ID = IdIndex;
+    if(Cache.Serial == Serial && !bFull)
+    {
+      return Cache.pChunk;
+    }
+
+    // the old one is full, another thread can have it once some of it has been freed
+    if(Cache.Serial == Serial)
+    {
+      Cache.pChunk->Disown();
+    }
 
-          Curr->Next = NewHeader;
+    Cache.pChunk = FindChunk();
+    Cache.Serial = (Cache.pChunk != nullptr) ? Serial : 0;
 
-          inBuff.allocOffset = Offset;
-          inBuff.AllocationID = IdIndex;
+    return Cache.pChunk;
+  }
 
-          vkBindBufferMemory(*pDevice, inBuff.Buffer, inBuff.allocMemory, inBuff.allocOffset);
+  ThreadChunk* MemoryPool::FindChunk()
+  {
+    VkDeviceSize Alignment = GetChunkAlignment();
+    VkDeviceSize inSize = AlignUp(ChunkSize, Alignment);
 
-          IdIndex++;
+    // a quarter free is worth going back to, less and we'd be looking for a new chunk again right away
+    {
+      std::lock_guard<std::mutex> Guard(ChunkLock);
 
-          return true;
+      for(uint32_t i = 0; i < Chunks.size(); i++)
+      {
+        if(Chunks[i]->Adopt(inSize / 4))
+        {
+          return Chunks[i];
         }
       }
+    }
+
+    uint32_t BlockId = 0;
+    VkDeviceSize Offset = 0;
 
-      Curr = Curr->Next;
+    MemoryBlock* Block = Place([&](MemoryBlock* pBlock) { return (BlockId = pBlock->ReserveChunk(inSize, Alignment, Offset)) != 0; }, inSize + Alignment);
+
+    if(Block == nullptr)
+    {
+      return nullptr;
     }
 
-    return false;
+    ThreadChunk* Chunk = new ThreadChunk;
+    Chunk->Init(this, Block, BlockId, Offset, inSize, Granularity);
+
+    std::lock_guard<std::mutex> Guard(ChunkLock);
+    Chunks.push_back(Chunk);
+
+    return Chunk;
   }
 
-  bool MemoryBlock::AllocateTexture(Ek::Texture& inTex)
+  void MemoryPool::ReleaseChunk(ThreadChunk* Chunk)
   {
-    VkMemoryRequirements MemReq;
-    vkGetImageMemoryRequirements(*pDevice, inTex.Image, &MemReq);
+    {
+      std::lock_guard<std::mutex> Guard(ChunkLock);
+      Chunks.erase(std::find(Chunks.begin(), Chunks.end(), Chunk));
+    }
+
+    // shared so Trim can't pull the block out from under the delete
+    {
+      std::shared_lock<std::shared_mutex> Guard(BlockLock);
+      Chunk->pBlock->Delete(Chunk->BlockId);
+    }
 
-    uint32_t ReqSize = MemReq.size;
-    uint32_t ReqAlignment = MemReq.alignment;
+    Chunk->Destroy();
+    delete Chunk;
+  }
 
-    inTex.allocSize = ReqSize;
-    inTex.allocMemory = Allocation;
-    inTex.allocMemoryType = MemType;
-    inTex.pAllocator = this;
-    inTex.pDevice = pDevice;
+  bool MemoryPool::AllocateBuffer(Ek::Buffer& inBuff, const VkMemoryRequirements& MemReq, bool bDedicated)
+  {
+    return Allocate(MemReq, bDedicated, VK_NULL_HANDLE, inBuff.Buffer,
+      [&](MemoryBlock* Block) { return Block->AllocateBuffer(inBuff, MemReq); },
+      [&](ThreadChunk* Chunk) { return Chunk->AllocateBuffer(inBuff, MemReq); });
+  }
 
-    // if the base header isn't used, use it
-    if(Header == nullptr)
+  bool MemoryPool::AllocateTexture(Ek::Texture& inTex, const VkMemoryRequirements& MemReq, bool bDedicated)
+  {
+    return Allocate(MemReq, bDedicated, inTex.Image, VK_NULL_HANDLE,
+      [&](MemoryBlock* Block) { return Block->AllocateTexture(inTex, MemReq); },
+      [&](ThreadChunk* Chunk) { return Chunk->AllocateTexture(inTex, MemReq); });
+  }
+
+  bool MemoryPool::Allocate(const VkMemoryRequirements& MemReq, bool bDedicated, VkImage Image, VkBuffer Buffer, const std::function<bool(MemoryBlock*)>& TryBlock, const std::function<bool(ThreadChunk*)>& TryChunk)
+  {
+    if(bDedicated || MemReq.size >= DedicatedSize)
     {
-      Header = new MemHeader;
+      if(AddDedicated(MemReq.size, Image, Buffer, TryBlock) != nullptr)
+      {
+        return true;
+      }
 
-      Header->Start = 0;
-      Header->MemorySize = ReqSize;
-      Header->pObject = &inTex;
-      Header->ID = IdIndex;
+      // we never create resources that require dedicated memory, so the shared blocks are a fine fallback
+    }
+    else if(ChunkSize > 0)
+    {
+      ThreadChunk* Chunk = GetChunk(MemReq, false);
+
+      if(Chunk != nullptr && (TryChunk(Chunk) || ((Chunk = GetChunk(MemReq, true)) != nullptr && TryChunk(Chunk))))
+      {
+        return true;
+      }
+    }
 
-      inTex.allocOffset = 0;
-      inTex.AllocationID = IdIndex;
+    return Place(TryBlock, MemReq.size + MemReq.alignment) != nullptr;
+  }
 
-      // we assume here that IdIndex is 0, so we increase it to 1 so that we don't have duplicate AllocationIDs
-      IdIndex++;
+  void MemoryPool::Trim(uint64_t Frame, bool bNow)
+  {
+    // IsEmpty takes the block's lock, so a thread still on its way out of Delete is done with the block once it says yes
+    std::unique_lock<std::shared_mutex> Guard(BlockLock);
 
-      vkBindImageMemory(*pDevice, inTex.Image, inTex.allocMemory, inTex.allocOffset);
+    // a dedicated block can't be reused by anything else, so there's no point holding on to it
+    for(uint32_t i = 0; i < Dedicated.size(); i++)
+    {
+      if(Dedicated[i]->IsEmpty())
+      {
+        Dedicated[i]->Destroy();
+        delete Dedicated[i];
 
-      return true;
+        Dedicated.erase(Dedicated.begin()+i);
+        i--;
+      }
     }
 
-    MemHeader* Curr = Header;
-    MemHeader* NewHeader = new MemHeader;
-    NewHeader->pObject = &inTex;
+    for(uint32_t i = 0; i < Blocks.size(); i++)
+    {
+      if(!Blocks[i]->IsEmpty())
+      {
+        Blocks[i]->EmptySince = 0;
+        continue;
+      }
 
-    while(Curr != nullptr)
+      if(Blocks[i]->EmptySince == 0)
+      {
+        Blocks[i]->EmptySince = Frame;
+      }
+
+      // we always keep one block around so a pool that empties out doesn't thrash vkAllocateMemory
+      if((bNow || Frame - Blocks[i]->EmptySince >= EmptyFrameThreshold) && Blocks.size() > 1)
+      {
+        Blocks[i]->Destroy();
+        delete Blocks[i];
+
+        Blocks.erase(Blocks.begin()+i);
+        i--;
+      }
+    }
+  }
+
+  bool MemoryPool::NeedsDefrag(uint32_t Threshold)
+  {
+    std::shared_lock<std::shared_mutex> Guard(BlockLock);
+
+    uint32_t Used = 0;
+
+    for(uint32_t i = 0; i < Blocks.size(); i++)
     {
-      uint32_t Offset = Curr->Start + Curr->MemorySize;
+      // holes in an almost full block aren't worth copying for
+      bool bRoomy = Blocks[i]->GetSize() - Blocks[i]->GetUsedSize() >= Blocks[i]->GetSize() / 8;
 
-      if(Curr->Next)
+      if(bRoomy && Blocks[i]->AssessFrag() >= Threshold)
       {
-        uint32_t Free = Curr->Next->Start - Offset;
+        return true;
+      }
 
-        if(Free >= ReqSize)
-        {
-          if(Offset % ReqAlignment > 0)
-          {
-            Offset = ReqAlignment * ceil((float)Offset/(float)ReqAlignment);
-          }
+      if(!Blocks[i]->IsEmpty())
+      {
+        Used++;
+      }
+    }
+
+    // more than one block in use, the emptiest one might fit in the holes of the others
+    return Used > 1;
+  }
+
+  MemHeader* MemoryPool::FindMoveCandidate(MemoryBlock*& pSrc)
+  {
+    std::shared_lock<std::shared_mutex> Guard(BlockLock);
+
+    // the least used block is the source, emptying it lets Trim give it back
+    pSrc = nullptr;
 
-          NewHeader->MemorySize = ReqSize;
-          NewHeader->Start = Offset;
-          NewHeader->ID = IdIndex;
+    for(uint32_t i = 0; i < Blocks.size(); i++)
+    {
+      if(!Blocks[i]->IsEmpty() && (pSrc == nullptr || Blocks[i]->GetUsedSize() <= pSrc->GetUsedSize()))
+      {
+        pSrc = Blocks[i];
+      }
+    }
 
-          // Insert NewHeader between curr and next
-          NewHeader->Next = Curr->Next;
-          Curr->Next = NewHeader;
+    if(pSrc == nullptr)
+    {
+      return nullptr;
+    }
 
-          inTex.allocOffset = Offset;
-          inTex.AllocationID = IdIndex;
+    return pSrc->PickMovable();
+  }
 
-          IdIndex++;
+  MemoryBlock* MemoryPool::ReserveMove(MemoryBlock* pSrc, MemHeader* Header, const VkMemoryRequirements& MemReq, uint32_t& AllocId)
+  {
+    std::shared_lock<std::shared_mutex> Guard(BlockLock);
 
-          vkBindImageMemory(*pDevice, inTex.Image, inTex.allocMemory, inTex.allocOffset);
+    std::vector<MemoryBlock*> Targets;
 
-          return true;
-        }
+    // fuller blocks first, moving into a block emptier than the source would just move the hole around
+    for(uint32_t i = 0; i < Blocks.size(); i++)
+    {
+      if(Blocks[i] != pSrc && Blocks[i]->GetUsedSize() >= pSrc->GetUsedSize())
+      {
+        Targets.push_back(Blocks[i]);
       }
-      else
+    }
+
+    std::sort(Targets.begin(), Targets.end(), [](MemoryBlock* A, MemoryBlock* B) { return A->GetUsedSize() > B->GetUsedSize(); });
+
+    for(uint32_t i = 0; i < Targets.size(); i++)
+    {
+      if((AllocId = Targets[i]->Reserve(MemReq, Header->bLinear, Header->pObject)) != 0)
       {
-        uint32_t Free = Size - Offset;
+        return Targets[i];
+      }
+    }
 
-        if(Free >= ReqSize)
-        {
-          if(Offset % ReqAlignment > 0)
-          {
-            Offset = ReqAlignment * ceil((float)Offset/(float)ReqAlignment);
-          }
+    if((AllocId = pSrc->Reserve(MemReq, Header->bLinear, Header->pObject, Header->Start)) != 0)
+    {
+      return pSrc;
+    }
+
+    return nullptr;
+  }
 
-          NewHeader->Start = Offset;
-          NewHeader->MemorySize = ReqSize;
-          NewHeader->ID = IdIndex;
+  void MemoryPool::GetStats(Stats& Out)
+  {
+    std::shared_lock<std::shared_mutex> Guard(BlockLock);
 
-          Curr->Next = NewHeader;
+    Out = Stats();
 
-          inTex.allocOffset = Offset;
-          inTex.AllocationID = IdIndex;
+    Out.BlockCount = Blocks.size();
+    Out.DedicatedCount = Dedicated.size();
 
-          IdIndex++;
+    for(uint32_t i = 0; i < Blocks.size(); i++)
+    {
+      Out.BlockBytes += Blocks[i]->GetSize();
+      Out.UsedBytes += Blocks[i]->GetUsedSize();
+      Out.FreeBytes += Blocks[i]->GetSize() - Blocks[i]->GetUsedSize();
 
-          vkBindImageMemory(*pDevice, inTex.Image, inTex.allocMemory, inTex.allocOffset);
+      VkDeviceSize Largest = Blocks[i]->GetLargestFree();
 
-          return true;
-        }
+      if(Largest > Out.LargestFree)
+      {
+        Out.LargestFree = Largest;
       }
+    }
+
+    for(uint32_t i = 0; i < Dedicated.size(); i++)
+    {
+      Out.BlockBytes += Dedicated[i]->GetSize();
+      Out.UsedBytes += Dedicated[i]->GetUsedSize();
+    }
+  }
+
+  uint64_t MemoryPool::GetVersion()
+  {
+    std::shared_lock<std::shared_mutex> Guard(BlockLock);
+
+    uint64_t Ret = Blocks.size();
 
-      Curr = Curr->Next;
+    for(uint32_t i = 0; i < Blocks.size(); i++)
+    {
+      Ret += Blocks[i]->Version;
     }
 
-    return false;
+    return Ret;
   }
+/* MemoryPool */
 }
 
 namespace Ek
 {
   void AllocatedObject::Delete()
   {
+    if(AliasRefs != nullptr)
+    {
+      bool bLast = AliasRefs->fetch_sub(1) == 1;
+      AliasRefs.reset();
+
+      // someone else is still bound to the range
+      if(!bLast)
+      {
+        return;
+      }
+    }
+
+    if(pChunk != nullptr)
+    {
+      pChunk->Delete(AllocationID);
+      return;
+    }
+
     pAllocator->Delete(AllocationID);
   }
 
+  bool AllocatedObject::ShareMemory(AllocatedObject& Owner)
+  {
+    // the defragmenter only knows about the owner, it would move the range out from under the aliases.
+    // A dedicated allocation may only ever be bound to the one resource it was made for
+    if(bMovable || Owner.bMovable || Owner.pAllocator == nullptr || Owner.pAllocator->bDedicated)
+    {
+      return false;
+    }
+
+    if(Owner.AliasRefs == nullptr)
+    {
+      Owner.AliasRefs = std::make_shared<std::atomic<uint32_t>>(1);
+    }
+
+    Owner.AliasRefs->fetch_add(1);
+    AliasRefs = Owner.AliasRefs;
+
+    pBackend = Owner.pBackend;
+    pAllocator = Owner.pAllocator;
+    pChunk = Owner.pChunk;
+    AllocationID = Owner.AllocationID;
+
+    allocSize = Owner.allocSize;
+    allocOffset = Owner.allocOffset;
+    allocMemory = Owner.allocMemory;
+    allocMemoryIndex = Owner.allocMemoryIndex;
+    allocMemoryUsage = Owner.allocMemoryUsage;
+    Category = Owner.Category;
+
+    return true;
+  }
+
   void AllocatedObject::Map(void** Pointer)
   {
     *Pointer = pAllocator->GetMemory(allocOffset);
     return;
   }
 
+  void AllocatedObject::Flush()
+  {
+    pAllocator->Flush();
+  }
+
+  void AllocatedObject::Invalidate()
+  {
+    pAllocator->Invalidate();
+  }
+
   void Texture::Destroy()
   {
-    vkDestroyImage(*pDevice, Image, nullptr);
+    pBackend->DestroyImage(Image);
     Delete();
   }
 
+  VkResult Texture::Alias(Texture& Owner)
+  {
+    VkMemoryRequirements MemReq;
+    Owner.pBackend->GetImageRequirements(Image, MemReq);
+
+    // the image has to fit the owner's range as it was placed, we can't move or grow it
+    if(MemReq.size > Owner.allocSize || Owner.allocOffset % MemReq.alignment != 0 || !(MemReq.memoryTypeBits & (1u << Owner.allocMemoryIndex)))
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    if(!ShareMemory(Owner))
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    VkResult Err;
+
+    if((Err = pBackend->BindImage(Image, allocMemory, allocOffset)) != VK_SUCCESS)
+    {
+      Delete();
+      return Err;
+    }
+
+    return VK_SUCCESS;
+  }
+
   VkImageMemoryBarrier Texture::Barrier(VkImageAspectFlags Aspect, VkImageLayout NewLayout, VkAccessFlags src, VkAccessFlags dst)
   {
     VkImageMemoryBarrier Barrier{};
@@ -378,8 +1620,8 @@ namespace Ek
 
     Barrier.subresourceRange.aspectMask = Aspect;
     Barrier.subresourceRange.layerCount = 1;
-    Barrier.subresourceRange.levelCount = 1;
-    Barrier.subresourceRange.baseMipLevel = 0;
+    Barrier.subresourceRange.levelCount = MipLevels - BaseLevel;
+    Barrier.subresourceRange.baseMipLevel = BaseLevel;
     Barrier.subresourceRange.baseArrayLayer = 0;
 
     Layout = NewLayout;
@@ -389,7 +1631,7 @@ namespace Ek
 
   void Buffer::Destroy()
   {
-    vkDestroyBuffer(*pDevice, Buffer, nullptr);
+    pBackend->DestroyBuffer(Buffer);
     Delete();
   }
 }
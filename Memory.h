@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <vector>
 #include <queue>
 
@@ -9,8 +15,14 @@
 namespace EkBackend
 {
   class MemHeader;
+  class TlsfHeap;
   class MemoryBlock;
+  class ThreadChunk;
+  class MemoryPool;
   class AllocateInterface;
+  class MoveListener;
+  class MemoryBudget;
+  class MemoryBackend;
 }
 
 namespace Ek
@@ -24,33 +36,91 @@ namespace Ek
 /* Full declarations */
 namespace Ek
 {
-  enum eMemoryType
+  // what a resource's memory is used for, vulkanInterface turns this into the best memory type the resource supports
+  enum eMemoryUsage
   {
-    eHostMemory = 0,
-    eLocalMemory = 1
+    eGpuOnly = 0,   // device local, never mapped
+    eUpload = 1,    // host visible + coherent, uncached (write-combined) so the cpu can stream writes into it
+    eReadback = 2,  // host visible + cached so the cpu can read results back quickly
+    eGpuMapped = 3, // device local + host visible (ReBAR) when the device has it, for data the cpu rewrites every frame
+    eTransient = 4  // attachments that never leave the render pass, lazily allocated when the device has it (tilers), device local otherwise
+  };
+
+  // what a resource is, only used to report where memory goes. See EkBackend::MemoryBudget
+  enum eMemoryCategory
+  {
+    eMemoryOther = 0,
+    eMemoryTexture = 1,
+    eMemoryMesh = 2,
+    eMemoryRenderTarget = 3,
+    eMemoryCategoryCount = 4
+  };
+
+  // handed out by uploads, done once the copies have landed and graphics owns the data
+  typedef uint64_t UploadToken;
+
+  // an image on the cpu, 4 byte texels or BC blocks. RowPitch is level 0's, any levels after it are tightly packed behind it.
+  // See EkBackend::MipGenerator for the layout
+  struct ImageData
+  {
+    std::vector<uint8_t> Pixels;
+    VkExtent2D Extent = {0, 0};
+    uint32_t RowPitch = 0;
+    uint32_t MipLevels = 1;
+    VkFormat Format = VK_FORMAT_R8G8B8A8_UNORM;
   };
 
   class AllocatedObject
   {
     friend EkBackend::MemoryBlock;
+    friend EkBackend::ThreadChunk;
 
     public:
-      uint32_t allocSize;
-      uint32_t allocOffset;
-      eMemoryType allocMemoryType;
+      VkDeviceSize allocSize;
+      VkDeviceSize allocOffset;
+      uint32_t allocMemoryIndex;
+      eMemoryUsage allocMemoryUsage;
+
+      // set before allocating to let the defragmenter relocate this object. Movable objects need TRANSFER_SRC and TRANSFER_DST usage
+      bool bMovable = false;
+
+      // set before allocating, the budget tracks usage per category
+      eMemoryCategory Category = eMemoryOther;
+
+      // told after the object has been given a new handle, so views and descriptors pointing at the old one can be rebuilt
+      EkBackend::MoveListener* pMoveListener = nullptr;
+
+      // buffers get deleted through this, Destroy still has to be called first
+      virtual ~AllocatedObject() {}
 
       virtual void Destroy() = 0;
       void Map(void** Pointer);
 
+      VkDeviceMemory GetDeviceMemory() { return allocMemory; }
+
+      // only do anything when the memory type isn't HOST_COHERENT
+      void Flush();
+      void Invalidate();
+
     protected:
-      VkDevice* pDevice;
+      EkBackend::MemoryBackend* pBackend;
       VkDeviceMemory allocMemory;
 
       void Delete();
 
+      // copies the allocation over and takes a reference on it, the caller binds its own handle. False for movable objects and
+      // owners in a dedicated block
+      bool ShareMemory(AllocatedObject& Owner);
+
     private:
-      EkBackend::MemoryBlock* pAllocator;
+      EkBackend::MemoryBlock* pAllocator = nullptr;
       uint32_t AllocationID;
+
+      // set when the object lives in a thread's chunk, AllocationID is the chunk's then. pAllocator is still the block for mapping
+      EkBackend::ThreadChunk* pChunk = nullptr;
+
+      // shared by an object and everything aliasing its memory, whoever lets go last gives the range back
+      std::shared_ptr<std::atomic<uint32_t>> AliasRefs;
   };
 
   class Texture : public AllocatedObject
@@ -59,6 +129,11 @@ namespace Ek
       VkImageMemoryBarrier Barrier(VkImageAspectFlags Aspect, VkImageLayout NewLayout, VkAccessFlags src, VkAccessFlags dst);
       void Destroy();
 
+      // binds this image to Owner's memory instead of allocating its own. Only for images that are never in use at the same time
+      // as the owner (transient attachments of different frames), neither can be movable and the contents don't survive between uses.
+      // Fails when the owner got a dedicated block, the caller allocates its own memory then
+      VkResult Alias(Texture& Owner);
+
       // Handles
         VkImage Image;
 
@@ -66,6 +141,10 @@ namespace Ek
         VkExtent2D Extent;
         VkFormat Format;
         VkImageLayout Layout;
+        VkImageUsageFlags Usage;
+        uint32_t MipLevels = 1;
+        // first level with anything in it, views start here. Only above 0 while TextureStreamer is filling the chain in
+        uint32_t BaseLevel = 0;
   };
 
   class Buffer : public AllocatedObject
@@ -75,63 +154,365 @@ namespace Ek
 
       // Handles
         VkBuffer Buffer;
+
+      // Buffer data
+        VkDeviceSize Size;
+        VkBufferUsageFlags Usage;
   };
 }
 
 namespace EkBackend
 {
+  // one physical range of a block, free or used. Used ranges are handed out as AllocationIDs by the MemoryBlock
   struct MemHeader
   {
-    uint32_t MemorySize;
-    uint32_t Start;
+    VkDeviceSize MemorySize;
+    VkDeviceSize Start;
+
+    uint32_t ID = 0;
+
+    Ek::AllocatedObject* pObject = nullptr;
+
+    bool bFree = true;
+    bool bLinear = true; // buffers are linear, optimal tiled images are not. Used for bufferImageGranularity
+
+    bool bMovable = false; // copied from the object when allocated, so we never have to touch pObject to find out
+    Ek::eMemoryCategory Category = Ek::eMemoryOther; // same
+    bool bMoving = false;  // already picked by the defragmenter this pass
+
+    // neighbours in address order
+    MemHeader* PrevPhys = nullptr;
+    MemHeader* NextPhys = nullptr;
+
+    // links in the segregated free list, only valid while bFree is set
+    MemHeader* PrevFree = nullptr;
+    MemHeader* NextFree = nullptr;
+  };
+
+  /*
+    Two-level segregated fit allocator, only deals in offsets so it doesn't touch vulkan.
+    The first level splits sizes by power of two, the second level splits each power of two into SlCount linear ranges.
+    A bitmap per level lets us find a free range that is large enough with two bit scans, so Allocate and Free are O(1).
+    Sizes and offsets are 64 bit, so a heap can span the whole of a large device heap.
+  */
+  class TlsfHeap
+  {
+    public:
+      void Init(VkDeviceSize inSize, VkDeviceSize inGranularity);
+      void Destroy();
+
+      MemHeader* Allocate(VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear);
+      void Free(MemHeader* Header);
+
+      MemHeader* GetFirst() { return First; }
+      VkDeviceSize GetLargestFree();
+
+      // extends the heap to NewSize, the new space is appended behind the last range
+      void Grow(VkDeviceSize NewSize);
+
+      VkDeviceSize Size = 0;
+      VkDeviceSize FreeSize = 0;
+
+    private:
+      static const uint32_t SlLog2 = 5;
+      static const uint32_t SlCount = 1 << SlLog2;
+      static const uint32_t FlShift = SlLog2;
+      static const uint32_t SmallBlock = 1 << FlShift;
+      static const uint32_t FlCount = 64 - FlShift + 1;
+
+      static void Mapping(VkDeviceSize inSize, uint32_t& Fl, uint32_t& Sl);
 
-    uint32_t ID = -1;
+      MemHeader* FindFree(VkDeviceSize inSize);
+      void InsertFree(MemHeader* Header);
+      void RemoveFree(MemHeader* Header);
+      bool Place(MemHeader* Header, VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear, VkDeviceSize& Offset);
 
-    Ek::AllocatedObject* pObject;
+      VkDeviceSize Granularity = 1;
 
-    MemHeader* Next = nullptr;
+      uint64_t FlBitmap = 0;
+      uint32_t SlBitmap[FlCount] = {};
+      MemHeader* FreeLists[FlCount][SlCount] = {};
+
+      MemHeader* First = nullptr;
   };
 
+  /*
+    One VkDeviceMemory allocation and the TlsfHeap that splits it up.
+    Every method that touches the heap or the ID table takes Lock, so threads can allocate and free in the same block.
+  */
   class MemoryBlock
   {
+    friend ThreadChunk;
+
     public:
-      bool Init(VkDevice& inDevice, uint32_t inMemoryIndex, uint32_t DesiredSize);
+      // a dedicated block is made for exactly one image or buffer, pass its handle and the driver can lay the memory out for it
+      bool Init(MemoryBackend* inBackend, uint32_t inMemoryIndex, VkDeviceSize DesiredSize, VkDeviceSize BufferImageGranularity = 1, VkImage DedicatedImage = VK_NULL_HANDLE, VkBuffer DedicatedBuffer = VK_NULL_HANDLE);
       void Destroy();
 
       void Map();
-      void* GetMemory(uint32_t Offset);
+      void* GetMemory(VkDeviceSize Offset);
       void unMap();
 
+      void Flush();
+      void Invalidate();
+
       bool AllocateBuffer(Ek::Buffer& inBuffer);
       bool AllocateTexture(Ek::Texture& inTexture);
+      bool AllocateBuffer(Ek::Buffer& inBuffer, const VkMemoryRequirements& MemReq);
+      bool AllocateTexture(Ek::Texture& inTexture, const VkMemoryRequirements& MemReq);
       void Delete(uint32_t AllocId);
 
+      // a range for a ThreadChunk, it has no object of its own so the budget and the trace only see what goes in it
+      uint32_t ReserveChunk(VkDeviceSize inSize, VkDeviceSize Alignment, VkDeviceSize& Offset);
+
+      // budget and trace bookkeeping for a range handed to or taken back from a resource
+      void Record(const MemHeader* Header, VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bFreed);
+
+      // 0 - 100, how much of the free space is split up. 0 means all free space is one range
       uint32_t AssessFrag();
 
-      Ek::eMemoryType MemType;
+      // defragmentation, Reserve takes a range for an object without binding it (0 on failure),
+      // only accepting ranges that start below Below. Adopt moves the object into the reserved range and frees its old one
+      uint32_t Reserve(const VkMemoryRequirements& MemReq, bool bLinear, Ek::AllocatedObject* pObject, VkDeviceSize Below = UINT64_MAX);
+      void Adopt(Ek::AllocatedObject& Object, uint32_t AllocId);
+      // the highest movable allocation nobody is moving yet, marked as moving
+      MemHeader* PickMovable();
+
+      bool IsEmpty();
+      VkDeviceSize GetSize() { return Size; }
+      // a snapshot that can be read without the lock, good enough for heuristics
+      VkDeviceSize GetUsedSize() { return UsedSize.load(std::memory_order_relaxed); }
+      VkDeviceSize GetLargestFree();
+      VkDeviceSize GetOffset(uint32_t AllocId);
+      VkDeviceMemory GetAllocation() { return Allocation; }
+
       bool Mapped;
+      bool Coherent = true;
+      bool bDedicated = false;
+
+      // frame the block was first seen empty by MemoryPool::Trim, 0 while it holds allocations
+      uint64_t EmptySince = 0;
+
+      // bumped on every allocation and free, lets the defragmenter tell if anything changed since it last gave up
+      std::atomic<uint64_t> Version{0};
+
+      // allocations and frees are reported here when set
+      MemoryBudget* pBudget = nullptr;
+      uint32_t HeapIndex = 0;
+
+      // allocations and frees get written here as a trace the memory bench can replay
+      std::ostream* pTrace = nullptr;
 
     private:
-      VkDevice* pDevice;
+      // both expect Lock to be held
+      MemHeader* Allocate(VkDeviceSize ReqSize, VkDeviceSize ReqAlignment, bool bLinear, Ek::AllocatedObject* pObject);
+      void Release(uint32_t AllocId);
+
+      MemoryBackend* pBackend;
       uint32_t MemoryIndex;
       VkDeviceMemory Allocation;
-      uint32_t Size;
+      VkDeviceSize Size;
 
       void* Memory;
 
-      uint32_t IdIndex = 1;
+      std::mutex Lock;
+      std::atomic<VkDeviceSize> UsedSize{0};
+
+      TlsfHeap Heap;
 
-      MemHeader* Header = nullptr;
+      // AllocationID -> header, 0 is never handed out. Released IDs are reused so the table stays dense
+      std::vector<MemHeader*> Allocations;
+      std::vector<uint32_t> FreeIds;
+  };
+
+  /*
+    A slice of a shared block that one thread places its small allocations in, so threads loading assets in parallel
+    don't queue up on the same block. To the block the slice is a single range, what goes inside it comes from the
+    chunk's own TlsfHeap. Other threads only take Lock to free objects they were handed.
+    When the owning thread fills it up it lets go of the chunk, any thread can pick it up again once enough has been freed
+    and whoever frees the last allocation of a chunk nobody owns gives it back to the block.
+    Objects in chunks are never moved by the defragmenter, they're small enough that it wouldn't pay off.
+  */
+  class ThreadChunk
+  {
+    public:
+      void Init(MemoryPool* inPool, MemoryBlock* inBlock, uint32_t inBlockId, VkDeviceSize inStart, VkDeviceSize inSize, VkDeviceSize Granularity);
+      // destroys whatever still lives in the chunk, the range in the block is left to the block
+      void Destroy();
+
+      bool AllocateBuffer(Ek::Buffer& inBuffer, const VkMemoryRequirements& MemReq);
+      bool AllocateTexture(Ek::Texture& inTexture, const VkMemoryRequirements& MemReq);
+      void Delete(uint32_t AllocId);
+
+      // the owning thread is done with it
+      void Disown();
+      // takes the chunk for the calling thread if nobody owns it and at least MinFree bytes are free
+      bool Adopt(VkDeviceSize MinFree);
+
+      MemoryBlock* pBlock;
+      uint32_t BlockId;
+
+    private:
+      bool Allocate(Ek::AllocatedObject& Object, const VkMemoryRequirements& MemReq, bool bLinear);
+
+      MemoryPool* pPool;
+      VkDeviceSize Start;
+
+      std::mutex Lock;
+      bool bOwned = true;
+      // empty, unowned and on its way back to the block, nobody may adopt it any more
+      bool bReleasing = false;
+
+      TlsfHeap Heap;
+
+      std::vector<MemHeader*> Allocations;
+      std::vector<uint32_t> FreeIds;
+  };
+
+  /*
+    A growable list of MemoryBlocks that all use the same memory type.
+    When every block is full a new one is added, each new block is twice the size of the last up to MaxBlockSize.
+    Blocks that stay empty for EmptyFrameThreshold frames are given back to the driver by Trim().
+    Resources the driver wants their own memory for, or that are DedicatedSize or bigger, get a dedicated block instead.
+    Those are kept apart from the shared blocks so the defragmenter never looks at them, and Trim frees them as soon as they're empty.
+
+    Any thread can allocate and free. Allocations up to ChunkAllocSize come out of the calling thread's ThreadChunk,
+    bigger ones share BlockLock to walk the blocks and only take it to themselves when the pool has to grow.
+    Trim, Destroy and the defragmenter are for the render thread.
+  */
+  class MemoryPool
+  {
+    friend ThreadChunk;
+
+    public:
+      bool Init(MemoryBackend* inBackend, uint32_t inMemoryIndex, VkMemoryPropertyFlags inProperties, VkDeviceSize inGranularity, uint32_t inHeapIndex = 0, MemoryBudget* inBudget = nullptr);
+      void Destroy();
+
+      bool AllocateBuffer(Ek::Buffer& inBuffer, const VkMemoryRequirements& MemReq, bool bDedicated = false);
+      bool AllocateTexture(Ek::Texture& inTexture, const VkMemoryRequirements& MemReq, bool bDedicated = false);
+
+      // bNow skips the wait for blocks that are already empty, for when the heap is running out of budget
+      void Trim(uint64_t Frame, bool bNow = false);
+
+      // defragmentation, see vulkanInterface::Defragment
+      bool NeedsDefrag(uint32_t Threshold);
+      MemHeader* FindMoveCandidate(MemoryBlock*& pSrc);
+      MemoryBlock* ReserveMove(MemoryBlock* pSrc, MemHeader* Header, const VkMemoryRequirements& MemReq, uint32_t& AllocId);
+      uint64_t GetVersion();
+
+      struct Stats
+      {
+        uint32_t BlockCount = 0;
+        uint32_t DedicatedCount = 0;
+        uint64_t BlockBytes = 0;     // VkDeviceMemory held by the pool, dedicated blocks included
+        uint64_t UsedBytes = 0;
+        uint64_t FreeBytes = 0;      // free space in the shared blocks
+        uint64_t LargestFree = 0;    // largest free range in any shared block
+      };
+
+      void GetStats(Stats& Out);
+
+      VkDeviceSize BaseBlockSize = 32000000;
+      VkDeviceSize MaxBlockSize = 256000000;
+      uint64_t EmptyFrameThreshold = 600;
+      VkDeviceSize DedicatedSize = 16000000;
+
+      // size of the per thread chunks and the largest allocation that goes in one, 0 turns chunks off
+      VkDeviceSize ChunkSize = 4194304;
+      VkDeviceSize ChunkAllocSize = 65536;
+
+      // set before Init to record a trace of every block's allocations, see MemoryBlock::pTrace
+      std::ostream* pTrace = nullptr;
+
+    private:
+      // AddBlock needs BlockLock to itself
+      MemoryBlock* AddBlock(VkDeviceSize MinSize);
+      MemoryBlock* AddDedicated(VkDeviceSize inSize, VkImage Image, VkBuffer Buffer, const std::function<bool(MemoryBlock*)>& TryBlock);
+      // a dedicated block, a thread chunk or the shared blocks, whichever fits MemReq. Image or Buffer is the resource for a dedicated block
+      bool Allocate(const VkMemoryRequirements& MemReq, bool bDedicated, VkImage Image, VkBuffer Buffer, const std::function<bool(MemoryBlock*)>& TryBlock, const std::function<bool(ThreadChunk*)>& TryChunk);
+      void SetupBlock(MemoryBlock* Block);
+
+      // the first block TryBlock succeeds in, growing the pool if none does
+      MemoryBlock* Place(const std::function<bool(MemoryBlock*)>& TryBlock, VkDeviceSize MinSize);
+
+      // the calling thread's chunk, nullptr if the allocation doesn't go in one
+      ThreadChunk* GetChunk(const VkMemoryRequirements& MemReq, bool bFull);
+      ThreadChunk* FindChunk();
+      void ReleaseChunk(ThreadChunk* Chunk);
+      VkDeviceSize GetChunkAlignment();
+
+      MemoryBackend* pBackend;
+      uint32_t MemoryIndex;
+      VkMemoryPropertyFlags Properties;
+      VkDeviceSize Granularity;
+
+      uint32_t HeapIndex;
+      MemoryBudget* pBudget;
+
+      // heap allocated, AllocatedObjects keep a pointer to their block
+      std::vector<MemoryBlock*> Blocks;
+      std::vector<MemoryBlock*> Dedicated;
+      std::shared_mutex BlockLock;
+
+      std::vector<ThreadChunk*> Chunks;
+      std::mutex ChunkLock;
+
+      // unique for every Init, threads cache their chunk under it so a stale cache entry never matches a new pool
+      uint64_t Serial = 0;
+  };
+
+  /*
+    Everything the blocks need from the driver. VulkanMemoryBackend forwards to a VkDevice, the memory bench
+    plugs in a fake one so the allocator can be measured without a gpu.
+  */
+  class MemoryBackend
+  {
+    public:
+      // DedicatedImage/DedicatedBuffer are VK_NULL_HANDLE unless the memory is for that one resource
+      virtual VkResult AllocateMemory(uint32_t TypeIndex, VkDeviceSize Size, VkImage DedicatedImage, VkBuffer DedicatedBuffer, VkDeviceMemory& Memory) = 0;
+      virtual void FreeMemory(VkDeviceMemory Memory) = 0;
+
+      virtual VkResult MapMemory(VkDeviceMemory Memory, VkDeviceSize Size, void** ppData) = 0;
+      virtual void UnmapMemory(VkDeviceMemory Memory) = 0;
+      virtual void FlushMemory(VkDeviceMemory Memory) = 0;
+      virtual void InvalidateMemory(VkDeviceMemory Memory) = 0;
+
+      virtual void GetBufferRequirements(VkBuffer Buffer, VkMemoryRequirements& MemReq) = 0;
+      virtual void GetImageRequirements(VkImage Image, VkMemoryRequirements& MemReq) = 0;
+      virtual VkResult BindBuffer(VkBuffer Buffer, VkDeviceMemory Memory, VkDeviceSize Offset) = 0;
+      virtual VkResult BindImage(VkImage Image, VkDeviceMemory Memory, VkDeviceSize Offset) = 0;
+
+      virtual void DestroyBuffer(VkBuffer Buffer) = 0;
+      virtual void DestroyImage(VkImage Image) = 0;
+
+      // driver reported budget and usage per heap, false when the driver can't tell us
+      virtual bool GetHeapBudgets(VkDeviceSize* pBudgets, VkDeviceSize* pUsages) = 0;
+  };
+
+  // implemented by whatever holds views or descriptors of a movable object
+  class MoveListener
+  {
+    public:
+      virtual void OnMove(Ek::AllocatedObject* pObject) = 0;
   };
 
   class AllocateInterface
   {
     public:
       virtual VkResult LoadImage(const char* Path, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage) = 0;
-      virtual VkResult CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage) = 0;
+      virtual VkResult LoadImage(const Ek::ImageData& Image, Ek::Texture& inTex, VkImageLayout Layout, VkImageUsageFlags Usage) = 0;
+      // doesn't touch the device, any thread can call it
+      virtual bool DecodeImage(const char* Path, Ek::ImageData& Image, bool bNormalMap = false) = 0;
+      virtual VkResult CreateImage(Ek::Texture& inTex, VkFormat Format, VkExtent2D ImageExtent, VkImageUsageFlags Usage, uint32_t MipLevels = 1) = 0;
       virtual VkResult CreateImageView(VkImageView& View, Ek::Texture& Texture, VkImageAspectFlags Aspects) = 0;
-      virtual void AllocateBuffer(Ek::Buffer& inBuffer, Ek::eMemoryType MemType) = 0;
-      virtual void AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryType MemType) = 0;
+      virtual VkResult CreateBuffer(Ek::Buffer& inBuffer, VkDeviceSize Size, VkBufferUsageFlags Usage) = 0;
+      virtual void AllocateBuffer(Ek::Buffer& inBuffer, Ek::eMemoryUsage Usage) = 0;
+      virtual void AllocateTexture(Ek::Texture& inTexture, Ek::eMemoryUsage Usage) = 0;
+
+      virtual Ek::UploadToken UploadBuffer(Ek::Buffer& Dst, const void* pData, VkDeviceSize Size, VkDeviceSize DstOffset = 0) = 0;
+      virtual Ek::UploadToken GetUploadToken() = 0;
+      virtual bool IsUploadDone(Ek::UploadToken Token) = 0;
+      virtual void WaitUpload(Ek::UploadToken Token) = 0;
   };
 }
 
@@ -1,8 +1,13 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
 
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
 
+#include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform.hpp>
 #include <vulkan/vulkan_core.h>
 
@@ -10,41 +15,140 @@
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 
-  const std::vector<VkVertexInputAttributeDescription> Vertex::GetAttributes()
+  const std::vector<VkVertexInputAttributeDescription> Vertex::GetAttributes(Ek::eVertexFormat Format)
   {
     std::vector<VkVertexInputAttributeDescription> Ret(3);
 
     Ret[0].binding = 0;
     Ret[0].location = 0;
-    Ret[0].offset = offsetof(Vertex, Position);
-    Ret[0].format = VK_FORMAT_R32G32B32_SFLOAT;
 
     Ret[1].binding = 0;
     Ret[1].location = 1;
-    Ret[1].offset = offsetof(Vertex, Normal);
-    Ret[1].format = VK_FORMAT_R32G32B32_SFLOAT;
 
     Ret[2].binding = 0;
     Ret[2].location = 2;
-    Ret[2].offset = offsetof(Vertex, TexPos);
-    Ret[2].format = VK_FORMAT_R32G32_SFLOAT;
+
+    switch(Format)
+    {
+      case Ek::eVertexFloat:
+        Ret[0].offset = offsetof(Vertex, Position);
+        Ret[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        Ret[1].offset = offsetof(Vertex, Normal);
+        Ret[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+        Ret[2].offset = offsetof(Vertex, TexPos);
+        Ret[2].format = VK_FORMAT_R32G32_SFLOAT;
+        break;
+
+      case Ek::eVertexPacked:
+        Ret[0].offset = offsetof(PackedVertex, Position);
+        Ret[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+        Ret[1].offset = offsetof(PackedVertex, Normal);
+        Ret[1].format = VK_FORMAT_R16G16_SNORM;
+        Ret[2].offset = offsetof(PackedVertex, TexPos);
+        Ret[2].format = VK_FORMAT_R16G16_SFLOAT;
+        break;
+
+      // three component 16 bit formats aren't guaranteed for vertex buffers, the fourth is padding
+      case Ek::eVertexPackedQuantized:
+        Ret[0].offset = offsetof(QuantizedVertex, Position);
+        Ret[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+        Ret[1].offset = offsetof(QuantizedVertex, Normal);
+        Ret[1].format = VK_FORMAT_R16G16_SNORM;
+        Ret[2].offset = offsetof(QuantizedVertex, TexPos);
+        Ret[2].format = VK_FORMAT_R16G16_SFLOAT;
+        break;
+    }
 
     return Ret;
   }
 
-  const std::vector<VkVertexInputBindingDescription> Vertex::GetBinding()
+  const std::vector<VkVertexInputBindingDescription> Vertex::GetBinding(Ek::eVertexFormat Format)
   {
     std::vector<VkVertexInputBindingDescription> Ret(1);
 
     Ret[0].binding = 0;
-    Ret[0].stride = sizeof(Vertex);
+    Ret[0].stride = GetStride(Format);
     Ret[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     return Ret;
   }
 
+  uint32_t Vertex::GetStride(Ek::eVertexFormat Format)
+  {
+    switch(Format)
+    {
+      case Ek::eVertexPacked:
+        return sizeof(PackedVertex);
+      case Ek::eVertexPackedQuantized:
+        return sizeof(QuantizedVertex);
+      default:
+        return sizeof(Vertex);
+    }
+  }
+
 namespace Ek
 {
+  // part of the mesh cache key, changing these has to invalidate old caches. Triangulate leaves points and lines alone,
+  // SortByPType puts them in meshes of their own so Import can leave them out
+  static const uint32_t ImportFlags = aiProcess_Triangulate | aiProcess_SortByPType | aiProcess_JoinIdenticalVertices;
+
+  // assimp matrices are row major, glm's are column major
+  static glm::mat4 ToGlm(const aiMatrix4x4& Matrix)
+  {
+    return glm::transpose(glm::make_mat4(&Matrix.a1));
+  }
+
+  // false only if assimp says there is a texture but can't give it to us, Path stays empty for materials without one
+  static bool GetAlbedoPath(const aiMaterial* pMaterial, std::string& Path)
+  {
+    aiString aiAlbedoPath;
+
+    if(pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+    {
+      if(pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &aiAlbedoPath) != AI_SUCCESS)
+      {
+        return false;
+      }
+
+      Path = aiAlbedoPath.C_Str();
+    }
+    else if(pMaterial->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
+    {
+      if(pMaterial->GetTexture(aiTextureType_BASE_COLOR, 0, &aiAlbedoPath) != AI_SUCCESS)
+      {
+        return false;
+      }
+
+      Path = aiAlbedoPath.C_Str();
+    }
+
+    return true;
+  }
+
+  // octahedral mapping of a unit vector onto [-1, 1]^2, packed as snorm16x2. Decoded by OctDecode in VertPacked.glsl
+  static uint32_t OctEncode(glm::vec3 Normal)
+  {
+    float Sum = glm::abs(Normal.x) + glm::abs(Normal.y) + glm::abs(Normal.z);
+
+    if(!(Sum > 0.f))
+    {
+      return glm::packSnorm2x16(glm::vec2(0.f));
+    }
+
+    Normal /= Sum;
+
+    glm::vec2 Ret(Normal.x, Normal.y);
+
+    // the lower hemisphere folds over the diagonals
+    if(Normal.z < 0.f)
+    {
+      Ret.x = (1.f - glm::abs(Normal.y)) * (Normal.x >= 0.f ? 1.f : -1.f);
+      Ret.y = (1.f - glm::abs(Normal.x)) * (Normal.y >= 0.f ? 1.f : -1.f);
+    }
+
+    return glm::packSnorm2x16(Ret);
+  }
+
   Renderable::Renderable()
   {}
 
@@ -53,17 +157,33 @@ namespace Ek
 
   Mesh::Mesh()
   {
+    Alloc = nullptr;
+    Arena = nullptr;
+    Culler = nullptr;
+    Streamer = nullptr;
     Transform = glm::mat4(1.f);
+    ShaderLocation = {UINT32_MAX, 0};
   }
 
   Mesh::~Mesh()
   {
-    pTemp = nullptr;
+    // the copies into our buffers might still be in flight
+    if(Alloc != nullptr)
+    {
+      Alloc->WaitUpload(Ready);
+    }
 
-    VertexBuffer.Destroy();
-    IndexBuffer.Destroy();
-    TransitBuffer.Destroy();
-    cmdBuffer.Delete();
+    if(Arena != nullptr)
+    {
+      Arena->Free(Geometry);
+    }
+
+    if(Culler != nullptr)
+    {
+      Culler->Remove(Clusters);
+    }
+
+    delete pCache;
 
     Vertices.clear();
     Indices.clear();
@@ -71,6 +191,11 @@ namespace Ek
 
     if(Albedo.Image != VK_NULL_HANDLE)
     {
+      if(Streamer != nullptr)
+      {
+        Streamer->Remove(Albedo);
+      }
+
       Albedo.Destroy();
       vkDestroyImageView(*pDevice, AlbedoView, nullptr);
       vkDestroySampler(*pDevice, AlbedoSampler, nullptr);
@@ -81,182 +206,696 @@ namespace Ek
 
   void Mesh::Draw(Wrappers::CommandBuffer& inBuffer)
   {
-    VkDeviceSize Offset = 0;
-    vkCmdBindVertexBuffers(inBuffer.Buffer, 0, 1, &VertexBuffer.Buffer, &Offset);
-    vkCmdBindIndexBuffer(inBuffer.Buffer, IndexBuffer.Buffer, Offset, VK_INDEX_TYPE_UINT32);
-    vkCmdDrawIndexed(inBuffer.Buffer, Indices.size(), 1, 0, 0, 0);
+    if(!Alloc->IsUploadDone(Ready))
+    {
+      return;
+    }
+
+    if(Culler != nullptr && Clusters.bCulled && Lod == 0)
+    {
+      Culler->Draw(inBuffer.Buffer, Clusters);
+      return;
+    }
+
+    const MeshLevel& Level = Levels[Lod];
+
+    if(bWholeDraw)
+    {
+      RecordDraw(inBuffer, Level.WholeDraw);
+      return;
+    }
+
+    for(uint32_t i = 0; i < Level.SubMeshDraws.size(); i++)
+    {
+      RecordDraw(inBuffer, Level.SubMeshDraws[i]);
+    }
   }
 
-  void Mesh::Allocate(Wrappers::CommandBuffer& inCmdBuffer)
+  void Mesh::SelectLod(const glm::mat4& WorldView, float PixelsPerUnit, float MaxPixelError)
   {
-    VkResult Err;
+    Lod = 0;
 
-    cmdBuffer = inCmdBuffer;
+    if(Levels.size() < 2)
+    {
+      return;
+    }
 
-    VkBufferCreateInfo VertexBufferCI{};
-    VertexBufferCI.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    VertexBufferCI.size        = sizeof(Vertex) * Vertices.size();
-    VertexBufferCI.usage       = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    VertexBufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // the errors are in model space, a scaled World scales them with it
+    float Scale;
+    float Distance = GetDistance(WorldView, Scale);
 
-    if((Err = vkCreateBuffer(*pDevice, &VertexBufferCI, nullptr, &VertexBuffer.Buffer)) != VK_SUCCESS)
+    // the camera is inside the bounds, the closest surface could be right in front of it
+    if(Distance <= 0.f)
     {
-      throw std::runtime_error("Failed to create buffer: " + std::to_string(Err));
+      return;
     }
 
-    VkBufferCreateInfo IndexBufferCI{};
-    IndexBufferCI.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    IndexBufferCI.size        = sizeof(uint32_t) * Indices.size();
-    IndexBufferCI.usage       = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    IndexBufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    for(uint32_t l = Levels.size() - 1; l > 0; l--)
+    {
+      if(Levels[l].Error * Scale * PixelsPerUnit / Distance <= MaxPixelError)
+      {
+        Lod = l;
+        return;
+      }
+    }
+  }
 
-    if((Err = vkCreateBuffer(*pDevice, &IndexBufferCI, nullptr, &IndexBuffer.Buffer)) != VK_SUCCESS)
+  void Mesh::RequestTexture(const glm::mat4& WorldView, const glm::mat4& Projection, float PixelsPerUnit)
+  {
+    if(Streamer == nullptr || Albedo.Image == VK_NULL_HANDLE)
     {
-      throw std::runtime_error("Failed to create buffer: " + std::to_string(Err));
+      return;
     }
 
-    VkBufferCreateInfo TransitBufferCI{};
-    TransitBufferCI.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    TransitBufferCI.size        = (sizeof(Vertex)*Vertices.size())+(sizeof(uint32_t)*Indices.size());
-    TransitBufferCI.usage       = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    TransitBufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // the same clip planes as the meshlet culler, a texture nobody sees doesn't need anything past its tail
+    glm::mat4 Clip = glm::transpose(Projection * WorldView);
+    glm::vec4 Planes[6] = {Clip[3] + Clip[0], Clip[3] - Clip[0], Clip[3] + Clip[1], Clip[3] - Clip[1], Clip[2], Clip[3] - Clip[2]};
+
+    float Scale;
+    float Distance = GetDistance(WorldView, Scale);
 
-    if((Err = vkCreateBuffer(*pDevice, &TransitBufferCI, nullptr, &TransitBuffer.Buffer)) != VK_SUCCESS)
+    for(uint32_t i = 0; i < 6; i++)
     {
-      throw std::runtime_error("Failed to create buffer: " + std::to_string(Err));
+      float Length = glm::length(glm::vec3(Planes[i]));
+
+      if(Length > 0.f && glm::dot(Planes[i], glm::vec4(glm::vec3(Bounds), 1.f)) / Length < -Bounds.w * Scale)
+      {
+        return;
+      }
     }
 
-    Alloc->AllocateBuffer(VertexBuffer, eLocalMemory);
-    Alloc->AllocateBuffer(IndexBuffer, eLocalMemory);
-    Alloc->AllocateBuffer(TransitBuffer, eHostMemory);
+    uint32_t Level = 0;
+    float Texels = std::max(Albedo.Extent.width, Albedo.Extent.height);
+    float Pixels = 2.f * Bounds.w * Scale * PixelsPerUnit / std::max(Distance, 1e-6f);
 
-    TransitBuffer.Map(&pTemp);
-      memcpy(pTemp, Vertices.data(), sizeof(Vertex)*Vertices.size());
-      memcpy((Vertex*)pTemp + Vertices.size(), Indices.data(), sizeof(uint32_t)*Indices.size());
+    // every halving of the pixels it covers is a level down the chain
+    if(Distance > 0.f && Pixels < Texels)
+    {
+      Level = std::floor(std::log2(Texels / std::max(Pixels, 1.f)));
+    }
 
-      VkBufferCopy VertexCopyInfo{};
-      VertexCopyInfo.size = sizeof(Vertex)*Vertices.size();
-      VertexCopyInfo.srcOffset = 0;
-      VertexCopyInfo.dstOffset = 0;
+    Streamer->Request(Albedo, Level);
+  }
 
-      VkBufferCopy IndexCopyInfo{};
-      IndexCopyInfo.size = sizeof(uint32_t)*Indices.size();
-      IndexCopyInfo.srcOffset = VertexCopyInfo.size;
-      IndexCopyInfo.dstOffset = 0;
+  float Mesh::GetDistance(const glm::mat4& WorldView, float& Scale)
+  {
+    Scale = std::max(glm::length(glm::vec3(WorldView[0])), std::max(glm::length(glm::vec3(WorldView[1])), glm::length(glm::vec3(WorldView[2]))));
 
-      cmdBuffer.BeginCommand();
-        vkCmdCopyBuffer(cmdBuffer.Buffer, TransitBuffer.Buffer, VertexBuffer.Buffer, 1, &VertexCopyInfo);
-        vkCmdCopyBuffer(cmdBuffer.Buffer, TransitBuffer.Buffer, IndexBuffer.Buffer, 1, &IndexCopyInfo);
-      cmdBuffer.EndComand();
+    return glm::length(glm::vec3(WorldView * glm::vec4(glm::vec3(Bounds), 1.f))) - Bounds.w * Scale;
+  }
 
-    std::cout << "allocating mesh with size: " << VertexBuffer.allocSize+IndexBuffer.allocSize << '\n';
+  void Mesh::RecordDraw(Wrappers::CommandBuffer& inBuffer, const DrawRange& Range)
+  {
+    // the geometry arena is bound once at the start of the frame, we only say where our slice of it is and how wide its indices are
+    Arena->BindIndices(inBuffer.Buffer, Range.IndexType);
+    vkCmdDrawIndexed(inBuffer.Buffer, Range.IndexCount, 1, Range.FirstIndex, Range.VertexOffset, 0);
+  }
 
-    cmdBuffer.FenceWait();
+  Ek::MeshletRange* Mesh::GetMeshlets()
+  {
+    if(Culler == nullptr || Clusters.pData == nullptr || Lod != 0 || !Alloc->IsUploadDone(Ready))
+    {
+      return nullptr;
+    }
+
+    return &Clusters;
   }
 
-  void Mesh::Move(glm::vec3 Direction)
+  void Mesh::Allocate(EkBackend::GeometryArena* pArena, EkBackend::MeshletCuller* pCuller)
   {
-    Transform = glm::translate(Transform, Direction);
+    Arena = pArena;
+
+    // a cached model is copied straight from the mapped file into staging
+    const void* pVertices = Vertices.data();
+    uint32_t VertexCount = Vertices.size();
+    uint32_t Stride = sizeof(Vertex);
+
+    if(pCache != nullptr)
+    {
+      pVertices = pCache->GetVertices();
+      VertexCount = pCache->GetVertexCount();
+    }
+
+    if(PackedStride != 0)
+    {
+      pVertices = Packed.data();
+      VertexCount = Packed.size() / PackedStride;
+      Stride = PackedStride;
+    }
+
+    // sized in 16 bit units even when some submeshes use 32 bit indices, PackIndices keeps those 4 byte aligned
+    Geometry = Arena->Allocate(VertexCount, IndexData.size() / sizeof(uint16_t), VK_INDEX_TYPE_UINT16);
+
+    // before the arena's upload, so Ready covers the meshlets too
+    if(pCuller != nullptr && !Meshlets.empty())
+    {
+      Culler = pCuller;
+      Clusters = Culler->Add(Meshlets, MeshletVertices, MeshletTriangles, MeshletTriangles.size() * 3, Geometry.VertexOffset);
+    }
+
+    // staged through the upload ring, the token covers the albedo from Load() as well
+    Ready = Arena->Upload(Geometry, pVertices, IndexData.data());
+
+    std::cout << "allocating mesh with size: " << (uint64_t)Stride*VertexCount + IndexData.size() << '\n';
+
+    // the draws were relative to our slice of the arena
+    for(uint32_t l = 0; l < Levels.size() && Geometry.pIndices != nullptr; l++)
+    {
+      DrawRange& WholeDraw = Levels[l].WholeDraw;
+      std::vector<DrawRange>& SubMeshDraws = Levels[l].SubMeshDraws;
+
+      WholeDraw.FirstIndex += Geometry.pIndices->Start / EkBackend::GeometryArena::GetIndexSize(WholeDraw.IndexType);
+      WholeDraw.VertexOffset += Geometry.VertexOffset;
+
+      for(uint32_t i = 0; i < SubMeshDraws.size(); i++)
+      {
+        SubMeshDraws[i].FirstIndex += Geometry.pIndices->Start / EkBackend::GeometryArena::GetIndexSize(SubMeshDraws[i].IndexType);
+        SubMeshDraws[i].VertexOffset += Geometry.VertexOffset;
+      }
+    }
+
+    // only the gpu needs the packed copies
+    std::vector<uint8_t>().swap(Packed);
+    std::vector<uint8_t>().swap(IndexData);
+    std::vector<Meshlet>().swap(Meshlets);
+    std::vector<uint32_t>().swap(MeshletVertices);
+    std::vector<uint32_t>().swap(MeshletTriangles);
+
+    // Upload copied everything into the staging ring already
+    delete pCache;
+    pCache = nullptr;
+  }
+
+  void Mesh::DrawSubMesh(Wrappers::CommandBuffer& inBuffer, uint32_t Index)
+  {
+    if(!Alloc->IsUploadDone(Ready))
+    {
+      return;
+    }
+
+    RecordDraw(inBuffer, Levels[Lod].SubMeshDraws[Index]);
+  }
+
+  void Mesh::LoadNode(const aiScene* Scene, const aiNode* Node, int32_t Parent, std::vector<std::pair<uint32_t, uint32_t>>& Placed)
+  {
+    uint32_t Index = Nodes.size();
+
+    // the children push more nodes, so don't hold on to a reference into Nodes past this
+    {
+      Nodes.emplace_back();
+
+      MeshNode& Curr = Nodes.back();
+      Curr.Name = Node->mName.C_Str();
+      Curr.Parent = Parent;
+      Curr.Local = ToGlm(Node->mTransformation);
+      Curr.World = (Parent >= 0) ? Nodes[Parent].World * Curr.Local : Curr.Local;
+    }
+
+    for(uint32_t i = 0; i < Node->mNumMeshes; i++)
+    {
+      Placed.push_back({Index, Node->mMeshes[i]});
+    }
+
+    for(uint32_t i = 0; i < Node->mNumChildren; i++)
+    {
+      LoadNode(Scene, Node->mChildren[i], Index, Placed);
+    }
   }
 
   /* 
    things to note here:
-    assimp uses:
-    Z : up-axis
-    Y : forward-axis
-    x : right-axis
+    our models are z up, assimp puts the rotation to y up on the root node (COLLADA's up_axis). Node transforms are
+    baked into the vertices, so that already takes care of it
 
     assim uses row-major matrices, so we must convert them to column major for use with glm
 
     texture coordinate origin(0,0) is at the lower left corner for assimp, because it is made for use with opengl.
     but with vulkan our origin is at the top left corner, we must invert the Y coordinate for correct texture wrapping
   */
-  void Mesh::Load(EkBackend::AllocateInterface* pAlloc, VkDevice& inDevice, EkBackend::DescriptorSet& Set, std::string inPath)
+  void Mesh::Import(const std::string& AbsolutePath)
   {
-    Path = inPath;
-    SceneSet = &Set;
+    const aiScene* Scene = Importer.ReadFile(AbsolutePath, ImportFlags);
 
-    Alloc = pAlloc;
+    if(Scene == nullptr || Scene->mRootNode == nullptr)
+    {
+      throw std::runtime_error("failed to load mesh at : " + AbsolutePath);
+    }
 
-    pDevice = &inDevice;
+    Materials.resize(Scene->mNumMaterials);
 
-    std::string AbsolutePath = MODELDIR;
-    AbsolutePath.append(inPath);
+    for(uint32_t i = 0; i < Scene->mNumMaterials; i++)
+    {
+      Materials[i].Name = Scene->mMaterials[i]->GetName().C_Str();
+      Materials[i].AlbedoPath.clear();
+
+      if(!GetAlbedoPath(Scene->mMaterials[i], Materials[i].AlbedoPath))
+      {
+        throw std::runtime_error("Failed to find material texture from assimp scene while importing mesh");
+      }
+    }
 
-    const aiScene* Scene = Importer.ReadFile(AbsolutePath, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+    // every (node, mesh) pair the hierarchy places, a mesh used by two nodes is placed twice
+    std::vector<std::pair<uint32_t, uint32_t>> Placed;
+    LoadNode(Scene, Scene->mRootNode, -1, Placed);
 
-    if(Scene == nullptr)
+    // submeshes that share a material end up next to each other, so they can be drawn as one range
+    std::stable_sort(Placed.begin(), Placed.end(), [&](const std::pair<uint32_t, uint32_t>& A, const std::pair<uint32_t, uint32_t>& B)
     {
-      throw std::runtime_error("failed to load mesh at : " + AbsolutePath);
+      return Scene->mMeshes[A.second]->mMaterialIndex < Scene->mMeshes[B.second]->mMaterialIndex;
+    });
+
+    for(uint32_t p = 0; p < Placed.size(); p++)
+    {
+      const aiMesh* pMesh = Scene->mMeshes[Placed[p].second];
+      MeshNode& Node = Nodes[Placed[p].first];
+
+      // we only draw triangle lists, a point or line mesh would shift the ranges of everything after it
+      if((pMesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0)
+      {
+        continue;
+      }
+
+      SubMesh Sub;
+      Sub.FirstVertex = Vertices.size();
+      Sub.VertexCount = pMesh->mNumVertices;
+      Sub.FirstIndex = Indices.size();
+      Sub.Material = pMesh->mMaterialIndex;
+      Sub.Node = Placed[p].first;
+
+      // node transforms are baked into the vertices, the shader only knows about the model's own transform
+      glm::mat3 NormalMatrix = glm::transpose(glm::inverse(glm::mat3(Node.World)));
+
+      Vertices.resize(Sub.FirstVertex + Sub.VertexCount);
+
+      for(uint32_t i = 0; i < pMesh->mNumVertices; i++)
+      {
+        Vertex& Curr = Vertices[Sub.FirstVertex + i];
+
+        Curr.Position = glm::vec3(Node.World * glm::vec4(pMesh->mVertices[i].x, pMesh->mVertices[i].y, pMesh->mVertices[i].z, 1.f));
+
+        if(pMesh->HasTextureCoords(0))
+        {
+          const aiVector3D* TexCoord = &pMesh->mTextureCoords[0][i];
+          Curr.TexPos.x = TexCoord->x;
+          Curr.TexPos.y = 1.f-TexCoord->y;
+        }
+
+        if(pMesh->HasNormals())
+        {
+          Curr.Normal = glm::normalize(NormalMatrix * glm::vec3(pMesh->mNormals[i].x, pMesh->mNormals[i].y, pMesh->mNormals[i].z));
+        }
+      }
+
+      // indices point into the model's vertices, the arena offset of the model is added per draw
+      for(uint32_t i = 0; i < pMesh->mNumFaces; i++)
+      {
+        // a mesh with triangles can still have the odd degenerate point or line in it
+        if(pMesh->mFaces[i].mNumIndices != 3)
+        {
+          continue;
+        }
+
+        for(uint32_t x = 0; x < 3; x++)
+        {
+          Indices.push_back(Sub.FirstVertex + pMesh->mFaces[i].mIndices[x]);
+        }
+      }
+
+      Sub.IndexCount = Indices.size() - Sub.FirstIndex;
+
+      Node.SubMeshes.push_back(SubMeshes.size());
+      SubMeshes.push_back(Sub);
     }
 
-    Vertices.resize(Scene->mMeshes[0]->mNumVertices);
+    Importer.FreeScene();
 
-    for(uint32_t i = 0; i < Scene->mMeshes[0]->mNumVertices; i++)
+    // cache friendly triangle order, outward facing clusters first, vertices in the order they're used
+    EkBackend::MeshOptimizer::Stats Stats = EkBackend::MeshOptimizer::Optimize(Vertices, Indices, SubMeshes);
+
+    std::cout << "optimized " << AbsolutePath << ", ACMR " << Stats.AcmrBefore << " -> " << Stats.AcmrAfter << '\n';
+
+    // simplified levels go behind the full one, they keep using the vertices Optimize just ordered
+    EkBackend::MeshOptimizer::BuildLods(Vertices, Indices, SubMeshes, Lods);
+
+    if(!SubMeshes.empty())
     {
-      Vertices[i].Position.y = Scene->mMeshes[0]->mVertices[i].z;
-      Vertices[i].Position.x = Scene->mMeshes[0]->mVertices[i].x;
-      Vertices[i].Position.z = Scene->mMeshes[0]->mVertices[i].y*-1.f;
+      std::cout << "built " << Lods.size() / SubMeshes.size() << " levels of detail for " << AbsolutePath << '\n';
+    }
+  }
 
-      if(Scene->mMeshes[0]->HasTextureCoords(0))
+  void Mesh::PackIndices(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount)
+  {
+    IndexData.clear();
+
+    uint32_t SubMeshCount = SubMeshes.size();
+    uint32_t LevelCount = (SubMeshCount > 0) ? 1 + Lods.size() / SubMeshCount : 1;
+
+    Levels.assign(LevelCount, MeshLevel());
+    Lod = 0;
+
+    // level 0 is the submeshes themselves
+    auto GetRange = [&](uint32_t Level, uint32_t Index)
+    {
+      if(Level == 0)
       {
-        const aiVector3D* TexCoord = &Scene->mMeshes[0]->mTextureCoords[0][i];
-        Vertices[i].TexPos.x = TexCoord->x;
-        Vertices[i].TexPos.y = 1.f-TexCoord->y;
+        return SubMeshLod{SubMeshes[Index].FirstIndex, SubMeshes[Index].IndexCount, 0.f};
       }
 
-      Vertices[i].Normal.x = Scene->mMeshes[0]->mNormals[i].x;
-      Vertices[i].Normal.y = Scene->mMeshes[0]->mNormals[i].y;
-      Vertices[i].Normal.z = Scene->mMeshes[0]->mNormals[i].z;
+      return Lods[(Level - 1) * SubMeshCount + Index];
+    };
+
+    for(uint32_t l = 0; l < LevelCount; l++)
+    {
+      Levels[l].SubMeshDraws.resize(SubMeshCount);
+
+      for(uint32_t i = 0; i < SubMeshCount; i++)
+      {
+        Levels[l].Error = std::max(Levels[l].Error, GetRange(l, i).Error);
+      }
     }
 
-    for(uint32_t i = 0; i < Scene->mMeshes[0]->mNumFaces; i++)
+    // vertex 65535 is only special with primitive restart, which we never turn on
+    bWholeDraw = VertexCount <= 65536;
+
+    if(bWholeDraw)
     {
-      for(uint32_t x = 0; x < Scene->mMeshes[0]->mFaces[i].mNumIndices; x++)
+      IndexData.resize(IndexCount * sizeof(uint16_t));
+
+      uint16_t* pOut = (uint16_t*)IndexData.data();
+
+      for(uint32_t i = 0; i < IndexCount; i++)
+      {
+        pOut[i] = pIndices[i];
+      }
+
+      // a level's submeshes are back to back
+      for(uint32_t l = 0; l < LevelCount; l++)
       {
-        Indices.push_back(Scene->mMeshes[0]->mFaces[i].mIndices[x]);
+        uint32_t First = IndexCount;
+        uint32_t Count = 0;
+
+        for(uint32_t i = 0; i < SubMeshCount; i++)
+        {
+          SubMeshLod Range = GetRange(l, i);
+
+          First = std::min(First, Range.FirstIndex);
+          Count += Range.IndexCount;
+
+          Levels[l].SubMeshDraws[i] = {Range.FirstIndex, Range.IndexCount, 0, VK_INDEX_TYPE_UINT16};
+        }
+
+        Levels[l].WholeDraw = {(Count > 0) ? First : 0, Count, 0, VK_INDEX_TYPE_UINT16};
       }
+
+      return;
     }
 
-    aiString aiAlbedoPath;
-    std::string AlbedoPath = MODELDIR;
+    // too many vertices for one 16 bit range, every submesh gets its own base vertex and the narrowest indices that fit it
+    size_t Offset = 0;
 
-    if(Scene->mMaterials[Scene->mMeshes[0]->mMaterialIndex]->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+    for(uint32_t l = 0; l < LevelCount; l++)
     {
-      if(Scene->mMaterials[Scene->mMeshes[0]->mMaterialIndex]->GetTexture(aiTextureType_DIFFUSE, 0, &aiAlbedoPath) != AI_SUCCESS)
+      for(uint32_t i = 0; i < SubMeshCount; i++)
       {
-        throw std::runtime_error("Failed to find material texture from assimp scene while importing mesh");
+        const SubMesh& Sub = SubMeshes[i];
+        SubMeshLod Range = GetRange(l, i);
+
+        VkIndexType Type = (Sub.VertexCount <= 65536) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        uint32_t Size = EkBackend::GeometryArena::GetIndexSize(Type);
+
+        Offset = (Offset + Size - 1) & ~(size_t)(Size - 1);
+
+        Levels[l].SubMeshDraws[i] = {(uint32_t)(Offset / Size), Range.IndexCount, (int32_t)Sub.FirstVertex, Type};
+
+        IndexData.resize(Offset + (size_t)Range.IndexCount * Size);
+
+        for(uint32_t x = 0; x < Range.IndexCount; x++)
+        {
+          uint32_t Index = pIndices[Range.FirstIndex + x] - Sub.FirstVertex;
+
+          if(Type == VK_INDEX_TYPE_UINT16)
+          {
+            ((uint16_t*)(IndexData.data() + Offset))[x] = Index;
+          }
+          else
+          {
+            ((uint32_t*)(IndexData.data() + Offset))[x] = Index;
+          }
+        }
+
+        Offset = IndexData.size();
       }
+    }
+  }
+
+  void Mesh::Pack(const Vertex* pVertices, uint32_t Count, eVertexFormat Format)
+  {
+    Dequant = PositionDequant();
+    PackedStride = 0;
+    Packed.clear();
 
-      AlbedoPath.append(aiAlbedoPath.C_Str());
+    if(Format == eVertexFloat)
+    {
+      return;
     }
-    else if(Scene->mMaterials[Scene->mMeshes[0]->mMaterialIndex]->GetTextureCount(aiTextureType_BASE_COLOR) > 0)
+
+    PackedStride = Vertex::GetStride(Format);
+    Packed.resize((size_t)PackedStride * Count);
+
+    if(Format == eVertexPacked)
     {
-      if(Scene->mMaterials[Scene->mMeshes[0]->mMaterialIndex]->GetTexture(aiTextureType_BASE_COLOR, 0, &aiAlbedoPath) != AI_SUCCESS)
+      PackedVertex* pOut = (PackedVertex*)Packed.data();
+
+      for(uint32_t i = 0; i < Count; i++)
       {
-        throw std::runtime_error("Failed to find material texture from assimp scene while importing mesh");
+        pOut[i].Position = pVertices[i].Position;
+        pOut[i].Normal = OctEncode(pVertices[i].Normal);
+        pOut[i].TexPos = glm::packHalf2x16(pVertices[i].TexPos);
+      }
+    }
+    else
+    {
+      glm::vec3 Min(0.f);
+      glm::vec3 Max(0.f);
+
+      if(Count > 0)
+      {
+        Min = pVertices[0].Position;
+        Max = pVertices[0].Position;
+      }
+
+      for(uint32_t i = 1; i < Count; i++)
+      {
+        Min = glm::min(Min, pVertices[i].Position);
+        Max = glm::max(Max, pVertices[i].Position);
       }
 
-     AlbedoPath.append(aiAlbedoPath.C_Str());
+      // flat axes get a scale of 1 so we don't divide by zero, every vertex lands on 0 there anyway
+      glm::vec3 Extent = Max - Min;
+      Extent = glm::vec3(Extent.x > 0.f ? Extent.x : 1.f, Extent.y > 0.f ? Extent.y : 1.f, Extent.z > 0.f ? Extent.z : 1.f);
+
+      Dequant.Scale = glm::vec4(Extent, 1.f);
+      Dequant.Bias = glm::vec4(Min, 0.f);
+
+      QuantizedVertex* pOut = (QuantizedVertex*)Packed.data();
+
+      for(uint32_t i = 0; i < Count; i++)
+      {
+        glm::vec3 Unit = glm::clamp((pVertices[i].Position - Min) / Extent, 0.f, 1.f);
+
+        pOut[i].Position[0] = (uint16_t)(Unit.x * 65535.f + 0.5f);
+        pOut[i].Position[1] = (uint16_t)(Unit.y * 65535.f + 0.5f);
+        pOut[i].Position[2] = (uint16_t)(Unit.z * 65535.f + 0.5f);
+        pOut[i].Position[3] = 0;
+        pOut[i].Normal = OctEncode(pVertices[i].Normal);
+        pOut[i].TexPos = glm::packHalf2x16(pVertices[i].TexPos);
+      }
+    }
+
+    // the float copy was only kept around to be uploaded
+    std::vector<Vertex>().swap(Vertices);
+  }
+
+  void Mesh::Move(glm::vec3 Direction)
+  {
+    Transform = glm::translate(Transform, Direction);
+  }
+
+  void Mesh::Load(EkBackend::AllocateInterface* pAlloc, VkDevice& inDevice, EkBackend::DescriptorSet& Set, std::string inPath, eVertexFormat Format)
+  {
+    Read(pAlloc, inPath, Format);
+    CreateTexture(inDevice, Set);
+  }
+
+  void Mesh::Read(EkBackend::AllocateInterface* pAlloc, std::string inPath, eVertexFormat Format, bool bMeshlets)
+  {
+    Path = inPath;
+
+    Alloc = pAlloc;
+
+    std::string AbsolutePath = MODELDIR;
+    AbsolutePath.append(inPath);
+
+    Vertices.clear();
+    Indices.clear();
+    SubMeshes.clear();
+    Nodes.clear();
+    Materials.clear();
+    Lods.clear();
+
+    std::string CachePath = AbsolutePath + ".ekmesh";
+    uint64_t SourceHash = EkBackend::MeshCache::HashFile(AbsolutePath);
+
+    delete pCache;
+    pCache = new EkBackend::MeshCache;
+
+    if(SourceHash != 0 && pCache->Open(CachePath, SourceHash, ImportFlags))
+    {
+      SubMeshes = std::move(pCache->SubMeshes);
+      Nodes = std::move(pCache->Nodes);
+      Materials = std::move(pCache->Materials);
+      Lods = std::move(pCache->Lods);
     }
     else
     {
-      Importer.FreeScene();
+      delete pCache;
+      pCache = nullptr;
+
+      Import(AbsolutePath);
+
+      if(SourceHash != 0 && !EkBackend::MeshCache::Write(CachePath, SourceHash, ImportFlags, Vertices, Indices, SubMeshes, Lods, Nodes, Materials))
+      {
+        std::cout << "failed to write mesh cache " << CachePath << '\n';
+      }
+    }
+
+    // the cache always holds float vertices and 32 bit indices, packing them again is cheap next to an import.
+    // So are the meshlets, they aren't cached
+    const Vertex* pVertices = Vertices.data();
+    const uint32_t* pIndices = Indices.data();
+    uint32_t VertexCount = Vertices.size();
+    uint32_t IndexCount = Indices.size();
+
+    if(pCache != nullptr)
+    {
+      pVertices = pCache->GetVertices();
+      pIndices = pCache->GetIndices();
+      VertexCount = pCache->GetVertexCount();
+      IndexCount = pCache->GetIndexCount();
+    }
+
+    Meshlets.clear();
+    MeshletVertices.clear();
+    MeshletTriangles.clear();
+
+    if(bMeshlets)
+    {
+      EkBackend::MeshOptimizer::BuildMeshlets(pVertices, pIndices, VertexCount, SubMeshes, Meshlets, MeshletVertices, MeshletTriangles);
+    }
+
+    PackIndices(pIndices, IndexCount, VertexCount);
+
+    // what SelectLod measures the distance to
+    Bounds = glm::vec4(0.f);
+
+    if(VertexCount > 0)
+    {
+      glm::vec3 Min = pVertices[0].Position;
+      glm::vec3 Max = Min;
+
+      for(uint32_t i = 1; i < VertexCount; i++)
+      {
+        Min = glm::min(Min, pVertices[i].Position);
+        Max = glm::max(Max, pVertices[i].Position);
+      }
+
+      glm::vec3 Center = (Min + Max) * 0.5f;
+
+      Bounds = glm::vec4(Center, glm::length(Max - Center));
+    }
+    // frees Vertices, so it goes last
+    Pack(pVertices, VertexCount, Format);
+
+    // we only have the one texture slot, it goes to the first material that has an albedo
+    std::string AlbedoPath = MODELDIR;
+    bool bAlbedo = false;
+
+    for(uint32_t i = 0; i < SubMeshes.size() && !bAlbedo; i++)
+    {
+      if(!Materials[SubMeshes[i].Material].AlbedoPath.empty())
+      {
+        AlbedoPath.append(Materials[SubMeshes[i].Material].AlbedoPath);
+        bAlbedo = true;
+      }
+    }
+
+    AlbedoImage = Ek::ImageData();
+
+    if(bAlbedo)
+    {
+      Alloc->DecodeImage(AlbedoPath.c_str(), AlbedoImage);
+    }
+  }
+
+  void Mesh::CreateTexture(VkDevice& inDevice, EkBackend::DescriptorSet& Set, EkBackend::TextureStreamer* pStreamer)
+  {
+    SceneSet = &Set;
+
+    pDevice = &inDevice;
+
+    if(AlbedoImage.Pixels.empty())
+    {
       return;
     }
 
     VkResult Err = VK_SUCCESS;
 
-    Err = Alloc->LoadImage(AlbedoPath.c_str(), Albedo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
-    Err = Alloc->CreateImageView(AlbedoView, Albedo, VK_IMAGE_ASPECT_COLOR_BIT);
+    Albedo.bMovable = true;
+    Albedo.pMoveListener = this;
+
+    if(pStreamer != nullptr)
+    {
+      Streamer = pStreamer;
+      Err = Streamer->Load(AlbedoImage, Albedo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    }
+    else
+    {
+      Err = Alloc->LoadImage(AlbedoImage, Albedo, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    }
+
+    // nothing was created, so the destructor mustn't think there's a view and sampler to go with it
+    if(Err != VK_SUCCESS)
+    {
+      Albedo.Image = VK_NULL_HANDLE;
+      throw std::runtime_error("Failed to load albedo texture for " + Path);
+    }
+
+    if((Err = Alloc->CreateImageView(AlbedoView, Albedo, VK_IMAGE_ASPECT_COLOR_BIT)) != VK_SUCCESS)
+    {
+      if(Streamer != nullptr)
+      {
+        Streamer->Remove(Albedo);
+      }
+
+      // the upload may still be reading into it
+      Alloc->WaitUpload(Alloc->GetUploadToken());
+      Albedo.Destroy();
+      Albedo.Image = VK_NULL_HANDLE;
+
+      throw std::runtime_error("Failed to create albedo image view for " + Path);
+    }
+
+    // the upload queue copied the pixels into staging already, or the streamer took them
+    AlbedoImage = Ek::ImageData();
 
     VkSamplerCreateInfo SamplerCI{};
     SamplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     SamplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     SamplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
     SamplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    SamplerCI.minLod = 1.f;
-    SamplerCI.maxLod = 1.f;
+    // the whole mip chain LoadImage made
+    SamplerCI.minLod = 0.f;
+    SamplerCI.maxLod = VK_LOD_CLAMP_NONE;
     SamplerCI.minFilter = VK_FILTER_LINEAR;
     SamplerCI.magFilter = VK_FILTER_LINEAR;
     SamplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
@@ -291,5 +930,20 @@ namespace Ek
 
     vkUpdateDescriptorSets(*pDevice, 1, &DescWrite, 0, nullptr);
   }
-}
 
+  void Mesh::OnMove(Ek::AllocatedObject* pObject)
+  {
+    if(pObject != &Albedo)
+    {
+      return;
+    }
+
+    vkDestroyImageView(*pDevice, AlbedoView, nullptr);
+    Alloc->CreateImageView(AlbedoView, Albedo, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    if(ShaderLocation.first != UINT32_MAX)
+    {
+      SetTextureBinding(ShaderLocation.first, ShaderLocation.second);
+    }
+  }
+}
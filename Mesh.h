@@ -2,29 +2,137 @@
 
 #include <assimp/Importer.hpp>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <glm/glm.hpp>
 
+#include "Geometry.h"
 #include "Memory.h"
+#include "MeshletCull.h"
+#include "TextureStreamer.h"
 #include "Wrappers.h"
 
+struct aiScene;
+struct aiNode;
+
+namespace EkBackend
+{
+  class MeshCache;
+}
+
+namespace Ek
+{
+  // how vertices are laid out in the geometry arena, picked once for the renderer before CreateDevice
+  enum eVertexFormat
+  {
+    eVertexFloat = 0,           // 32 bytes, Vertex as is
+    eVertexPacked = 1,          // 20 bytes, float3 position, octahedral snorm16x2 normal, half2 uv
+    eVertexPackedQuantized = 2  // 16 bytes, like eVertexPacked but the position is unorm16x4 across the mesh bounds
+  };
+}
+
+// what meshes are imported into, turned into the renderer's eVertexFormat before upload
 struct Vertex
 {
   glm::vec3 Position;
   glm::vec3 Normal;
   glm::vec2 TexPos;
 
-  static const std::vector<VkVertexInputAttributeDescription> GetAttributes();
-  static const std::vector<VkVertexInputBindingDescription> GetBinding();
+  static const std::vector<VkVertexInputAttributeDescription> GetAttributes(Ek::eVertexFormat Format = Ek::eVertexFloat);
+  static const std::vector<VkVertexInputBindingDescription> GetBinding(Ek::eVertexFormat Format = Ek::eVertexFloat);
+  static uint32_t GetStride(Ek::eVertexFormat Format);
+};
+
+struct PackedVertex
+{
+  glm::vec3 Position;
+  uint32_t Normal;
+  uint32_t TexPos;
+};
+
+struct QuantizedVertex
+{
+  uint16_t Position[4];
+  uint32_t Normal;
+  uint32_t TexPos;
 };
 
 namespace Ek
 {
+  // one aiMesh placed by one node, its vertices are already in model space. Offsets are relative to the model's slice of the arena
+  struct SubMesh
+  {
+    uint32_t FirstIndex = 0;
+    uint32_t IndexCount = 0;
+    uint32_t FirstVertex = 0;
+    uint32_t VertexCount = 0;
+
+    uint32_t Material = 0;
+    uint32_t Node = 0;
+  };
+
+  // one submesh at a reduced level of detail, built by MeshOptimizer::BuildLods. Every level's indices follow the level before
+  // it in the model's index range, all of them index the same vertices. Error is how far, in model space, the simplified
+  // surface is off from the full one
+  struct SubMeshLod
+  {
+    uint32_t FirstIndex = 0;
+    uint32_t IndexCount = 0;
+    float Error = 0.f;
+  };
+
+  // the scene's aiNode tree, flattened so parents always come before their children
+  struct MeshNode
+  {
+    std::string Name;
+    int32_t Parent = -1;
+
+    glm::mat4 Local = glm::mat4(1.f);
+    glm::mat4 World = glm::mat4(1.f);
+
+    // indices into the model's SubMeshes
+    std::vector<uint32_t> SubMeshes;
+  };
+
+  // one vkCmdDrawIndexed, FirstIndex is in IndexType sized units of the geometry arena's index buffer
+  struct DrawRange
+  {
+    uint32_t FirstIndex = 0;
+    uint32_t IndexCount = 0;
+    int32_t VertexOffset = 0;
+    VkIndexType IndexType = VK_INDEX_TYPE_UINT32;
+  };
+
+  // everything needed to draw the model at one level of detail, level 0 is the full mesh
+  struct MeshLevel
+  {
+    float Error = 0.f;
+
+    // the whole level in one draw, only when every index is the same width and relative to the model's first vertex
+    DrawRange WholeDraw;
+    std::vector<DrawRange> SubMeshDraws;
+  };
+
+  // the packed vertex shader does Position * Scale + Bias, it's identity unless the positions are quantized.
+  // Push it to the vertex stage at offset 16 before drawing the mesh
+  struct PositionDequant
+  {
+    glm::vec4 Scale = glm::vec4(1.f);
+    glm::vec4 Bias = glm::vec4(0.f);
+  };
+
+  struct MeshMaterial
+  {
+    std::string Name;
+    std::string AlbedoPath; // empty if the material has no diffuse/base color texture
+  };
+
   class Renderable
   {
     public:
       Renderable();
-      ~Renderable();
+      virtual ~Renderable();
 
       virtual void Draw(Ek::Wrappers::CommandBuffer& inBuffer) = 0;
 
@@ -36,47 +144,124 @@ namespace Ek
         std::vector<Vertex> Vertices;
         std::vector<uint32_t> Indices;
 
-      Ek::Buffer VertexBuffer;
-      Ek::Buffer IndexBuffer;
+      // where Vertices and Indices live in the geometry arena
+      Ek::GeometryRange Geometry;
   };
 
-  class Mesh : public Renderable
+  class Mesh : public Renderable, public EkBackend::MoveListener
   {
     public:
       Mesh();
       ~Mesh();
 
+      // submeshes are sorted by material and packed back to back, so the whole model is one draw as long as it has at most
+      // 65536 vertices. Past that every submesh is drawn on its own, with 16 bit indices if it is small enough.
+      // Once the culler has run over the mesh it's one indirect draw of whatever meshlets survived instead, the meshlets are
+      // only ever built from level 0 though. Both draw the level SelectLod picked
       void Draw(Ek::Wrappers::CommandBuffer& inBuffer);
+      void DrawSubMesh(Ek::Wrappers::CommandBuffer& inBuffer, uint32_t Index);
+
+      // picks the coarsest level whose error covers at most MaxPixelError pixels on screen. PixelsPerUnit is how many pixels
+      // one unit at distance one covers, so Projection[1][1] * ViewportHeight / 2
+      void SelectLod(const glm::mat4& WorldView, float PixelsPerUnit, float MaxPixelError);
+      uint32_t GetLod() { return Lod; }
+      uint32_t GetLodCount() { return Levels.size(); }
+
+      // tells the streamer which albedo level the mesh needs this frame, nothing if it's off screen. Assumes the texture is
+      // stretched across the mesh once, so its texels are spread over the bounding sphere's diameter
+      void RequestTexture(const glm::mat4& WorldView, const glm::mat4& Projection, float PixelsPerUnit);
 
-      void Load(EkBackend::AllocateInterface* pAlloc, VkDevice& inDevice, EkBackend::DescriptorSet& Set, std::string inPath);
-      void Allocate(Ek::Wrappers::CommandBuffer& inCmdBuffer);
+      // Read and CreateTexture in one go
+      void Load(EkBackend::AllocateInterface* pAlloc, VkDevice& inDevice, EkBackend::DescriptorSet& Set, std::string inPath, eVertexFormat Format = eVertexFloat);
+
+      // reads every mesh the scene's nodes place into one vertex/index allocation and decodes the albedo. The result is kept
+      // in a .ekmesh next to the model, later loads of the same file read that instead of going through assimp.
+      // Only touches the cpu, so loader threads can call it
+      // bMeshlets splits the mesh into meshlets for a MeshletCuller as well
+      void Read(EkBackend::AllocateInterface* pAlloc, std::string inPath, eVertexFormat Format = eVertexFloat, bool bMeshlets = false);
+      // these record uploads, so call them from one thread at a time
+      // with a streamer only the smallest levels of the albedo go up now, RequestTexture pulls in the rest
+      void CreateTexture(VkDevice& inDevice, EkBackend::DescriptorSet& Set, EkBackend::TextureStreamer* pStreamer = nullptr);
+      void Allocate(EkBackend::GeometryArena* pArena, EkBackend::MeshletCuller* pCuller = nullptr);
+
+      // what MeshletCuller::Cull takes, nullptr until the meshlets are uploaded or when the mesh has none
+      MeshletRange* GetMeshlets();
 
       void Move(glm::vec3 Direction);
 
       void SetTextureBinding(uint32_t Binding, uint32_t Location);
 
+      // the defragmenter moved Albedo or the streamer added levels to it, rebuild the view and descriptor
+      void OnMove(Ek::AllocatedObject* pObject);
+
+      const std::vector<SubMesh>& GetSubMeshes() { return SubMeshes; }
+      const std::vector<MeshNode>& GetNodes() { return Nodes; }
+      const std::vector<MeshMaterial>& GetMaterials() { return Materials; }
+      const std::vector<SubMeshLod>& GetLods() { return Lods; }
+      const PositionDequant& GetDequant() { return Dequant; }
+
       std::string Path;
 
     private:
+      // fills Vertices, Indices, SubMeshes, Lods, Nodes and Materials from the source model
+      void Import(const std::string& AbsolutePath);
+      void LoadNode(const aiScene* Scene, const aiNode* Node, int32_t Parent, std::vector<std::pair<uint32_t, uint32_t>>& Placed);
+      // converts the imported vertices into Format, Packed replaces Vertices when Format isn't eVertexFloat
+      void Pack(const Vertex* pVertices, uint32_t Count, eVertexFormat Format);
+      // picks 16 bit indices for the whole model when it can, otherwise per submesh, and fills IndexData and every level's draws
+      void PackIndices(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount);
+      void RecordDraw(Ek::Wrappers::CommandBuffer& inBuffer, const DrawRange& Range);
+      // from the camera to the closest point of the bounds, <= 0 when the camera is inside them. Scale is World's largest axis scale
+      float GetDistance(const glm::mat4& WorldView, float& Scale);
+
+      std::vector<SubMesh> SubMeshes;
+      std::vector<MeshNode> Nodes;
+      std::vector<MeshMaterial> Materials;
+      // SubMeshes.size() per reduced level, level 1 first
+      std::vector<SubMeshLod> Lods;
+
+      // what goes into the arena's index buffer, freed once it's uploaded
+      std::vector<uint8_t> IndexData;
+      bool bWholeDraw = false;
+      std::vector<MeshLevel> Levels;
+      uint32_t Lod = 0;
+      // model space bounding sphere, xyz center and w radius
+      glm::vec4 Bounds = glm::vec4(0.f);
+
+      std::vector<uint8_t> Packed;
+      uint32_t PackedStride = 0;
+      PositionDequant Dequant;
+
+      // built by Read, freed once Allocate handed them to the culler
+      std::vector<Meshlet> Meshlets;
+      std::vector<uint32_t> MeshletVertices;
+      std::vector<uint32_t> MeshletTriangles;
+      MeshletRange Clusters;
 
       Assimp::Importer Importer;
 
-      // Transit memory
-        void* pTemp;
-        Ek::Buffer TransitBuffer;
-        Ek::Wrappers::CommandBuffer cmdBuffer;
+      // open from Load until Allocate has copied the vertices/indices out of it, Vertices and Indices stay empty then
+      EkBackend::MeshCache* pCache = nullptr;
+
+      // Upload of the vertex/index data and albedo, we don't draw until it is done
+        Ek::UploadToken Ready = 0;
 
       // Descriptor Info
         EkBackend::DescriptorSet* SceneSet;
         std::pair<uint32_t, uint32_t> ShaderLocation;
 
       // Texture Info
+        // decoded by Read, freed once CreateTexture has handed it to the upload queue
+        Ek::ImageData AlbedoImage;
         Ek::Texture Albedo;
-        VkImageView AlbedoView;
-        VkSampler AlbedoSampler;
+        VkImageView AlbedoView = VK_NULL_HANDLE;
+        VkSampler AlbedoSampler = VK_NULL_HANDLE;
 
       // Allocator
         EkBackend::AllocateInterface* Alloc;
+        EkBackend::GeometryArena* Arena;
+        EkBackend::MeshletCuller* Culler;
+        EkBackend::TextureStreamer* Streamer;
   };
 }
 
@@ -0,0 +1,387 @@
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MeshCache.h"
+
+namespace EkBackend
+{
+  static const uint32_t CacheMagic = 0x534d4b45; // "EKMS"
+  // 2: meshes are run through MeshOptimizer before they're cached
+  // 3: simplified levels of detail after the full index range, their submesh ranges at the end of the table
+  // 4: positions are only transformed by their node, no extra z up swap on top of the one assimp does
+  static const uint32_t CacheVersion = 4;
+
+  // every section starts on a 16 byte boundary, so the arrays can be used in place
+  struct CacheHeader
+  {
+    uint32_t Magic;
+    uint32_t Version;
+    uint64_t SourceHash;
+    uint32_t ImportFlags;
+    uint32_t VertexStride;
+
+    uint32_t VertexCount;
+    uint32_t IndexCount;
+    uint32_t SubMeshCount;
+    uint32_t NodeCount;
+    uint32_t MaterialCount;
+    uint32_t LodCount;
+
+    uint64_t VertexOffset;
+    uint64_t IndexOffset;
+    uint64_t SubMeshOffset;
+    uint64_t TableOffset;   // nodes, materials and lods. The first two have strings in them so they're read one field at a time
+    uint64_t FileSize;
+  };
+
+  static uint64_t AlignSection(uint64_t Offset)
+  {
+    return (Offset + 15) & ~15ull;
+  }
+
+  static void WriteBytes(std::string& Out, const void* pData, size_t Size)
+  {
+    Out.append((const char*)pData, Size);
+  }
+
+  static void WriteString(std::string& Out, const std::string& Str)
+  {
+    uint32_t Length = Str.size();
+
+    WriteBytes(Out, &Length, sizeof(Length));
+    WriteBytes(Out, Str.data(), Length);
+  }
+
+  // walks the table section, every read checks it stays inside the file
+  struct CacheReader
+  {
+    const char* pCurr;
+    const char* pEnd;
+
+    bool Read(void* pData, size_t Size)
+    {
+      if((size_t)(pEnd - pCurr) < Size)
+      {
+        return false;
+      }
+
+      if(Size > 0)
+      {
+        memcpy(pData, pCurr, Size);
+        pCurr += Size;
+      }
+
+      return true;
+    }
+
+    bool ReadString(std::string& Str)
+    {
+      uint32_t Length;
+
+      if(!Read(&Length, sizeof(Length)) || (size_t)(pEnd - pCurr) < Length)
+      {
+        return false;
+      }
+
+      Str.assign(pCurr, Length);
+      pCurr += Length;
+
+      return true;
+    }
+  };
+
+  MeshCache::~MeshCache()
+  {
+    Close();
+  }
+
+  uint64_t MeshCache::HashFile(const std::string& Path)
+  {
+    int File = open(Path.c_str(), O_RDONLY);
+
+    if(File < 0)
+    {
+      return 0;
+    }
+
+    uint64_t Hash = 0xcbf29ce484222325ull;
+    unsigned char Buffer[65536];
+    ssize_t Read;
+
+    while((Read = read(File, Buffer, sizeof(Buffer))) > 0)
+    {
+      for(ssize_t i = 0; i < Read; i++)
+      {
+        Hash ^= Buffer[i];
+        Hash *= 0x100000001b3ull;
+      }
+    }
+
+    close(File);
+
+    return (Read < 0) ? 0 : Hash;
+  }
+
+  std::string MeshCache::GetTempPath(const std::string& Path)
+  {
+    static std::atomic<uint64_t> Counter(0);
+
+    return Path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(Counter++);
+  }
+
+  bool MeshCache::Open(const std::string& Path, uint64_t SourceHash, uint32_t ImportFlags)
+  {
+    Close();
+
+    int File = open(Path.c_str(), O_RDONLY);
+
+    if(File < 0)
+    {
+      return false;
+    }
+
+    struct stat Info;
+
+    if(fstat(File, &Info) != 0 || (size_t)Info.st_size < sizeof(CacheHeader))
+    {
+      close(File);
+      return false;
+    }
+
+    MappedSize = Info.st_size;
+    pMapped = mmap(nullptr, MappedSize, PROT_READ, MAP_PRIVATE, File, 0);
+
+    // the mapping keeps the file alive on its own
+    close(File);
+
+    if(pMapped == MAP_FAILED)
+    {
+      pMapped = nullptr;
+      return false;
+    }
+
+    const char* pData = (const char*)pMapped;
+    const CacheHeader* pHeader = (const CacheHeader*)pData;
+
+    bool bValid = pHeader->Magic == CacheMagic && pHeader->Version == CacheVersion && pHeader->SourceHash == SourceHash && pHeader->ImportFlags == ImportFlags &&
+                  pHeader->VertexStride == sizeof(Vertex) && pHeader->FileSize == MappedSize &&
+                  pHeader->VertexOffset <= MappedSize && pHeader->IndexOffset <= MappedSize && pHeader->SubMeshOffset <= MappedSize &&
+                  (pHeader->VertexOffset | pHeader->IndexOffset | pHeader->SubMeshOffset) % 16 == 0 &&
+                  pHeader->VertexOffset + (uint64_t)pHeader->VertexCount * sizeof(Vertex) <= MappedSize &&
+                  pHeader->IndexOffset + (uint64_t)pHeader->IndexCount * sizeof(uint32_t) <= MappedSize &&
+                  pHeader->SubMeshOffset + (uint64_t)pHeader->SubMeshCount * sizeof(Ek::SubMesh) <= MappedSize &&
+                  pHeader->TableOffset <= MappedSize;
+
+    if(!bValid)
+    {
+      Close();
+      return false;
+    }
+
+    // the vertex data is read by the copy into staging, tell the kernel to start reading it in now
+    madvise(pMapped, MappedSize, MADV_WILLNEED);
+
+    pVertices = (const Vertex*)(pData + pHeader->VertexOffset);
+    pIndices = (const uint32_t*)(pData + pHeader->IndexOffset);
+    VertexCount = pHeader->VertexCount;
+    IndexCount = pHeader->IndexCount;
+
+    CacheReader Reader{pData + pHeader->SubMeshOffset, pData + MappedSize};
+
+    SubMeshes.resize(pHeader->SubMeshCount);
+    Reader.Read(SubMeshes.data(), SubMeshes.size() * sizeof(Ek::SubMesh));
+
+    Reader.pCurr = pData + pHeader->TableOffset;
+
+    // like the lods below, a broken count mustn't make us allocate gigabytes. A node is at least an empty name, its parent,
+    // two matrices and an empty submesh list, a material two empty strings
+    const uint64_t MinNodeSize = sizeof(uint32_t) + sizeof(int32_t) + 2 * sizeof(glm::mat4) + sizeof(uint32_t);
+    const uint64_t MinMaterialSize = 2 * sizeof(uint32_t);
+
+    bValid = (uint64_t)pHeader->NodeCount * MinNodeSize + (uint64_t)pHeader->MaterialCount * MinMaterialSize <= (uint64_t)(Reader.pEnd - Reader.pCurr);
+
+    Nodes.resize(bValid ? pHeader->NodeCount : 0);
+
+    for(uint32_t i = 0; i < Nodes.size() && bValid; i++)
+    {
+      uint32_t SubMeshCount = 0;
+
+      bValid = Reader.ReadString(Nodes[i].Name) && Reader.Read(&Nodes[i].Parent, sizeof(Nodes[i].Parent)) &&
+               Reader.Read(&Nodes[i].Local, sizeof(Nodes[i].Local)) && Reader.Read(&Nodes[i].World, sizeof(Nodes[i].World)) &&
+               Reader.Read(&SubMeshCount, sizeof(SubMeshCount)) && SubMeshCount <= SubMeshes.size();
+
+      if(bValid)
+      {
+        Nodes[i].SubMeshes.resize(SubMeshCount);
+        bValid = Reader.Read(Nodes[i].SubMeshes.data(), SubMeshCount * sizeof(uint32_t));
+      }
+    }
+
+    Materials.resize(bValid ? pHeader->MaterialCount : 0);
+
+    for(uint32_t i = 0; i < Materials.size() && bValid; i++)
+    {
+      bValid = Reader.ReadString(Materials[i].Name) && Reader.ReadString(Materials[i].AlbedoPath);
+    }
+
+    // checked before the resize so a broken count can't make us allocate gigabytes
+    bValid = bValid && (uint64_t)pHeader->LodCount * sizeof(Ek::SubMeshLod) <= (uint64_t)(Reader.pEnd - Reader.pCurr);
+
+    if(bValid)
+    {
+      Lods.resize(pHeader->LodCount);
+      bValid = Reader.Read(Lods.data(), Lods.size() * sizeof(Ek::SubMeshLod));
+    }
+
+    // every level's ranges have to be inside the index array, PackIndices trusts them
+    for(uint32_t i = 0; i < Lods.size() && bValid; i++)
+    {
+      bValid = (uint64_t)Lods[i].FirstIndex + Lods[i].IndexCount <= IndexCount;
+    }
+
+    bValid = bValid && (SubMeshes.empty() ? Lods.empty() : Lods.size() % SubMeshes.size() == 0);
+
+    // the same for what PackIndices, BuildMeshlets and Mesh::Read index with, a damaged file can still have a matching hash
+    for(uint32_t i = 0; i < SubMeshes.size() && bValid; i++)
+    {
+      const Ek::SubMesh& Sub = SubMeshes[i];
+
+      bValid = (uint64_t)Sub.FirstIndex + Sub.IndexCount <= IndexCount && (uint64_t)Sub.FirstVertex + Sub.VertexCount <= VertexCount &&
+               Sub.Material < Materials.size() && Sub.Node < Nodes.size();
+    }
+
+    // parents come before their children
+    for(uint32_t i = 0; i < Nodes.size() && bValid; i++)
+    {
+      bValid = Nodes[i].Parent >= -1 && Nodes[i].Parent < (int32_t)i;
+
+      for(uint32_t x = 0; x < Nodes[i].SubMeshes.size() && bValid; x++)
+      {
+        bValid = Nodes[i].SubMeshes[x] < SubMeshes.size();
+      }
+    }
+
+    for(uint32_t i = 0; i < IndexCount && bValid; i++)
+    {
+      bValid = pIndices[i] < VertexCount;
+    }
+
+    if(!bValid)
+    {
+      std::cout << "mesh cache " << Path << " is damaged, importing the source again\n";
+      Close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void MeshCache::Close()
+  {
+    if(pMapped != nullptr)
+    {
+      munmap(pMapped, MappedSize);
+    }
+
+    pMapped = nullptr;
+    MappedSize = 0;
+
+    pVertices = nullptr;
+    pIndices = nullptr;
+    VertexCount = 0;
+    IndexCount = 0;
+  }
+
+  bool MeshCache::Write(const std::string& Path, uint64_t SourceHash, uint32_t ImportFlags, const std::vector<Vertex>& Vertices, const std::vector<uint32_t>& Indices,
+                        const std::vector<Ek::SubMesh>& SubMeshes, const std::vector<Ek::SubMeshLod>& Lods, const std::vector<Ek::MeshNode>& Nodes,
+                        const std::vector<Ek::MeshMaterial>& Materials)
+  {
+    CacheHeader Header{};
+    Header.Magic = CacheMagic;
+    Header.Version = CacheVersion;
+    Header.SourceHash = SourceHash;
+    Header.ImportFlags = ImportFlags;
+    Header.VertexStride = sizeof(Vertex);
+
+    Header.VertexCount = Vertices.size();
+    Header.IndexCount = Indices.size();
+    Header.SubMeshCount = SubMeshes.size();
+    Header.NodeCount = Nodes.size();
+    Header.MaterialCount = Materials.size();
+    Header.LodCount = Lods.size();
+
+    Header.VertexOffset = AlignSection(sizeof(CacheHeader));
+    Header.IndexOffset = AlignSection(Header.VertexOffset + Vertices.size() * sizeof(Vertex));
+    Header.SubMeshOffset = AlignSection(Header.IndexOffset + Indices.size() * sizeof(uint32_t));
+    Header.TableOffset = AlignSection(Header.SubMeshOffset + SubMeshes.size() * sizeof(Ek::SubMesh));
+
+    std::string Table;
+
+    for(uint32_t i = 0; i < Nodes.size(); i++)
+    {
+      uint32_t SubMeshCount = Nodes[i].SubMeshes.size();
+
+      WriteString(Table, Nodes[i].Name);
+      WriteBytes(Table, &Nodes[i].Parent, sizeof(Nodes[i].Parent));
+      WriteBytes(Table, &Nodes[i].Local, sizeof(Nodes[i].Local));
+      WriteBytes(Table, &Nodes[i].World, sizeof(Nodes[i].World));
+      WriteBytes(Table, &SubMeshCount, sizeof(SubMeshCount));
+      WriteBytes(Table, Nodes[i].SubMeshes.data(), SubMeshCount * sizeof(uint32_t));
+    }
+
+    for(uint32_t i = 0; i < Materials.size(); i++)
+    {
+      WriteString(Table, Materials[i].Name);
+      WriteString(Table, Materials[i].AlbedoPath);
+    }
+
+    WriteBytes(Table, Lods.data(), Lods.size() * sizeof(Ek::SubMeshLod));
+
+    Header.FileSize = Header.TableOffset + Table.size();
+
+    std::string TempPath = GetTempPath(Path);
+    std::ofstream File(TempPath, std::ios::binary | std::ios::trunc);
+
+    if(!File.is_open())
+    {
+      return false;
+    }
+
+    static const char Zeros[16] = {};
+
+    File.write((const char*)&Header, sizeof(Header));
+    File.write(Zeros, Header.VertexOffset - sizeof(Header));
+    File.write((const char*)Vertices.data(), Vertices.size() * sizeof(Vertex));
+    File.write(Zeros, Header.IndexOffset - (Header.VertexOffset + Vertices.size() * sizeof(Vertex)));
+    File.write((const char*)Indices.data(), Indices.size() * sizeof(uint32_t));
+    File.write(Zeros, Header.SubMeshOffset - (Header.IndexOffset + Indices.size() * sizeof(uint32_t)));
+    File.write((const char*)SubMeshes.data(), SubMeshes.size() * sizeof(Ek::SubMesh));
+    File.write(Zeros, Header.TableOffset - (Header.SubMeshOffset + SubMeshes.size() * sizeof(Ek::SubMesh)));
+    File.write(Table.data(), Table.size());
+
+    File.close();
+
+    if(File.fail())
+    {
+      std::remove(TempPath.c_str());
+      return false;
+    }
+
+    // a unique temp name is never cleaned up by the next write, so don't leave it behind
+    if(std::rename(TempPath.c_str(), Path.c_str()) != 0)
+    {
+      std::remove(TempPath.c_str());
+      return false;
+    }
+
+    return true;
+  }
+}
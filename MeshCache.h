@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Mesh.h"
+
+namespace EkBackend
+{
+  /*
+    A .ekmesh file next to a model, holding what Mesh::Load made out of it: the packed vertex and index arrays ready to be
+    uploaded, the submeshes and their levels of detail, the node tree and the materials. It is keyed by an FNV-1a hash of
+    the source file, the assimp import flags and the vertex layout, so editing the model or changing how we import it makes
+    the cache miss.
+    Open maps the file, the vertex/index pointers point straight into the mapping until Close.
+  */
+  class MeshCache
+  {
+    public:
+      ~MeshCache();
+
+      // false if there is no cache or it was made from something else, the caller imports the source then
+      bool Open(const std::string& Path, uint64_t SourceHash, uint32_t ImportFlags);
+      void Close();
+      bool IsOpen() { return pMapped != nullptr; }
+
+      // written to a GetTempPath and renamed over Path, so a crash halfway never leaves a broken cache behind
+      static bool Write(const std::string& Path, uint64_t SourceHash, uint32_t ImportFlags, const std::vector<Vertex>& Vertices, const std::vector<uint32_t>& Indices,
+                        const std::vector<Ek::SubMesh>& SubMeshes, const std::vector<Ek::SubMeshLod>& Lods, const std::vector<Ek::MeshNode>& Nodes,
+                        const std::vector<Ek::MeshMaterial>& Materials);
+
+      // FNV-1a over the whole file, 0 if it can't be read
+      static uint64_t HashFile(const std::string& Path);
+      // a file next to Path no other writer uses, loader threads can be writing the same cache at the same time. Whichever
+      // rename lands last wins, they wrote the same thing
+      static std::string GetTempPath(const std::string& Path);
+
+      const Vertex* GetVertices() { return pVertices; }
+      const uint32_t* GetIndices() { return pIndices; }
+      uint32_t GetVertexCount() { return VertexCount; }
+      uint32_t GetIndexCount() { return IndexCount; }
+
+      // filled by Open
+      std::vector<Ek::SubMesh> SubMeshes;
+      std::vector<Ek::SubMeshLod> Lods;
+      std::vector<Ek::MeshNode> Nodes;
+      std::vector<Ek::MeshMaterial> Materials;
+
+    private:
+      void* pMapped = nullptr;
+      size_t MappedSize = 0;
+
+      const Vertex* pVertices = nullptr;
+      const uint32_t* pIndices = nullptr;
+      uint32_t VertexCount = 0;
+      uint32_t IndexCount = 0;
+  };
+}
@@ -0,0 +1,903 @@
+#include <algorithm>
+#include <cmath>
+
+#include "MeshOptimizer.h"
+
+namespace EkBackend
+{
+  // area weighted sum of squared distances to a set of planes
+  struct Quadric
+  {
+    double XX = 0, XY = 0, XZ = 0, YY = 0, YZ = 0, ZZ = 0;
+    double DX = 0, DY = 0, DZ = 0, DD = 0;
+    double Weight = 0;
+
+    void AddPlane(const glm::vec3& Normal, float Distance, float Area)
+    {
+      XX += Area * Normal.x * Normal.x;
+      XY += Area * Normal.x * Normal.y;
+      XZ += Area * Normal.x * Normal.z;
+      YY += Area * Normal.y * Normal.y;
+      YZ += Area * Normal.y * Normal.z;
+      ZZ += Area * Normal.z * Normal.z;
+      DX += Area * Normal.x * Distance;
+      DY += Area * Normal.y * Distance;
+      DZ += Area * Normal.z * Distance;
+      DD += Area * Distance * Distance;
+      Weight += Area;
+    }
+
+    void Add(const Quadric& Other)
+    {
+      XX += Other.XX; XY += Other.XY; XZ += Other.XZ;
+      YY += Other.YY; YZ += Other.YZ; ZZ += Other.ZZ;
+      DX += Other.DX; DY += Other.DY; DZ += Other.DZ;
+      DD += Other.DD;
+      Weight += Other.Weight;
+    }
+
+    // mean squared distance of Pos to the planes
+    double Eval(const glm::vec3& Pos) const
+    {
+      double X = Pos.x, Y = Pos.y, Z = Pos.z;
+
+      double Sum = XX * X * X + YY * Y * Y + ZZ * Z * Z + 2 * (XY * X * Y + XZ * X * Z + YZ * Y * Z) + 2 * (DX * X + DY * Y + DZ * Z) + DD;
+
+      return (Weight > 0) ? std::max(Sum, 0.0) / Weight : 0;
+    }
+  };
+
+  uint32_t MeshOptimizer::CountMisses(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount)
+  {
+    // a vertex is in the cache while fewer than CacheSize misses happened since it was loaded, LoadedAt is 0 for never
+    std::vector<uint32_t> LoadedAt(VertexCount, 0);
+    uint32_t Misses = 0;
+
+    for(uint32_t i = 0; i < IndexCount; i++)
+    {
+      uint32_t Index = pIndices[i];
+
+      if(LoadedAt[Index] == 0 || Misses - LoadedAt[Index] >= CacheSize)
+      {
+        Misses++;
+        LoadedAt[Index] = Misses;
+      }
+    }
+
+    return Misses;
+  }
+
+  float MeshOptimizer::GetAcmr(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount)
+  {
+    if(IndexCount < 3)
+    {
+      return 0.f;
+    }
+
+    return (float)CountMisses(pIndices, IndexCount, VertexCount) / (IndexCount / 3);
+  }
+
+  void MeshOptimizer::Tipsify(std::vector<uint32_t>& Indices, uint32_t VertexCount, std::vector<uint32_t>& Clusters)
+  {
+    uint32_t TriangleCount = Indices.size() / 3;
+
+    // triangles around every vertex, packed back to back
+    std::vector<uint32_t> Live(VertexCount, 0);
+    std::vector<uint32_t> AdjacencyStart(VertexCount + 1, 0);
+    std::vector<uint32_t> Adjacency(TriangleCount * 3);
+
+    for(uint32_t i = 0; i < TriangleCount * 3; i++)
+    {
+      Live[Indices[i]]++;
+    }
+
+    for(uint32_t i = 0; i < VertexCount; i++)
+    {
+      AdjacencyStart[i + 1] = AdjacencyStart[i] + Live[i];
+    }
+
+    {
+      std::vector<uint32_t> Fill(AdjacencyStart.begin(), AdjacencyStart.end() - 1);
+
+      for(uint32_t i = 0; i < TriangleCount * 3; i++)
+      {
+        Adjacency[Fill[Indices[i]]++] = i / 3;
+      }
+    }
+
+    std::vector<uint32_t> CacheTime(VertexCount, 0);
+    std::vector<bool> Emitted(TriangleCount, false);
+    std::vector<uint32_t> DeadEnds;
+    std::vector<uint32_t> Candidates;
+    std::vector<uint32_t> Out;
+    Out.reserve(TriangleCount * 3);
+
+    uint32_t Time = CacheSize + 1;
+    uint32_t Cursor = 0;
+    int64_t Fan = 0;
+
+    Clusters.clear();
+    Clusters.push_back(0);
+
+    while(Fan >= 0 && VertexCount > 0)
+    {
+      Candidates.clear();
+
+      for(uint32_t a = AdjacencyStart[Fan]; a < AdjacencyStart[Fan + 1]; a++)
+      {
+        uint32_t Triangle = Adjacency[a];
+
+        if(Emitted[Triangle])
+        {
+          continue;
+        }
+
+        Emitted[Triangle] = true;
+
+        for(uint32_t x = 0; x < 3; x++)
+        {
+          uint32_t Index = Indices[Triangle * 3 + x];
+
+          Out.push_back(Index);
+          DeadEnds.push_back(Index);
+          Candidates.push_back(Index);
+          Live[Index]--;
+
+          if(Time - CacheTime[Index] > CacheSize)
+          {
+            CacheTime[Index] = Time++;
+          }
+        }
+      }
+
+      // the candidate that is still going to be in the cache after its remaining triangles went through, the oldest one wins
+      Fan = -1;
+      int64_t Best = -1;
+
+      for(uint32_t c = 0; c < Candidates.size(); c++)
+      {
+        uint32_t Index = Candidates[c];
+
+        if(Live[Index] == 0)
+        {
+          continue;
+        }
+
+        int64_t Priority = 0;
+
+        if(Time - CacheTime[Index] + 2 * Live[Index] <= CacheSize)
+        {
+          Priority = Time - CacheTime[Index];
+        }
+
+        if(Priority > Best)
+        {
+          Best = Priority;
+          Fan = Index;
+        }
+      }
+
+      if(Fan >= 0)
+      {
+        continue;
+      }
+
+      // nothing useful is left in the cache, the next triangle starts a new cluster
+      while(!DeadEnds.empty() && Fan < 0)
+      {
+        uint32_t Index = DeadEnds.back();
+        DeadEnds.pop_back();
+
+        if(Live[Index] > 0)
+        {
+          Fan = Index;
+        }
+      }
+
+      while(Fan < 0 && Cursor < VertexCount)
+      {
+        if(Live[Cursor] > 0)
+        {
+          Fan = Cursor;
+        }
+
+        Cursor++;
+      }
+
+      if(Fan >= 0 && Out.size() / 3 > Clusters.back())
+      {
+        Clusters.push_back(Out.size() / 3);
+      }
+    }
+
+    Indices.swap(Out);
+  }
+
+  void MeshOptimizer::SortClusters(std::vector<uint32_t>& Indices, const Vertex* pVertices, const std::vector<uint32_t>& Clusters)
+  {
+    uint32_t TriangleCount = Indices.size() / 3;
+
+    struct Cluster
+    {
+      uint32_t First;
+      uint32_t Count;
+      float Key;
+    };
+
+    std::vector<Cluster> Sorted(Clusters.size());
+
+    // area weighted centroid of the whole submesh
+    glm::vec3 Center(0.f);
+    float TotalArea = 0.f;
+
+    for(uint32_t t = 0; t < TriangleCount; t++)
+    {
+      const glm::vec3& A = pVertices[Indices[t * 3 + 0]].Position;
+      const glm::vec3& B = pVertices[Indices[t * 3 + 1]].Position;
+      const glm::vec3& C = pVertices[Indices[t * 3 + 2]].Position;
+
+      float Area = glm::length(glm::cross(B - A, C - A));
+
+      Center += (A + B + C) * (Area / 3.f);
+      TotalArea += Area;
+    }
+
+    if(TotalArea > 0.f)
+    {
+      Center /= TotalArea;
+    }
+
+    for(uint32_t c = 0; c < Clusters.size(); c++)
+    {
+      Cluster& Curr = Sorted[c];
+      Curr.First = Clusters[c];
+      Curr.Count = ((c + 1 < Clusters.size()) ? Clusters[c + 1] : TriangleCount) - Curr.First;
+
+      glm::vec3 ClusterCenter(0.f);
+      glm::vec3 Normal(0.f);
+      float Area = 0.f;
+
+      for(uint32_t t = Curr.First; t < Curr.First + Curr.Count; t++)
+      {
+        const glm::vec3& A = pVertices[Indices[t * 3 + 0]].Position;
+        const glm::vec3& B = pVertices[Indices[t * 3 + 1]].Position;
+        const glm::vec3& C = pVertices[Indices[t * 3 + 2]].Position;
+
+        // the cross product's length is twice the area, so summing them weights the normal by area
+        glm::vec3 Cross = glm::cross(B - A, C - A);
+        float TriangleArea = glm::length(Cross);
+
+        ClusterCenter += (A + B + C) * (TriangleArea / 3.f);
+        Normal += Cross;
+        Area += TriangleArea;
+      }
+
+      Curr.Key = 0.f;
+
+      if(Area > 0.f && glm::length(Normal) > 0.f)
+      {
+        Curr.Key = glm::dot(ClusterCenter / Area - Center, glm::normalize(Normal));
+      }
+    }
+
+    // the further out a cluster faces, the more of the model it can hide
+    std::stable_sort(Sorted.begin(), Sorted.end(), [](const Cluster& A, const Cluster& B) { return A.Key > B.Key; });
+
+    std::vector<uint32_t> Out;
+    Out.reserve(Indices.size());
+
+    for(uint32_t c = 0; c < Sorted.size(); c++)
+    {
+      Out.insert(Out.end(), Indices.begin() + Sorted[c].First * 3, Indices.begin() + (Sorted[c].First + Sorted[c].Count) * 3);
+    }
+
+    Indices.swap(Out);
+  }
+
+  void MeshOptimizer::OptimizeFetch(std::vector<uint32_t>& Indices, Vertex* pVertices, uint32_t VertexCount)
+  {
+    std::vector<uint32_t> Remap(VertexCount, UINT32_MAX);
+    std::vector<Vertex> Reordered(VertexCount);
+    uint32_t Next = 0;
+
+    for(uint32_t i = 0; i < Indices.size(); i++)
+    {
+      uint32_t& Index = Indices[i];
+
+      if(Remap[Index] == UINT32_MAX)
+      {
+        Reordered[Next] = pVertices[Index];
+        Remap[Index] = Next++;
+      }
+
+      Index = Remap[Index];
+    }
+
+    // vertices no triangle uses go to the back so the ranges keep their size
+    for(uint32_t i = 0; i < VertexCount; i++)
+    {
+      if(Remap[i] == UINT32_MAX)
+      {
+        Reordered[Next++] = pVertices[i];
+      }
+    }
+
+    std::copy(Reordered.begin(), Reordered.end(), pVertices);
+  }
+
+  MeshOptimizer::Stats MeshOptimizer::Optimize(std::vector<Vertex>& Vertices, std::vector<uint32_t>& Indices, const std::vector<Ek::SubMesh>& SubMeshes)
+  {
+    Stats Ret;
+    uint64_t MissesBefore = 0;
+    uint64_t MissesAfter = 0;
+    uint64_t TriangleCount = 0;
+
+    std::vector<uint32_t> Local;
+    std::vector<uint32_t> Cached;
+    std::vector<uint32_t> Clusters;
+
+    for(uint32_t s = 0; s < SubMeshes.size(); s++)
+    {
+      const Ek::SubMesh& Sub = SubMeshes[s];
+
+      // only whole triangles
+      uint32_t IndexCount = Sub.IndexCount - Sub.IndexCount % 3;
+
+      if(IndexCount == 0)
+      {
+        continue;
+      }
+
+      Local.assign(Indices.begin() + Sub.FirstIndex, Indices.begin() + Sub.FirstIndex + IndexCount);
+
+      for(uint32_t i = 0; i < Local.size(); i++)
+      {
+        Local[i] -= Sub.FirstVertex;
+      }
+
+      uint32_t Before = CountMisses(Local.data(), Local.size(), Sub.VertexCount);
+
+      Tipsify(Local, Sub.VertexCount, Clusters);
+
+      uint32_t AfterCache = CountMisses(Local.data(), Local.size(), Sub.VertexCount);
+
+      if(Clusters.size() > 1)
+      {
+        Cached = Local;
+
+        SortClusters(Local, Vertices.data() + Sub.FirstVertex, Clusters);
+
+        // clusters start on a cold cache anyway, so sorting them should cost next to nothing
+        if(CountMisses(Local.data(), Local.size(), Sub.VertexCount) > AfterCache * OverdrawThreshold)
+        {
+          Local.swap(Cached);
+        }
+      }
+
+      OptimizeFetch(Local, Vertices.data() + Sub.FirstVertex, Sub.VertexCount);
+
+      MissesBefore += Before;
+      MissesAfter += CountMisses(Local.data(), Local.size(), Sub.VertexCount);
+      TriangleCount += IndexCount / 3;
+
+      for(uint32_t i = 0; i < Local.size(); i++)
+      {
+        Indices[Sub.FirstIndex + i] = Local[i] + Sub.FirstVertex;
+      }
+    }
+
+    if(TriangleCount > 0)
+    {
+      Ret.AcmrBefore = (float)MissesBefore / TriangleCount;
+      Ret.AcmrAfter = (float)MissesAfter / TriangleCount;
+    }
+
+    return Ret;
+  }
+
+  void MeshOptimizer::ComputeBounds(Ek::Meshlet& Curr, const Vertex* pVertices, const std::vector<uint32_t>& Vertices, const std::vector<uint32_t>& Triangles)
+  {
+    glm::vec3 Min = pVertices[Vertices[Curr.VertexOffset]].Position;
+    glm::vec3 Max = Min;
+
+    for(uint32_t v = 1; v < Curr.VertexCount; v++)
+    {
+      Min = glm::min(Min, pVertices[Vertices[Curr.VertexOffset + v]].Position);
+      Max = glm::max(Max, pVertices[Vertices[Curr.VertexOffset + v]].Position);
+    }
+
+    glm::vec3 Center = (Min + Max) * 0.5f;
+    float Radius = 0.f;
+
+    for(uint32_t v = 0; v < Curr.VertexCount; v++)
+    {
+      Radius = std::max(Radius, glm::length(pVertices[Vertices[Curr.VertexOffset + v]].Position - Center));
+    }
+
+    Curr.Sphere = glm::vec4(Center, Radius);
+
+    // face normals from the winding, so the cone agrees with what the rasterizer would cull
+    std::vector<glm::vec3> Normals;
+    Normals.reserve(Curr.TriangleCount);
+
+    glm::vec3 Axis(0.f);
+
+    for(uint32_t t = 0; t < Curr.TriangleCount; t++)
+    {
+      uint32_t Triangle = Triangles[Curr.TriangleOffset + t];
+
+      const glm::vec3& A = pVertices[Vertices[Curr.VertexOffset + (Triangle & 0xFF)]].Position;
+      const glm::vec3& B = pVertices[Vertices[Curr.VertexOffset + ((Triangle >> 8) & 0xFF)]].Position;
+      const glm::vec3& C = pVertices[Vertices[Curr.VertexOffset + ((Triangle >> 16) & 0xFF)]].Position;
+
+      glm::vec3 Cross = glm::cross(B - A, C - A);
+      float Length = glm::length(Cross);
+
+      // degenerate triangles never get rasterized, they don't get a say
+      if(Length > 0.f)
+      {
+        Normals.push_back(Cross / Length);
+        Axis += Normals.back();
+      }
+    }
+
+    Curr.Cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+
+    if(Normals.empty() || !(glm::length(Axis) > 0.f))
+    {
+      return;
+    }
+
+    Axis = glm::normalize(Axis);
+
+    float MinDot = 1.f;
+
+    for(uint32_t n = 0; n < Normals.size(); n++)
+    {
+      MinDot = std::min(MinDot, glm::dot(Axis, Normals[n]));
+    }
+
+    // the normals spread over more than a hemisphere (give or take), there's no camera position that sees none of them
+    if(MinDot <= 0.1f)
+    {
+      return;
+    }
+
+    Curr.Cone = glm::vec4(Axis, std::sqrt(1.f - MinDot * MinDot));
+  }
+
+  void MeshOptimizer::BuildMeshlets(const Vertex* pVertices, const uint32_t* pIndices, uint32_t VertexCount, const std::vector<Ek::SubMesh>& SubMeshes,
+    std::vector<Ek::Meshlet>& Meshlets, std::vector<uint32_t>& Vertices, std::vector<uint32_t>& Triangles)
+  {
+    Meshlets.clear();
+    Vertices.clear();
+    Triangles.clear();
+
+    // where a vertex sits in the meshlet being filled, UINT32_MAX if it isn't in it
+    std::vector<uint32_t> Local(VertexCount, UINT32_MAX);
+
+    Ek::Meshlet Curr;
+
+    auto Flush = [&]()
+    {
+      if(Curr.TriangleCount == 0)
+      {
+        return;
+      }
+
+      ComputeBounds(Curr, pVertices, Vertices, Triangles);
+
+      for(uint32_t v = 0; v < Curr.VertexCount; v++)
+      {
+        Local[Vertices[Curr.VertexOffset + v]] = UINT32_MAX;
+      }
+
+      Meshlets.push_back(Curr);
+
+      Curr = Ek::Meshlet();
+      Curr.VertexOffset = Vertices.size();
+      Curr.TriangleOffset = Triangles.size();
+    };
+
+    for(uint32_t s = 0; s < SubMeshes.size(); s++)
+    {
+      const Ek::SubMesh& Sub = SubMeshes[s];
+
+      // a meshlet never spans two submeshes, they might not share a material
+      Flush();
+
+      for(uint32_t i = Sub.FirstIndex; i + 2 < Sub.FirstIndex + Sub.IndexCount; i += 3)
+      {
+        uint32_t New = 0;
+
+        for(uint32_t x = 0; x < 3; x++)
+        {
+          // a triangle that uses the same vertex twice would be counted twice, that only wastes a slot
+          New += (Local[pIndices[i + x]] == UINT32_MAX) ? 1 : 0;
+        }
+
+        if(Curr.VertexCount + New > Ek::Meshlet::MaxVertices || Curr.TriangleCount + 1 > Ek::Meshlet::MaxTriangles)
+        {
+          Flush();
+        }
+
+        uint32_t Packed = 0;
+
+        for(uint32_t x = 0; x < 3; x++)
+        {
+          uint32_t Index = pIndices[i + x];
+
+          if(Local[Index] == UINT32_MAX)
+          {
+            Local[Index] = Curr.VertexCount++;
+            Vertices.push_back(Index);
+          }
+
+          Packed |= Local[Index] << (x * 8);
+        }
+
+        Triangles.push_back(Packed);
+        Curr.TriangleCount++;
+      }
+    }
+
+    Flush();
+  }
+
+  float MeshOptimizer::Simplify(std::vector<uint32_t>& Indices, const Vertex* pVertices, uint32_t VertexCount, uint32_t TargetCount)
+  {
+    uint32_t TriangleCount = Indices.size() / 3;
+
+    if(TriangleCount <= TargetCount)
+    {
+      return 0.f;
+    }
+
+    // vertices on the same spot are one point of the surface split by a uv or normal seam, Wedge is the first of them
+    std::vector<uint32_t> Wedge(VertexCount);
+    {
+      std::vector<uint32_t> Sorted(VertexCount);
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        Sorted[i] = i;
+      }
+
+      auto Less = [&](uint32_t A, uint32_t B)
+      {
+        const glm::vec3& PA = pVertices[A].Position;
+        const glm::vec3& PB = pVertices[B].Position;
+
+        return (PA.x != PB.x) ? PA.x < PB.x : (PA.y != PB.y) ? PA.y < PB.y : PA.z < PB.z;
+      };
+
+      std::sort(Sorted.begin(), Sorted.end(), Less);
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        bool bSame = i > 0 && !Less(Sorted[i - 1], Sorted[i]) && !Less(Sorted[i], Sorted[i - 1]);
+
+        Wedge[Sorted[i]] = bSame ? Wedge[Sorted[i - 1]] : Sorted[i];
+      }
+    }
+
+    // collapsing a seam or border vertex would tear the surface open, they hold the outline in place
+    std::vector<bool> Locked(VertexCount, false);
+    {
+      std::vector<uint32_t> WedgeSize(VertexCount, 0);
+      std::vector<uint64_t> Edges;
+      Edges.reserve(TriangleCount * 3);
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        WedgeSize[Wedge[i]]++;
+      }
+
+      for(uint32_t t = 0; t < TriangleCount; t++)
+      {
+        for(uint32_t x = 0; x < 3; x++)
+        {
+          uint64_t A = Wedge[Indices[t * 3 + x]];
+          uint64_t B = Wedge[Indices[t * 3 + (x + 1) % 3]];
+
+          Edges.push_back((std::min(A, B) << 32) | std::max(A, B));
+        }
+      }
+
+      std::sort(Edges.begin(), Edges.end());
+
+      // a closed manifold surface has exactly two triangles on every edge
+      for(uint32_t i = 0; i < Edges.size();)
+      {
+        uint32_t Run = 1;
+
+        while(i + Run < Edges.size() && Edges[i + Run] == Edges[i])
+        {
+          Run++;
+        }
+
+        if(Run != 2)
+        {
+          WedgeSize[Edges[i] >> 32] = UINT32_MAX;
+          WedgeSize[Edges[i] & 0xFFFFFFFF] = UINT32_MAX;
+        }
+
+        i += Run;
+      }
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        Locked[i] = WedgeSize[Wedge[i]] != 1;
+      }
+    }
+
+    std::vector<Quadric> Quadrics(VertexCount);
+
+    for(uint32_t t = 0; t < TriangleCount; t++)
+    {
+      const glm::vec3& A = pVertices[Indices[t * 3 + 0]].Position;
+      const glm::vec3& B = pVertices[Indices[t * 3 + 1]].Position;
+      const glm::vec3& C = pVertices[Indices[t * 3 + 2]].Position;
+
+      glm::vec3 Cross = glm::cross(B - A, C - A);
+      float Length = glm::length(Cross);
+
+      if(!(Length > 0.f))
+      {
+        continue;
+      }
+
+      glm::vec3 Normal = Cross / Length;
+
+      Quadric Plane;
+      Plane.AddPlane(Normal, -glm::dot(Normal, A), Length * 0.5f);
+
+      for(uint32_t x = 0; x < 3; x++)
+      {
+        Quadrics[Indices[t * 3 + x]].Add(Plane);
+      }
+    }
+
+    struct Collapse
+    {
+      uint32_t From;
+      uint32_t To;
+      double Cost;
+    };
+
+    std::vector<Collapse> Collapses;
+    std::vector<uint32_t> AdjacencyStart(VertexCount + 1);
+    std::vector<uint32_t> Adjacency;
+    std::vector<uint32_t> Remap(VertexCount);
+    std::vector<bool> Touched(VertexCount);
+
+    float Error = 0.f;
+
+    // every pass collapses the cheapest edges that don't share a triangle with each other, then the candidates are redone
+    while(TriangleCount > TargetCount)
+    {
+      std::fill(AdjacencyStart.begin(), AdjacencyStart.end(), 0);
+      Adjacency.resize(TriangleCount * 3);
+
+      for(uint32_t i = 0; i < TriangleCount * 3; i++)
+      {
+        AdjacencyStart[Indices[i] + 1]++;
+      }
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        AdjacencyStart[i + 1] += AdjacencyStart[i];
+      }
+
+      {
+        std::vector<uint32_t> Fill(AdjacencyStart.begin(), AdjacencyStart.end() - 1);
+
+        for(uint32_t i = 0; i < TriangleCount * 3; i++)
+        {
+          Adjacency[Fill[Indices[i]]++] = i / 3;
+        }
+      }
+
+      Collapses.clear();
+
+      for(uint32_t v = 0; v < VertexCount; v++)
+      {
+        if(Locked[v])
+        {
+          continue;
+        }
+
+        Collapse Best{v, v, 0};
+
+        for(uint32_t a = AdjacencyStart[v]; a < AdjacencyStart[v + 1]; a++)
+        {
+          for(uint32_t x = 0; x < 3; x++)
+          {
+            uint32_t To = Indices[Adjacency[a] * 3 + x];
+
+            if(To == v)
+            {
+              continue;
+            }
+
+            Quadric Sum = Quadrics[v];
+            Sum.Add(Quadrics[To]);
+
+            double Cost = Sum.Eval(pVertices[To].Position);
+
+            if(Best.To == v || Cost < Best.Cost)
+            {
+              Best = {v, To, Cost};
+            }
+          }
+        }
+
+        if(Best.To != v)
+        {
+          Collapses.push_back(Best);
+        }
+      }
+
+      std::sort(Collapses.begin(), Collapses.end(), [](const Collapse& A, const Collapse& B) { return A.Cost < B.Cost; });
+
+      for(uint32_t i = 0; i < VertexCount; i++)
+      {
+        Remap[i] = i;
+        Touched[i] = false;
+      }
+
+      uint32_t Removed = 0;
+
+      for(uint32_t c = 0; c < Collapses.size() && TriangleCount - Removed > TargetCount; c++)
+      {
+        const Collapse& Curr = Collapses[c];
+
+        if(Touched[Curr.From] || Touched[Curr.To])
+        {
+          continue;
+        }
+
+        // the triangles around From that survive get dragged over to To, none of them may fold over
+        uint32_t Shared = 0;
+        bool bFlips = false;
+
+        for(uint32_t a = AdjacencyStart[Curr.From]; a < AdjacencyStart[Curr.From + 1] && !bFlips; a++)
+        {
+          const uint32_t* pTriangle = &Indices[Adjacency[a] * 3];
+
+          if(pTriangle[0] == Curr.To || pTriangle[1] == Curr.To || pTriangle[2] == Curr.To)
+          {
+            Shared++;
+            continue;
+          }
+
+          glm::vec3 Before[3];
+          glm::vec3 After[3];
+
+          for(uint32_t x = 0; x < 3; x++)
+          {
+            Before[x] = pVertices[pTriangle[x]].Position;
+            After[x] = pVertices[(pTriangle[x] == Curr.From) ? Curr.To : pTriangle[x]].Position;
+          }
+
+          glm::vec3 NormalBefore = glm::cross(Before[1] - Before[0], Before[2] - Before[0]);
+          glm::vec3 NormalAfter = glm::cross(After[1] - After[0], After[2] - After[0]);
+
+          bFlips = glm::dot(NormalBefore, NormalAfter) <= 0.25f * glm::length(NormalBefore) * glm::length(NormalAfter);
+        }
+
+        if(bFlips || Shared == 0)
+        {
+          continue;
+        }
+
+        Remap[Curr.From] = Curr.To;
+        Quadrics[Curr.To].Add(Quadrics[Curr.From]);
+        Error = std::max(Error, (float)std::sqrt(Curr.Cost));
+        Removed += Shared;
+
+        // every triangle around From changed, the candidates of its corners are stale until the next pass
+        for(uint32_t a = AdjacencyStart[Curr.From]; a < AdjacencyStart[Curr.From + 1]; a++)
+        {
+          for(uint32_t x = 0; x < 3; x++)
+          {
+            Touched[Indices[Adjacency[a] * 3 + x]] = true;
+          }
+        }
+      }
+
+      if(Removed == 0)
+      {
+        break;
+      }
+
+      // drop the triangles that lost a corner
+      uint32_t Out = 0;
+
+      for(uint32_t t = 0; t < TriangleCount; t++)
+      {
+        uint32_t A = Remap[Indices[t * 3 + 0]];
+        uint32_t B = Remap[Indices[t * 3 + 1]];
+        uint32_t C = Remap[Indices[t * 3 + 2]];
+
+        if(A == B || B == C || A == C)
+        {
+          continue;
+        }
+
+        Indices[Out++] = A;
+        Indices[Out++] = B;
+        Indices[Out++] = C;
+      }
+
+      Indices.resize(Out);
+      TriangleCount = Out / 3;
+    }
+
+    return Error;
+  }
+
+  void MeshOptimizer::BuildLods(const std::vector<Vertex>& Vertices, std::vector<uint32_t>& Indices, const std::vector<Ek::SubMesh>& SubMeshes, std::vector<Ek::SubMeshLod>& Lods)
+  {
+    Lods.clear();
+
+    // the last level built of every submesh, local to the submesh's vertices
+    std::vector<std::vector<uint32_t>> Level(SubMeshes.size());
+    std::vector<float> Errors(SubMeshes.size(), 0.f);
+    std::vector<uint32_t> Clusters;
+    uint64_t LevelCount = 0;
+
+    for(uint32_t s = 0; s < SubMeshes.size(); s++)
+    {
+      const Ek::SubMesh& Sub = SubMeshes[s];
+
+      Level[s].assign(Indices.begin() + Sub.FirstIndex, Indices.begin() + Sub.FirstIndex + (Sub.IndexCount - Sub.IndexCount % 3));
+
+      for(uint32_t i = 0; i < Level[s].size(); i++)
+      {
+        Level[s][i] -= Sub.FirstVertex;
+      }
+
+      LevelCount += Level[s].size() / 3;
+    }
+
+    for(uint32_t l = 0; l < MaxLods && LevelCount > 0; l++)
+    {
+      std::vector<std::vector<uint32_t>> Next = Level;
+      std::vector<float> NextErrors = Errors;
+      uint64_t NextCount = 0;
+
+      for(uint32_t s = 0; s < SubMeshes.size(); s++)
+      {
+        const Ek::SubMesh& Sub = SubMeshes[s];
+
+        // simplified from the level before, so the errors add up
+        NextErrors[s] += Simplify(Next[s], Vertices.data() + Sub.FirstVertex, Sub.VertexCount, (uint32_t)(Next[s].size() / 3 * LodRatio));
+
+        Tipsify(Next[s], Sub.VertexCount, Clusters);
+
+        NextCount += Next[s].size() / 3;
+      }
+
+      // not worth the index memory if it barely got any smaller, the next one wouldn't either
+      if(NextCount > LevelCount * LodMinReduction)
+      {
+        break;
+      }
+
+      for(uint32_t s = 0; s < SubMeshes.size(); s++)
+      {
+        Lods.push_back({(uint32_t)Indices.size(), (uint32_t)Next[s].size(), NextErrors[s]});
+
+        for(uint32_t i = 0; i < Next[s].size(); i++)
+        {
+          Indices.push_back(Next[s][i] + SubMeshes[s].FirstVertex);
+        }
+      }
+
+      Level.swap(Next);
+      Errors.swap(NextErrors);
+      LevelCount = NextCount;
+    }
+  }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "Mesh.h"
+
+namespace EkBackend
+{
+  /*
+    Reorders a freshly imported model for the gpu, each submesh on its own:
+     1. triangles for the post-transform vertex cache (Tipsify, Sander et al. 2007)
+     2. the clusters Tipsify ends on a dead end, outward facing ones first so they occlude the rest (Fast Triangle Reordering)
+     3. vertices in the order the indices first use them, so vertex fetch walks memory forward
+    BuildMeshlets then cuts the result into the clusters MeshletCuller culls, BuildLods simplifies it into levels of detail.
+    Step 2 is skipped for a submesh when it costs more than OverdrawThreshold of the cache gain from step 1.
+  */
+  class MeshOptimizer
+  {
+    public:
+      // average cache miss ratio, misses per triangle of a FIFO cache of CacheSize vertices
+      struct Stats
+      {
+        float AcmrBefore = 0.f;
+        float AcmrAfter = 0.f;
+      };
+
+      // SubMeshes' index and vertex ranges stay where they are, only what is inside them moves
+      static Stats Optimize(std::vector<Vertex>& Vertices, std::vector<uint32_t>& Indices, const std::vector<Ek::SubMesh>& SubMeshes);
+
+      static float GetAcmr(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount);
+
+      // appends up to MaxLods simplified copies of every submesh to Indices, each with about LodRatio of the triangles of the
+      // level before it. Stops once a level keeps more than LodMinReduction of them, uv/normal seams and open borders never move
+      static void BuildLods(const std::vector<Vertex>& Vertices, std::vector<uint32_t>& Indices, const std::vector<Ek::SubMesh>& SubMeshes, std::vector<Ek::SubMeshLod>& Lods);
+
+      // splits every submesh into Ek::Meshlets in index order, so run it after Optimize. Vertices gets model relative
+      // vertex indices, Triangles three local indices per triangle packed as a | b << 8 | c << 16
+      static void BuildMeshlets(const Vertex* pVertices, const uint32_t* pIndices, uint32_t VertexCount, const std::vector<Ek::SubMesh>& SubMeshes,
+        std::vector<Ek::Meshlet>& Meshlets, std::vector<uint32_t>& Vertices, std::vector<uint32_t>& Triangles);
+
+      static const uint32_t CacheSize = 16;
+      static constexpr float OverdrawThreshold = 1.05f;
+
+      static const uint32_t MaxLods = 4;
+      static constexpr float LodRatio = 0.5f;
+      static constexpr float LodMinReduction = 0.8f;
+
+    private:
+      static uint32_t CountMisses(const uint32_t* pIndices, uint32_t IndexCount, uint32_t VertexCount);
+
+      // indices are local to the submesh here, Clusters gets the first triangle of every cluster
+      static void Tipsify(std::vector<uint32_t>& Indices, uint32_t VertexCount, std::vector<uint32_t>& Clusters);
+      static void SortClusters(std::vector<uint32_t>& Indices, const Vertex* pVertices, const std::vector<uint32_t>& Clusters);
+      static void OptimizeFetch(std::vector<uint32_t>& Indices, Vertex* pVertices, uint32_t VertexCount);
+
+      // collapses vertices into one of their neighbours, cheapest quadric error first (Garland and Heckbert 1997), until
+      // Indices has at most TargetCount triangles or nothing can move anymore. Returns the largest error it introduced
+      static float Simplify(std::vector<uint32_t>& Indices, const Vertex* pVertices, uint32_t VertexCount, uint32_t TargetCount);
+
+      // sphere and normal cone of the meshlet that was just filled
+      static void ComputeBounds(Ek::Meshlet& Curr, const Vertex* pVertices, const std::vector<uint32_t>& Vertices, const std::vector<uint32_t>& Triangles);
+  };
+}
@@ -0,0 +1,379 @@
+#include "MeshletCull.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vulkan/vulkan_core.h>
+
+#include <glm/matrix.hpp>
+
+namespace EkBackend
+{
+  static const VkBufferUsageFlags DataUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  static const VkBufferUsageFlags OutputUsage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  // words in front of every mesh's indices, a VkDrawIndexedIndirectCommand padded to 32 bytes
+  static const uint32_t HeaderWords = 8;
+  static const uint32_t MeshletWords = sizeof(Ek::Meshlet) / sizeof(uint32_t);
+  static const uint32_t GroupSize = 64;
+
+  // same layout as the push constants in Shaders/MeshletCull.glsl
+  struct CullConstants
+  {
+    glm::vec4 Planes[6];
+    glm::vec3 CameraPos;
+    uint32_t MeshletCount;
+    uint32_t MeshletOffset;
+    uint32_t OutputOffset;
+  };
+
+  VkResult MeshletCuller::Init(VkDevice& inDevice, AllocateInterface* inAlloc, const char* ShaderPath, VkDeviceSize DataBytes, VkDeviceSize OutputBytes)
+  {
+    VkResult Err;
+
+    pDevice = &inDevice;
+    pAlloc = inAlloc;
+
+    DataBytes -= DataBytes % sizeof(uint32_t);
+    OutputBytes -= OutputBytes % sizeof(uint32_t);
+
+    DataBuffer.Category = Ek::eMemoryMesh;
+    OutputBuffer.Category = Ek::eMemoryMesh;
+
+    if((Err = pAlloc->CreateBuffer(DataBuffer, DataBytes, DataUsage)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    if((Err = pAlloc->CreateBuffer(OutputBuffer, OutputBytes, OutputUsage)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    pAlloc->AllocateBuffer(DataBuffer, Ek::eGpuOnly);
+    pAlloc->AllocateBuffer(OutputBuffer, Ek::eGpuOnly);
+
+    DataHeap.Init(DataBytes, 1);
+    OutputHeap.Init(OutputBytes, 1);
+
+    // Descriptors
+    {
+      VkDescriptorSetLayoutBinding Bindings[2]{};
+
+      for(uint32_t i = 0; i < 2; i++)
+      {
+        Bindings[i].binding = i;
+        Bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        Bindings[i].descriptorCount = 1;
+        Bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+      }
+
+      VkDescriptorSetLayoutCreateInfo LayoutCI{};
+      LayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      LayoutCI.bindingCount = 2;
+      LayoutCI.pBindings = Bindings;
+
+      if((Err = vkCreateDescriptorSetLayout(*pDevice, &LayoutCI, nullptr, &SetLayout)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+
+      VkDescriptorPoolSize Size{};
+      Size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      Size.descriptorCount = 2;
+
+      VkDescriptorPoolCreateInfo PoolCI{};
+      PoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      PoolCI.poolSizeCount = 1;
+      PoolCI.pPoolSizes = &Size;
+      PoolCI.maxSets = 1;
+
+      if((Err = vkCreateDescriptorPool(*pDevice, &PoolCI, nullptr, &Pool)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+
+      VkDescriptorSetAllocateInfo SetAI{};
+      SetAI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      SetAI.descriptorPool = Pool;
+      SetAI.descriptorSetCount = 1;
+      SetAI.pSetLayouts = &SetLayout;
+
+      if((Err = vkAllocateDescriptorSets(*pDevice, &SetAI, &Set)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+
+      VkDescriptorBufferInfo BufferInfos[2]{};
+      BufferInfos[0].buffer = DataBuffer.Buffer;
+      BufferInfos[0].range = VK_WHOLE_SIZE;
+      BufferInfos[1].buffer = OutputBuffer.Buffer;
+      BufferInfos[1].range = VK_WHOLE_SIZE;
+
+      VkWriteDescriptorSet Writes[2]{};
+
+      for(uint32_t i = 0; i < 2; i++)
+      {
+        Writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        Writes[i].dstSet = Set;
+        Writes[i].dstBinding = i;
+        Writes[i].descriptorCount = 1;
+        Writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        Writes[i].pBufferInfo = &BufferInfos[i];
+      }
+
+      vkUpdateDescriptorSets(*pDevice, 2, Writes, 0, nullptr);
+    }
+
+    // Pipeline
+    {
+      VkPushConstantRange Range{};
+      Range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+      Range.size = sizeof(CullConstants);
+
+      VkPipelineLayoutCreateInfo LayoutCI{};
+      LayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+      LayoutCI.setLayoutCount = 1;
+      LayoutCI.pSetLayouts = &SetLayout;
+      LayoutCI.pushConstantRangeCount = 1;
+      LayoutCI.pPushConstantRanges = &Range;
+
+      if((Err = vkCreatePipelineLayout(*pDevice, &LayoutCI, nullptr, &PipelineLayout)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+
+      std::ifstream File(ShaderPath, std::ifstream::binary);
+
+      if(!File.is_open())
+      {
+        return VK_ERROR_INITIALIZATION_FAILED;
+      }
+
+      File.seekg(0, std::ifstream::end);
+      uint32_t FileSize = File.tellg();
+
+      std::vector<uint32_t> ShaderCode((FileSize + 3) / sizeof(uint32_t));
+
+      File.seekg(0, std::ifstream::beg);
+      File.read((char*)ShaderCode.data(), FileSize);
+
+      VkShaderModuleCreateInfo ModuleCI{};
+      ModuleCI.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      ModuleCI.codeSize = FileSize;
+      ModuleCI.pCode = ShaderCode.data();
+
+      VkShaderModule Module;
+
+      if((Err = vkCreateShaderModule(*pDevice, &ModuleCI, nullptr, &Module)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+
+      VkComputePipelineCreateInfo PipelineCI{};
+      PipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      PipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      PipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      PipelineCI.stage.module = Module;
+      PipelineCI.stage.pName = "main";
+      PipelineCI.layout = PipelineLayout;
+
+      Err = vkCreateComputePipelines(*pDevice, VK_NULL_HANDLE, 1, &PipelineCI, nullptr, &Pipeline);
+
+      vkDestroyShaderModule(*pDevice, Module, nullptr);
+
+      if(Err != VK_SUCCESS)
+      {
+        return Err;
+      }
+    }
+
+    return VK_SUCCESS;
+  }
+
+  void MeshletCuller::Destroy()
+  {
+    if(SetLayout == VK_NULL_HANDLE)
+    {
+      return;
+    }
+
+    vkDestroyPipeline(*pDevice, Pipeline, nullptr);
+    vkDestroyPipelineLayout(*pDevice, PipelineLayout, nullptr);
+    vkDestroyDescriptorPool(*pDevice, Pool, nullptr);
+    vkDestroyDescriptorSetLayout(*pDevice, SetLayout, nullptr);
+
+    Pipeline = VK_NULL_HANDLE;
+    PipelineLayout = VK_NULL_HANDLE;
+    Pool = VK_NULL_HANDLE;
+    Set = VK_NULL_HANDLE;
+    SetLayout = VK_NULL_HANDLE;
+
+    DataBuffer.Destroy();
+    OutputBuffer.Destroy();
+
+    DataHeap.Destroy();
+    OutputHeap.Destroy();
+  }
+
+  Ek::MeshletRange MeshletCuller::Add(const std::vector<Ek::Meshlet>& Meshlets, const std::vector<uint32_t>& Vertices, const std::vector<uint32_t>& Triangles, uint32_t IndexCount, int32_t VertexOffset)
+  {
+    Ek::MeshletRange Ret;
+
+    if(Meshlets.empty())
+    {
+      return Ret;
+    }
+
+    uint32_t DataWords = Meshlets.size() * MeshletWords + Vertices.size() + Triangles.size();
+
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if((Ret.pData = DataHeap.Allocate((VkDeviceSize)DataWords * sizeof(uint32_t), sizeof(uint32_t), true)) == nullptr)
+    {
+      throw std::runtime_error("failed to allocate " + std::to_string(DataWords * sizeof(uint32_t)) + " bytes of meshlet data, the culler is full");
+    }
+
+    if((Ret.pOutput = OutputHeap.Allocate((VkDeviceSize)(HeaderWords + IndexCount) * sizeof(uint32_t), HeaderWords * sizeof(uint32_t), true)) == nullptr)
+    {
+      DataHeap.Free(Ret.pData);
+      throw std::runtime_error("failed to allocate " + std::to_string((HeaderWords + IndexCount) * sizeof(uint32_t)) + " bytes of culled indices, the culler is full");
+    }
+
+    Ret.MeshletOffset = Ret.pData->Start / sizeof(uint32_t);
+    Ret.MeshletCount = Meshlets.size();
+    Ret.OutputOffset = Ret.pOutput->Start / sizeof(uint32_t);
+    Ret.VertexOffset = VertexOffset;
+
+    // the shader only sees one big array of words, so the meshlets point at their lists with absolute offsets
+    uint32_t VertexBase = Ret.MeshletOffset + Meshlets.size() * MeshletWords;
+    uint32_t TriangleBase = VertexBase + Vertices.size();
+
+    std::vector<uint32_t> Words(DataWords);
+    Ek::Meshlet* pMeshlets = (Ek::Meshlet*)Words.data();
+
+    for(uint32_t i = 0; i < Meshlets.size(); i++)
+    {
+      pMeshlets[i] = Meshlets[i];
+      pMeshlets[i].VertexOffset += VertexBase;
+      pMeshlets[i].TriangleOffset += TriangleBase;
+    }
+
+    std::copy(Vertices.begin(), Vertices.end(), Words.begin() + Meshlets.size() * MeshletWords);
+    std::copy(Triangles.begin(), Triangles.end(), Words.begin() + Meshlets.size() * MeshletWords + Vertices.size());
+
+    pAlloc->UploadBuffer(DataBuffer, Words.data(), Words.size() * sizeof(uint32_t), Ret.pData->Start);
+
+    return Ret;
+  }
+
+  void MeshletCuller::Remove(Ek::MeshletRange& Range)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    if(Range.pData != nullptr)
+    {
+      DataHeap.Free(Range.pData);
+    }
+
+    if(Range.pOutput != nullptr)
+    {
+      OutputHeap.Free(Range.pOutput);
+    }
+
+    Range = Ek::MeshletRange();
+  }
+
+  void MeshletCuller::Cull(VkCommandBuffer cmdBuffer, const std::vector<Ek::MeshletRange*>& Ranges, const glm::mat4& World, const glm::mat4& View, const glm::mat4& Projection)
+  {
+    CullConstants Constants;
+
+    // planes of vulkan's clip volume (-w <= x, y <= w, 0 <= z <= w) pulled back into model space, inside is dot(Plane, Pos) >= 0
+    {
+      glm::mat4 Clip = glm::transpose(Projection * View * World);
+
+      Constants.Planes[0] = Clip[3] + Clip[0];
+      Constants.Planes[1] = Clip[3] - Clip[0];
+      Constants.Planes[2] = Clip[3] + Clip[1];
+      Constants.Planes[3] = Clip[3] - Clip[1];
+      Constants.Planes[4] = Clip[2];
+      Constants.Planes[5] = Clip[3] - Clip[2];
+
+      // normalized so the shader can compare against a radius
+      for(uint32_t i = 0; i < 6; i++)
+      {
+        float Length = glm::length(glm::vec3(Constants.Planes[i]));
+
+        if(Length > 0.f)
+        {
+          Constants.Planes[i] /= Length;
+        }
+      }
+
+      Constants.CameraPos = glm::vec3(glm::inverse(View * World) * glm::vec4(0.f, 0.f, 0.f, 1.f));
+    }
+
+    VkMemoryBarrier Barrier{};
+    Barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+
+    // last frame's draws are done with the output before we reset it
+    Barrier.srcAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    Barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+
+    // no triangles yet, the shader counts them up
+    for(uint32_t i = 0; i < Ranges.size(); i++)
+    {
+      const Ek::MeshletRange& Range = *Ranges[i];
+
+      if(Range.pOutput == nullptr)
+      {
+        continue;
+      }
+
+      uint32_t Header[HeaderWords] = {0, 1, Range.OutputOffset + HeaderWords, (uint32_t)Range.VertexOffset, 0, 0, 0, 0};
+
+      vkCmdUpdateBuffer(cmdBuffer, OutputBuffer.Buffer, Range.pOutput->Start, sizeof(Header), Header);
+    }
+
+    Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, Pipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, PipelineLayout, 0, 1, &Set, 0, nullptr);
+
+    for(uint32_t i = 0; i < Ranges.size(); i++)
+    {
+      Ek::MeshletRange& Range = *Ranges[i];
+
+      if(Range.pOutput == nullptr)
+      {
+        continue;
+      }
+
+      Constants.MeshletCount = Range.MeshletCount;
+      Constants.MeshletOffset = Range.MeshletOffset;
+      Constants.OutputOffset = Range.OutputOffset;
+
+      vkCmdPushConstants(cmdBuffer, PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Constants), &Constants);
+      vkCmdDispatch(cmdBuffer, (Range.MeshletCount + GroupSize - 1) / GroupSize, 1, 1);
+
+      Range.bCulled = true;
+    }
+
+    Barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    Barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+  }
+
+  void MeshletCuller::Draw(VkCommandBuffer cmdBuffer, const Ek::MeshletRange& Range)
+  {
+    vkCmdBindIndexBuffer(cmdBuffer, OutputBuffer.Buffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdDrawIndexedIndirect(cmdBuffer, OutputBuffer.Buffer, Range.pOutput->Start, 1, sizeof(VkDrawIndexedIndirectCommand));
+  }
+}
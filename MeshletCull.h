@@ -0,0 +1,92 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+
+namespace Ek
+{
+  // up to MaxVertices vertices and MaxTriangles triangles of one submesh, laid out the way Shaders/MeshletCull.glsl reads it
+  struct Meshlet
+  {
+    static const uint32_t MaxVertices = 64;
+    static const uint32_t MaxTriangles = 124;
+
+    // model space bounding sphere, xyz center and w radius
+    glm::vec4 Sphere = glm::vec4(0.f);
+    // every triangle faces away from a camera with dot(Center - Camera, Axis) >= Cutoff * length(Center - Camera) + Radius.
+    // xyz axis and w cutoff, a cutoff of 1 never culls
+    glm::vec4 Cone = glm::vec4(0.f, 0.f, 0.f, 1.f);
+
+    // into the mesh's meshlet vertex list (model relative vertex indices) and triangle list (three 8 bit local indices each)
+    uint32_t VertexOffset = 0;
+    uint32_t TriangleOffset = 0;
+    uint32_t VertexCount = 0;
+    uint32_t TriangleCount = 0;
+  };
+
+  // a mesh's meshlets in the culler, offsets are in 32 bit words
+  struct MeshletRange
+  {
+    uint32_t MeshletOffset = 0;
+    uint32_t MeshletCount = 0;
+    // the indirect draw command, the compacted indices follow it
+    uint32_t OutputOffset = 0;
+    int32_t VertexOffset = 0;
+
+    EkBackend::MemHeader* pData = nullptr;
+    EkBackend::MemHeader* pOutput = nullptr;
+
+    // the output is garbage until the first Cull that covered this range
+    bool bCulled = false;
+  };
+}
+
+namespace EkBackend
+{
+  /*
+    Culls meshlets on the gpu and draws what survives.
+    Cull runs one compute invocation per meshlet, it tests the bounding sphere against the frustum and the normal cone
+    against the camera, then appends the surviving triangles to the mesh's output range as 32 bit indices and bumps the
+    index count of the mesh's VkDrawIndexedIndirectCommand. Draw binds the output as index buffer and draws indirect.
+    Only core vulkan 1.0 (storage buffers, atomics, vkCmdDrawIndexedIndirect), so it runs on software rasterizers like lavapipe.
+    The buffers have a fixed size, Add throws once they're full.
+  */
+  class MeshletCuller
+  {
+    public:
+      VkResult Init(VkDevice& inDevice, AllocateInterface* inAlloc, const char* ShaderPath, VkDeviceSize DataBytes, VkDeviceSize OutputBytes);
+      void Destroy();
+
+      // uploads through the allocator's upload queue, take the upload token after this to know when it can be culled
+      Ek::MeshletRange Add(const std::vector<Ek::Meshlet>& Meshlets, const std::vector<uint32_t>& Vertices, const std::vector<uint32_t>& Triangles, uint32_t IndexCount, int32_t VertexOffset);
+      void Remove(Ek::MeshletRange& Range);
+
+      // outside a renderpass. Every range shares WorldViewProj, the meshlets are in model space and Camera.World places all of them
+      void Cull(VkCommandBuffer cmdBuffer, const std::vector<Ek::MeshletRange*>& Ranges, const glm::mat4& World, const glm::mat4& View, const glm::mat4& Projection);
+      // leaves the output bound as index buffer, whoever draws next out of the geometry arena rebinds it
+      void Draw(VkCommandBuffer cmdBuffer, const Ek::MeshletRange& Range);
+
+    private:
+      VkDevice* pDevice;
+      AllocateInterface* pAlloc;
+
+      std::mutex Lock;
+
+      Ek::Buffer DataBuffer;
+      Ek::Buffer OutputBuffer;
+
+      TlsfHeap DataHeap;
+      TlsfHeap OutputHeap;
+
+      VkDescriptorSetLayout SetLayout = VK_NULL_HANDLE;
+      VkDescriptorPool Pool = VK_NULL_HANDLE;
+      VkDescriptorSet Set = VK_NULL_HANDLE;
+      VkPipelineLayout PipelineLayout = VK_NULL_HANDLE;
+      VkPipeline Pipeline = VK_NULL_HANDLE;
+  };
+}
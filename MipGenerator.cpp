@@ -0,0 +1,141 @@
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "MipGenerator.h"
+
+namespace EkBackend
+{
+  uint32_t MipGenerator::GetLevelCount(VkExtent2D Extent)
+  {
+    uint32_t Largest = std::max(Extent.width, Extent.height);
+    uint32_t Levels = 1;
+
+    while(Largest > 1)
+    {
+      Largest >>= 1;
+      Levels++;
+    }
+
+    return Levels;
+  }
+
+  VkExtent2D MipGenerator::GetExtent(VkExtent2D Extent, uint32_t Level)
+  {
+    return VkExtent2D{std::max(Extent.width >> Level, 1u), std::max(Extent.height >> Level, 1u)};
+  }
+
+  bool MipGenerator::IsBlockCompressed(VkFormat Format)
+  {
+    return Format == VK_FORMAT_BC7_UNORM_BLOCK || Format == VK_FORMAT_BC5_UNORM_BLOCK;
+  }
+
+  uint32_t MipGenerator::GetBlockSize(VkFormat Format)
+  {
+    return IsBlockCompressed(Format) ? 4 : 1;
+  }
+
+  uint32_t MipGenerator::GetBlockBytes(VkFormat Format)
+  {
+    return IsBlockCompressed(Format) ? 16 : 4;
+  }
+
+  size_t MipGenerator::GetOffset(const Ek::ImageData& Image, uint32_t Level)
+  {
+    size_t Offset = 0;
+
+    for(uint32_t i = 0; i < Level; i++)
+    {
+      Offset += (size_t)GetRowPitch(Image, i) * GetRowCount(Image, i);
+    }
+
+    return Offset;
+  }
+
+  uint32_t MipGenerator::GetRowPitch(const Ek::ImageData& Image, uint32_t Level)
+  {
+    uint32_t Block = GetBlockSize(Image.Format);
+
+    return (Level == 0) ? Image.RowPitch : (GetExtent(Image.Extent, Level).width + Block - 1) / Block * GetBlockBytes(Image.Format);
+  }
+
+  uint32_t MipGenerator::GetRowCount(const Ek::ImageData& Image, uint32_t Level)
+  {
+    uint32_t Block = GetBlockSize(Image.Format);
+
+    return (GetExtent(Image.Extent, Level).height + Block - 1) / Block;
+  }
+
+  void MipGenerator::Generate(Ek::ImageData& Image)
+  {
+    uint32_t Levels = GetLevelCount(Image.Extent);
+
+    if(Image.MipLevels >= Levels || Image.Format != VK_FORMAT_R8G8B8A8_UNORM)
+    {
+      return;
+    }
+
+    // grown once up front, the pointers below would dangle otherwise
+    Image.Pixels.resize(GetOffset(Image, Levels));
+
+    for(uint32_t Level = Image.MipLevels; Level < Levels; Level++)
+    {
+      Downsample(Image.Pixels.data() + GetOffset(Image, Level - 1), GetRowPitch(Image, Level - 1), GetExtent(Image.Extent, Level - 1),
+                 Image.Pixels.data() + GetOffset(Image, Level), GetExtent(Image.Extent, Level));
+    }
+
+    Image.MipLevels = Levels;
+  }
+
+  void MipGenerator::Downsample(const uint8_t* pSrc, uint32_t SrcPitch, VkExtent2D SrcExtent, uint8_t* pDst, VkExtent2D DstExtent)
+  {
+    // boxes that have both of their columns, a 1 texel wide source repeats its only one
+    uint32_t FullBoxes = std::min(DstExtent.width, SrcExtent.width / 2);
+
+    for(uint32_t y = 0; y < DstExtent.height; y++)
+    {
+      const uint8_t* pRow0 = pSrc + (size_t)std::min(y * 2, SrcExtent.height - 1) * SrcPitch;
+      const uint8_t* pRow1 = pSrc + (size_t)std::min(y * 2 + 1, SrcExtent.height - 1) * SrcPitch;
+      uint8_t* pOut = pDst + (size_t)y * DstExtent.width * 4;
+
+      uint32_t x = 0;
+
+#ifdef __SSE2__
+      const __m128i Zero = _mm_setzero_si128();
+      const __m128i Round = _mm_set1_epi16(2);
+
+      // 4 source texels of both rows make 2 output texels, summed in 16 bits
+      for(; x + 2 <= FullBoxes; x += 2)
+      {
+        __m128i Top = _mm_loadu_si128((const __m128i*)(pRow0 + x * 8));
+        __m128i Bottom = _mm_loadu_si128((const __m128i*)(pRow1 + x * 8));
+
+        __m128i Left = _mm_add_epi16(_mm_unpacklo_epi8(Top, Zero), _mm_unpacklo_epi8(Bottom, Zero));
+        __m128i Right = _mm_add_epi16(_mm_unpackhi_epi8(Top, Zero), _mm_unpackhi_epi8(Bottom, Zero));
+
+        // each half holds one column, fold the second onto the first
+        Left = _mm_add_epi16(Left, _mm_srli_si128(Left, 8));
+        Right = _mm_add_epi16(Right, _mm_srli_si128(Right, 8));
+
+        __m128i Sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(Left, Right), Round), 2);
+
+        _mm_storel_epi64((__m128i*)(pOut + x * 4), _mm_packus_epi16(Sum, Sum));
+      }
+#endif
+
+      for(; x < DstExtent.width; x++)
+      {
+        uint32_t x0 = std::min(x * 2, SrcExtent.width - 1);
+        uint32_t x1 = std::min(x * 2 + 1, SrcExtent.width - 1);
+
+        for(uint32_t c = 0; c < 4; c++)
+        {
+          uint32_t Sum = pRow0[x0 * 4 + c] + pRow0[x1 * 4 + c] + pRow1[x0 * 4 + c] + pRow1[x1 * 4 + c];
+          pOut[x * 4 + c] = (uint8_t)((Sum + 2) >> 2);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Memory.h"
+
+namespace EkBackend
+{
+  /*
+    Mip chains for Ek::ImageData on the cpu, and where each level lives in it. Each level is a 2x2 box filter of the one
+    above it, rounding down odd sizes like vkCmdBlitImage does. Used when the texture's format can't be blitted with a
+    linear filter, LoadImage has the upload queue blit the chain on the graphics side otherwise.
+    The downsampler does two texels at a time with SSE2 where we have it.
+  */
+  class MipGenerator
+  {
+    public:
+      // full chain down to 1x1
+      static uint32_t GetLevelCount(VkExtent2D Extent);
+      static VkExtent2D GetExtent(VkExtent2D Extent, uint32_t Level);
+
+      // the BC formats TextureCooker makes are 4x4 blocks of 16 bytes, everything else we load is 4 byte texels
+      static bool IsBlockCompressed(VkFormat Format);
+      static uint32_t GetBlockSize(VkFormat Format);
+      static uint32_t GetBlockBytes(VkFormat Format);
+
+      // a row is a row of blocks. Level 0 has Image.RowPitch bytes per row, the levels after it are tightly packed right behind it
+      static size_t GetOffset(const Ek::ImageData& Image, uint32_t Level);
+      static uint32_t GetRowPitch(const Ek::ImageData& Image, uint32_t Level);
+      static uint32_t GetRowCount(const Ek::ImageData& Image, uint32_t Level);
+
+      // appends every level an RGBA8 Image doesn't have yet
+      static void Generate(Ek::ImageData& Image);
+
+    private:
+      static void Downsample(const uint8_t* pSrc, uint32_t SrcPitch, VkExtent2D SrcExtent, uint8_t* pDst, VkExtent2D DstExtent);
+  };
+}
@@ -23,7 +23,7 @@ namespace Ek
     vkCmdBindPipeline(cmdBuffer.Buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipeline);
   }
 
-  VkResult PipelineInterface::Init(VkDevice& Device, Material& Mat, Wrappers::FrameBufferAttachment* FrameBufferAttachments, uint32_t FrameBufferAttachmentCount, VkOffset2D Offset, VkExtent2D Resolution, VkRenderPass& RenderPass, uint32_t Subpass, bool bDepthEnable)
+  VkResult PipelineInterface::Init(VkDevice& Device, Material& Mat, Wrappers::FrameBufferAttachment* FrameBufferAttachments, uint32_t FrameBufferAttachmentCount, VkOffset2D Offset, VkExtent2D Resolution, VkRenderPass& RenderPass, uint32_t Subpass, bool bDepthEnable, Ek::eVertexFormat VertexFormat)
   {
     VkResult Err;
 
@@ -77,8 +77,8 @@ namespace Ek
 
     // 2. Vertices
 
-    std::vector<VkVertexInputAttributeDescription> Attributes = Vertex::GetAttributes();
-    std::vector<VkVertexInputBindingDescription> Binding = Vertex::GetBinding();
+    std::vector<VkVertexInputAttributeDescription> Attributes = Vertex::GetAttributes(VertexFormat);
+    std::vector<VkVertexInputBindingDescription> Binding = Vertex::GetBinding(VertexFormat);
     VkPipelineVertexInputStateCreateInfo InputState{};
 
     {
@@ -14,6 +14,11 @@ namespace Ek
         case eRGBA:
           if(DatType & uNorm)
           {
+            if(DatType & Compressed)
+            {
+              Desired.push_back(VK_FORMAT_BC7_UNORM_BLOCK);
+            }
+
             Desired.push_back(VK_FORMAT_R8G8B8A8_UNORM);
             Desired.push_back(VK_FORMAT_R16G16B16A16_UNORM);
           }
@@ -158,6 +163,11 @@ namespace Ek
         case eRG:
           if(DatType & uNorm)
           {
+            if(DatType & Compressed)
+            {
+              Desired.push_back(VK_FORMAT_BC5_UNORM_BLOCK);
+            }
+
             Desired.push_back(VK_FORMAT_R8G8_UNORM);
           }
           else if(DatType & sNorm)
@@ -0,0 +1,78 @@
+#version 440
+#pragma shader_stage(compute)
+
+// one invocation per meshlet, see EkBackend::MeshletCuller. Everything is in the mesh's model space
+
+layout(local_size_x = 64) in;
+
+// Ek::Meshlet back to back, then each mesh's vertex and triangle lists. Offsets are absolute
+layout(set = 0, binding = 0) readonly buffer DataBuffer
+{
+  uint Words[];
+} Data;
+
+// per mesh a VkDrawIndexedIndirectCommand padded to 8 words, then its surviving indices
+layout(set = 0, binding = 1) buffer OutputBuffer
+{
+  uint Words[];
+} Out;
+
+layout(push_constant) uniform CullBuffer
+{
+  vec4 Planes[6];
+  vec3 CameraPos;
+  uint MeshletCount;
+  uint MeshletOffset;
+  uint OutputOffset;
+} Cull;
+
+const uint MeshletWords = 12;
+const uint HeaderWords = 8;
+
+void main()
+{
+  uint Id = gl_GlobalInvocationID.x;
+
+  if(Id >= Cull.MeshletCount)
+  {
+    return;
+  }
+
+  uint Base = Cull.MeshletOffset + Id * MeshletWords;
+
+  vec4 Sphere = vec4(uintBitsToFloat(Data.Words[Base + 0]), uintBitsToFloat(Data.Words[Base + 1]), uintBitsToFloat(Data.Words[Base + 2]), uintBitsToFloat(Data.Words[Base + 3]));
+  vec4 Cone = vec4(uintBitsToFloat(Data.Words[Base + 4]), uintBitsToFloat(Data.Words[Base + 5]), uintBitsToFloat(Data.Words[Base + 6]), uintBitsToFloat(Data.Words[Base + 7]));
+
+  uint VertexOffset = Data.Words[Base + 8];
+  uint TriangleOffset = Data.Words[Base + 9];
+  uint TriangleCount = Data.Words[Base + 11];
+
+  // completely outside one of the planes
+  for(uint i = 0; i < 6; i++)
+  {
+    if(dot(Cull.Planes[i].xyz, Sphere.xyz) + Cull.Planes[i].w < -Sphere.w)
+    {
+      return;
+    }
+  }
+
+  // every triangle faces away from the camera
+  vec3 ToCenter = Sphere.xyz - Cull.CameraPos;
+
+  if(dot(ToCenter, Cone.xyz) >= Cone.w * length(ToCenter) + Sphere.w)
+  {
+    return;
+  }
+
+  uint First = atomicAdd(Out.Words[Cull.OutputOffset], TriangleCount * 3);
+  uint Dst = Cull.OutputOffset + HeaderWords + First;
+
+  for(uint t = 0; t < TriangleCount; t++)
+  {
+    uint Triangle = Data.Words[TriangleOffset + t];
+
+    Out.Words[Dst + t * 3 + 0] = Data.Words[VertexOffset + (Triangle & 0xFF)];
+    Out.Words[Dst + t * 3 + 1] = Data.Words[VertexOffset + ((Triangle >> 8) & 0xFF)];
+    Out.Words[Dst + t * 3 + 2] = Data.Words[VertexOffset + ((Triangle >> 16) & 0xFF)];
+  }
+}
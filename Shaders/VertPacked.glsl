@@ -0,0 +1,52 @@
+#version 440
+#pragma shader_stage(vertex)
+
+// Vert.glsl for the packed vertex formats, see Ek::eVertexFormat
+
+// float3 or unorm16x4 across the mesh bounds, Dequant turns it back into model space
+layout(location = 0) in vec3 inPos;
+// octahedral snorm16x2
+layout(location = 1) in vec2 inNorm;
+// half2, widened by the vertex fetch
+layout(location = 2) in vec2 inCoord;
+
+layout(set = 0, binding = 0) uniform CameraBuffer
+{
+  mat4 World;
+  mat4 View;
+  mat4 Projection;
+  mat4 Normal;
+} Camera;
+
+// the fragment stage owns the first 16 bytes
+layout(push_constant) uniform DequantBuffer
+{
+  layout(offset = 16) vec4 Scale;
+  vec4 Bias;
+} Dequant;
+
+layout(location = 0) out vec3 outPos;
+layout(location = 1) out vec3 outNorm;
+layout(location = 2) out vec2 outCoord;
+
+vec3 OctDecode(vec2 Oct)
+{
+  vec3 Normal = vec3(Oct, 1.f - abs(Oct.x) - abs(Oct.y));
+
+  float Fold = max(-Normal.z, 0.f);
+  Normal.x += (Normal.x >= 0.f) ? -Fold : Fold;
+  Normal.y += (Normal.y >= 0.f) ? -Fold : Fold;
+
+  return normalize(Normal);
+}
+
+void main()
+{
+  vec3 Pos = inPos * Dequant.Scale.xyz + Dequant.Bias.xyz;
+
+  gl_Position = Camera.Projection * Camera.View * Camera.World * vec4(Pos, 1.f);
+
+  outPos = (Camera.World * vec4(Pos, 1.f)).xyz;
+  outNorm = (Camera.World * vec4(OctDecode(inNorm), 0.f)).xyz;
+  outCoord = inCoord;
+}
@@ -0,0 +1,204 @@
+#include "Staging.h"
+
+#include <stdexcept>
+#include <vulkan/vulkan_core.h>
+
+namespace EkBackend
+{
+  VkResult StagingRing::Init(VkDevice& inDevice, AllocateInterface* pAlloc, VkQueue& Queue, VkCommandPool& Pool, uint32_t inSize)
+  {
+    VkResult Err;
+
+    pDevice = &inDevice;
+    Size = inSize;
+    ChunkSize = Size / SlotCount;
+
+    if((Err = pAlloc->CreateBuffer(Buffer, Size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    pAlloc->AllocateBuffer(Buffer, Ek::eUpload);
+    Buffer.Map((void**)&Mapped);
+
+    for(uint32_t i = 0; i < SlotCount; i++)
+    {
+      if((Err = Slots[i].Cmd.Allocate(inDevice, Queue, Pool, Ek::eTransfer)) != VK_SUCCESS)
+      {
+        return Err;
+      }
+    }
+
+    return VK_SUCCESS;
+  }
+
+  void StagingRing::Destroy()
+  {
+    Flush();
+
+    for(uint32_t i = 0; i < SlotCount; i++)
+    {
+      Slots[i].Cmd.Delete();
+    }
+
+    Buffer.Destroy();
+  }
+
+  void* StagingRing::Acquire(uint32_t ReqSize, uint32_t Alignment, VkDeviceSize& Offset)
+  {
+    if(ReqSize > Size)
+    {
+      throw std::runtime_error("staging request of " + std::to_string(ReqSize) + " bytes is larger than the staging ring");
+    }
+
+    Reclaim();
+
+    // don't let one submission hold too much of the ring, we'd have to wait on it as soon as we wrap around
+    if(BatchBytes > 0 && BatchBytes + ReqSize > ChunkSize)
+    {
+      Submit();
+    }
+
+    while(true)
+    {
+      if(Pending.empty() && BatchBytes == 0)
+      {
+        Head = 0;
+        Tail = 0;
+      }
+
+      uint32_t Start = ((Head + Alignment - 1) / Alignment) * Alignment;
+      bool bFits = false;
+
+      if(Head >= Tail)
+      {
+        if(Start + ReqSize <= Size)
+        {
+          bFits = true;
+        }
+        // wrap around, the space between the head and the end of the ring is skipped
+        else if(ReqSize < Tail)
+        {
+          Start = 0;
+          bFits = true;
+        }
+      }
+      else if(Start + ReqSize < Tail)
+      {
+        bFits = true;
+      }
+
+      if(bFits)
+      {
+        Head = Start + ReqSize;
+        BatchBytes += ReqSize;
+
+        Offset = Start;
+        return Mapped + Start;
+      }
+
+      // the space we're waiting for might still be in the submission we're recording
+      if(Pending.empty())
+      {
+        Submit();
+      }
+
+      WaitOldest();
+    }
+  }
+
+  VkCommandBuffer StagingRing::GetCommand()
+  {
+    if(!Slots[Current].bRecording)
+    {
+      Slots[Current].Cmd.BeginCommand();
+      Slots[Current].bRecording = true;
+    }
+
+    return Slots[Current].Cmd.Buffer;
+  }
+
+  void StagingRing::Submit()
+  {
+    if(!Slots[Current].bRecording)
+    {
+      if(BatchBytes == 0)
+      {
+        return;
+      }
+
+      // space was handed out but nothing recorded, we still need a fence to know when it can be reused
+      GetCommand();
+    }
+
+    Buffer.Flush();
+
+    Slots[Current].Cmd.EndComand();
+    Slots[Current].End = Head;
+    Slots[Current].Serial = Serial++;
+    Slots[Current].bRecording = false;
+
+    Pending.push_back(Current);
+    BatchBytes = 0;
+
+    // slots are used round robin, so the next one is the oldest if it's still in flight
+    Current = (Current + 1) % SlotCount;
+
+    while(!Pending.empty() && Pending.front() == Current)
+    {
+      WaitOldest();
+    }
+  }
+
+  void StagingRing::WaitOldest()
+  {
+    uint32_t Oldest = Pending.front();
+    Pending.pop_front();
+
+    Slots[Oldest].Cmd.FenceWait();
+    Tail = Slots[Oldest].End;
+    Completed = Slots[Oldest].Serial;
+  }
+
+  void StagingRing::Reclaim()
+  {
+    while(!Pending.empty() && vkGetFenceStatus(*pDevice, Slots[Pending.front()].Cmd.Fence) == VK_SUCCESS)
+    {
+      WaitOldest();
+    }
+  }
+
+  void StagingRing::Flush()
+  {
+    Submit();
+
+    while(!Pending.empty())
+    {
+      WaitOldest();
+    }
+  }
+
+  uint64_t StagingRing::GetSerial()
+  {
+    // nothing recorded yet, so everything so far is covered by the last submission
+    if(!Slots[Current].bRecording && BatchBytes == 0)
+    {
+      return Serial - 1;
+    }
+
+    return Serial;
+  }
+
+  void StagingRing::WaitFor(uint64_t inSerial)
+  {
+    if(inSerial >= Serial)
+    {
+      Submit();
+    }
+
+    while(Completed < inSerial && !Pending.empty())
+    {
+      WaitOldest();
+    }
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <deque>
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+#include "Wrappers.h"
+
+namespace EkBackend
+{
+  /*
+    A ring of host visible memory that uploads are streamed through.
+    Acquire hands out space at the head, every submission remembers where the head was when it went out,
+    and the tail catches up to that point once the submission's fence has signaled.
+    Uploads bigger than ChunkSize should be split up by the caller, so the cpu can fill one chunk while the last one is copied.
+  */
+  class StagingRing
+  {
+    public:
+      VkResult Init(VkDevice& inDevice, AllocateInterface* pAlloc, VkQueue& Queue, VkCommandPool& Pool, uint32_t inSize);
+      void Destroy();
+
+      // Size bytes of mapped memory, waits on older submissions if the ring is full. Offset is relative to GetBuffer().
+      // this can submit the current command buffer, so fetch GetCommand() after calling it
+      void* Acquire(uint32_t Size, uint32_t Alignment, VkDeviceSize& Offset);
+
+      // command buffer of the current submission, copies out of the ring get recorded here
+      VkCommandBuffer GetCommand();
+      Ek::Buffer& GetBuffer() { return Buffer; }
+
+      // sends the current submission off without waiting on it
+      void Submit();
+      // gives back the space of every submission that has finished
+      void Reclaim();
+      // submits and waits until every copy has landed
+      void Flush();
+
+      // every submission gets a serial, GetSerial is the one of the copies recorded so far
+      uint64_t GetSerial();
+      uint64_t GetCompleted() { return Completed; }
+      void WaitFor(uint64_t inSerial);
+
+      uint32_t GetSize() { return Size; }
+
+      // how much a single submission collects before it is sent off
+      uint32_t ChunkSize;
+
+    private:
+      static const uint32_t SlotCount = 4;
+
+      struct Slot
+      {
+        Ek::Wrappers::CommandBuffer Cmd;
+        uint32_t End = 0;
+        uint64_t Serial = 0;
+        bool bRecording = false;
+      };
+
+      void WaitOldest();
+
+      VkDevice* pDevice;
+
+      Ek::Buffer Buffer;
+      char* Mapped;
+
+      uint32_t Size;
+      uint32_t Head = 0;
+      uint32_t Tail = 0;
+      uint32_t BatchBytes = 0;
+
+      uint64_t Serial = 1;    // serial of the submission being recorded
+      uint64_t Completed = 0; // highest serial whose fence has signaled
+
+      Slot Slots[SlotCount];
+      uint32_t Current = 0;
+
+      // submitted slots, oldest first
+      std::deque<uint32_t> Pending;
+  };
+}
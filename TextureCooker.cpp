@@ -0,0 +1,616 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "MeshCache.h"
+#include "MipGenerator.h"
+#include "TextureCooker.h"
+
+namespace EkBackend
+{
+  static const uint8_t Ktx2Identifier[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A}; // «KTX 20»\r\n\x1A\n
+  static const char SourceHashKey[] = "EkSourceHash";
+  static const char WriterKey[] = "KTXwriter";
+
+  // KTX2's fixed header, the level index follows it
+  struct Ktx2Header
+  {
+    uint8_t Identifier[12];
+    uint32_t Format;
+    uint32_t TypeSize;
+    uint32_t PixelWidth;
+    uint32_t PixelHeight;
+    uint32_t PixelDepth;
+    uint32_t LayerCount;
+    uint32_t FaceCount;
+    uint32_t LevelCount;
+    uint32_t SupercompressionScheme;
+
+    uint32_t DfdByteOffset;
+    uint32_t DfdByteLength;
+    uint32_t KvdByteOffset;
+    uint32_t KvdByteLength;
+    uint64_t SgdByteOffset;
+    uint64_t SgdByteLength;
+  };
+
+  struct Ktx2Level
+  {
+    uint64_t ByteOffset;
+    uint64_t ByteLength;
+    uint64_t UncompressedByteLength;
+  };
+
+  // how far along from the first endpoint to the second each of BC7's 4 bit indices is, out of 64
+  static const uint32_t Bc7Weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  // BC blocks are little endian bit streams, fields start at the lowest bit
+  struct BlockWriter
+  {
+    uint8_t* pOut;
+    uint32_t Bit = 0;
+
+    void Write(uint32_t Value, uint32_t Count)
+    {
+      for(uint32_t i = 0; i < Count; i++, Bit++)
+      {
+        pOut[Bit >> 3] |= ((Value >> i) & 1) << (Bit & 7);
+      }
+    }
+  };
+
+  // the texels of one 4x4 block, levels smaller than a block repeat their edge
+  static void ReadBlock(const uint8_t* pLevel, uint32_t RowPitch, VkExtent2D Extent, uint32_t BlockX, uint32_t BlockY, uint8_t Texels[64])
+  {
+    for(uint32_t y = 0; y < 4; y++)
+    {
+      uint32_t Row = std::min(BlockY * 4 + y, Extent.height - 1);
+
+      for(uint32_t x = 0; x < 4; x++)
+      {
+        uint32_t Column = std::min(BlockX * 4 + x, Extent.width - 1);
+
+        memcpy(Texels + (y * 4 + x) * 4, pLevel + (size_t)Row * RowPitch + Column * 4, 4);
+      }
+    }
+  }
+
+  static void AppendKeyValue(std::string& Out, const char* pKey, const std::string& Value)
+  {
+    uint32_t Length = strlen(pKey) + 1 + Value.size() + 1;
+
+    Out.append((const char*)&Length, sizeof(Length));
+    Out.append(pKey, strlen(pKey) + 1);
+    Out.append(Value.c_str(), Value.size() + 1);
+    Out.append((4 - Length % 4) % 4, '\0');
+  }
+
+  void TextureCooker::Encode(const Ek::ImageData& Image, VkFormat Format, Ek::ImageData& Out)
+  {
+    Out = Ek::ImageData();
+    Out.Format = Format;
+    Out.Extent = Image.Extent;
+    Out.MipLevels = Image.MipLevels;
+    Out.RowPitch = (Image.Extent.width + 3) / 4 * 16;
+    Out.Pixels.resize(MipGenerator::GetOffset(Out, Out.MipLevels));
+
+    for(uint32_t Level = 0; Level < Image.MipLevels; Level++)
+    {
+      const uint8_t* pSrc = Image.Pixels.data() + MipGenerator::GetOffset(Image, Level);
+      uint32_t SrcPitch = MipGenerator::GetRowPitch(Image, Level);
+      VkExtent2D Extent = MipGenerator::GetExtent(Image.Extent, Level);
+
+      uint8_t* pDst = Out.Pixels.data() + MipGenerator::GetOffset(Out, Level);
+      uint32_t BlocksWide = (Extent.width + 3) / 4;
+      uint32_t BlocksHigh = (Extent.height + 3) / 4;
+
+      for(uint32_t y = 0; y < BlocksHigh; y++)
+      {
+        for(uint32_t x = 0; x < BlocksWide; x++)
+        {
+          uint8_t Texels[64];
+          ReadBlock(pSrc, SrcPitch, Extent, x, y, Texels);
+
+          uint8_t* pBlock = pDst + ((size_t)y * BlocksWide + x) * 16;
+
+          if(Format == VK_FORMAT_BC7_UNORM_BLOCK)
+          {
+            EncodeBC7(Texels, pBlock);
+          }
+          else
+          {
+            EncodeBC4(Texels, 0, pBlock);
+            EncodeBC4(Texels, 1, pBlock + 8);
+          }
+        }
+      }
+    }
+  }
+
+  void TextureCooker::EncodeBC7(const uint8_t Texels[64], uint8_t* pOut)
+  {
+    float Mean[4] = {};
+
+    for(uint32_t t = 0; t < 16; t++)
+    {
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        Mean[c] += Texels[t * 4 + c] / 16.f;
+      }
+    }
+
+    float Cov[4][4] = {};
+
+    for(uint32_t t = 0; t < 16; t++)
+    {
+      for(uint32_t i = 0; i < 4; i++)
+      {
+        for(uint32_t j = 0; j < 4; j++)
+        {
+          Cov[i][j] += (Texels[t * 4 + i] - Mean[i]) * (Texels[t * 4 + j] - Mean[j]);
+        }
+      }
+    }
+
+    // the endpoints go along the principal axis, found by power iteration from the channel that varies the most
+    uint32_t Widest = 0;
+
+    for(uint32_t c = 1; c < 4; c++)
+    {
+      Widest = (Cov[c][c] > Cov[Widest][Widest]) ? c : Widest;
+    }
+
+    float Axis[4] = {Cov[Widest][0], Cov[Widest][1], Cov[Widest][2], Cov[Widest][3]};
+
+    for(uint32_t Iteration = 0; Iteration < 8; Iteration++)
+    {
+      float Next[4] = {};
+      float Largest = 0.f;
+
+      for(uint32_t i = 0; i < 4; i++)
+      {
+        for(uint32_t j = 0; j < 4; j++)
+        {
+          Next[i] += Cov[i][j] * Axis[j];
+        }
+
+        Largest = std::max(Largest, std::fabs(Next[i]));
+      }
+
+      if(Largest == 0.f)
+      {
+        break;
+      }
+
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        Axis[c] = Next[c] / Largest;
+      }
+    }
+
+    float Length = std::sqrt(Axis[0] * Axis[0] + Axis[1] * Axis[1] + Axis[2] * Axis[2] + Axis[3] * Axis[3]);
+    float Min = 0.f;
+    float Max = 0.f;
+
+    for(uint32_t t = 0; t < 16 && Length > 0.f; t++)
+    {
+      float Projected = 0.f;
+
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        Projected += (Texels[t * 4 + c] - Mean[c]) * Axis[c] / Length;
+      }
+
+      Min = std::min(Min, Projected);
+      Max = std::max(Max, Projected);
+    }
+
+    float Ends[2][4];
+
+    for(uint32_t c = 0; c < 4; c++)
+    {
+      float Direction = (Length > 0.f) ? Axis[c] / Length : 0.f;
+
+      Ends[0][c] = std::min(std::max(Mean[c] + Min * Direction, 0.f), 255.f);
+      Ends[1][c] = std::min(std::max(Mean[c] + Max * Direction, 0.f), 255.f);
+    }
+
+    uint32_t BestError = UINT32_MAX;
+    uint32_t BestEnds[2][4] = {};
+    uint32_t BestBits[2] = {};
+    uint32_t BestIndices[16] = {};
+
+    for(uint32_t Pass = 0; Pass < 2; Pass++)
+    {
+      // every combination of the two p bits, which are the lowest bit of all channels of their endpoint
+      for(uint32_t P = 0; P < 4; P++)
+      {
+        uint32_t Bits[2] = {P & 1, P >> 1};
+        uint32_t Quantized[2][4];
+        uint32_t Palette[16][4];
+
+        for(uint32_t e = 0; e < 2; e++)
+        {
+          for(uint32_t c = 0; c < 4; c++)
+          {
+            Quantized[e][c] = (uint32_t)std::min(std::max((int)std::lround((Ends[e][c] - Bits[e]) / 2.f), 0), 127);
+          }
+        }
+
+        for(uint32_t i = 0; i < 16; i++)
+        {
+          for(uint32_t c = 0; c < 4; c++)
+          {
+            uint32_t End0 = (Quantized[0][c] << 1) | Bits[0];
+            uint32_t End1 = (Quantized[1][c] << 1) | Bits[1];
+
+            Palette[i][c] = ((64 - Bc7Weights[i]) * End0 + Bc7Weights[i] * End1 + 32) >> 6;
+          }
+        }
+
+        uint32_t Error = 0;
+        uint32_t Indices[16];
+
+        for(uint32_t t = 0; t < 16; t++)
+        {
+          uint32_t TexelError = UINT32_MAX;
+
+          for(uint32_t i = 0; i < 16; i++)
+          {
+            uint32_t Distance = 0;
+
+            for(uint32_t c = 0; c < 4; c++)
+            {
+              int Delta = (int)Texels[t * 4 + c] - (int)Palette[i][c];
+              Distance += Delta * Delta;
+            }
+
+            if(Distance < TexelError)
+            {
+              TexelError = Distance;
+              Indices[t] = i;
+            }
+          }
+
+          Error += TexelError;
+        }
+
+        if(Error < BestError)
+        {
+          BestError = Error;
+          memcpy(BestEnds, Quantized, sizeof(BestEnds));
+          memcpy(BestBits, Bits, sizeof(BestBits));
+          memcpy(BestIndices, Indices, sizeof(BestIndices));
+        }
+      }
+
+      // least squares endpoints for the weights the texels picked, the bounding ones overshoot when the texels bunch up
+      float A = 0.f, B = 0.f, C = 0.f;
+      float X0[4] = {}, X1[4] = {};
+
+      for(uint32_t t = 0; t < 16; t++)
+      {
+        float w = Bc7Weights[BestIndices[t]] / 64.f;
+
+        A += (1.f - w) * (1.f - w);
+        B += (1.f - w) * w;
+        C += w * w;
+
+        for(uint32_t c = 0; c < 4; c++)
+        {
+          X0[c] += (1.f - w) * Texels[t * 4 + c];
+          X1[c] += w * Texels[t * 4 + c];
+        }
+      }
+
+      float Det = A * C - B * B;
+
+      if(std::fabs(Det) < 1e-4f)
+      {
+        break;
+      }
+
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        Ends[0][c] = std::min(std::max((C * X0[c] - B * X1[c]) / Det, 0.f), 255.f);
+        Ends[1][c] = std::min(std::max((A * X1[c] - B * X0[c]) / Det, 0.f), 255.f);
+      }
+    }
+
+    // the first texel's index has no top bit, it's implied 0. Swapping the endpoints mirrors the weights
+    if(BestIndices[0] & 8)
+    {
+      for(uint32_t c = 0; c < 4; c++)
+      {
+        std::swap(BestEnds[0][c], BestEnds[1][c]);
+      }
+
+      std::swap(BestBits[0], BestBits[1]);
+
+      for(uint32_t t = 0; t < 16; t++)
+      {
+        BestIndices[t] = 15 - BestIndices[t];
+      }
+    }
+
+    memset(pOut, 0, 16);
+
+    BlockWriter Writer{pOut};
+
+    // mode 6 is a 1 after six 0s
+    Writer.Write(1 << 6, 7);
+
+    for(uint32_t c = 0; c < 4; c++)
+    {
+      Writer.Write(BestEnds[0][c], 7);
+      Writer.Write(BestEnds[1][c], 7);
+    }
+
+    Writer.Write(BestBits[0], 1);
+    Writer.Write(BestBits[1], 1);
+
+    Writer.Write(BestIndices[0], 3);
+
+    for(uint32_t t = 1; t < 16; t++)
+    {
+      Writer.Write(BestIndices[t], 4);
+    }
+  }
+
+  void TextureCooker::EncodeBC4(const uint8_t Texels[64], uint32_t Channel, uint8_t* pOut)
+  {
+    uint32_t Min = 255;
+    uint32_t Max = 0;
+
+    for(uint32_t t = 0; t < 16; t++)
+    {
+      Min = std::min(Min, (uint32_t)Texels[t * 4 + Channel]);
+      Max = std::max(Max, (uint32_t)Texels[t * 4 + Channel]);
+    }
+
+    // the first endpoint above the second picks the palette with 6 values in between. A flat block is all index 0 either way
+    uint32_t Palette[8] = {Max, Min};
+
+    for(uint32_t i = 2; i < 8; i++)
+    {
+      Palette[i] = ((8 - i) * Max + (i - 1) * Min + 3) / 7;
+    }
+
+    uint64_t Indices = 0;
+
+    for(uint32_t t = 0; t < 16; t++)
+    {
+      uint32_t Value = Texels[t * 4 + Channel];
+      uint32_t Best = 0;
+
+      for(uint32_t i = 1; i < 8; i++)
+      {
+        if((uint32_t)std::abs((int)Value - (int)Palette[i]) < (uint32_t)std::abs((int)Value - (int)Palette[Best]))
+        {
+          Best = i;
+        }
+      }
+
+      Indices |= (uint64_t)Best << (t * 3);
+    }
+
+    pOut[0] = Max;
+    pOut[1] = Min;
+
+    for(uint32_t i = 0; i < 6; i++)
+    {
+      pOut[2 + i] = (uint8_t)(Indices >> (i * 8));
+    }
+  }
+
+  bool TextureCooker::Read(const std::string& Path, uint64_t SourceHash, VkFormat Format, Ek::ImageData& Image)
+  {
+    std::ifstream File(Path, std::ios::binary);
+
+    if(!File.is_open())
+    {
+      return false;
+    }
+
+    std::string Data((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+
+    Ktx2Header Header;
+
+    if(Data.size() < sizeof(Header))
+    {
+      return false;
+    }
+
+    memcpy(&Header, Data.data(), sizeof(Header));
+
+    bool bValid = memcmp(Header.Identifier, Ktx2Identifier, sizeof(Ktx2Identifier)) == 0 && Header.Format == (uint32_t)Format &&
+                  Header.PixelWidth > 0 && Header.PixelHeight > 0 && Header.PixelWidth <= 65536 && Header.PixelHeight <= 65536 && Header.PixelDepth == 0 && Header.LayerCount == 0 && Header.FaceCount == 1 &&
+                  Header.SupercompressionScheme == 0 && Header.LevelCount == MipGenerator::GetLevelCount(VkExtent2D{Header.PixelWidth, Header.PixelHeight}) &&
+                  sizeof(Header) + (uint64_t)Header.LevelCount * sizeof(Ktx2Level) <= Data.size() &&
+                  (uint64_t)Header.KvdByteOffset + Header.KvdByteLength <= Data.size();
+
+    if(!bValid)
+    {
+      return false;
+    }
+
+    // the key/value data is a list of length prefixed "key\0value\0" entries, each padded to 4 bytes
+    uint64_t CookedHash = 0;
+    size_t Pos = Header.KvdByteOffset;
+    size_t End = (size_t)Header.KvdByteOffset + Header.KvdByteLength;
+
+    while(End - Pos >= sizeof(uint32_t))
+    {
+      uint32_t Length;
+      memcpy(&Length, Data.data() + Pos, sizeof(Length));
+      Pos += sizeof(Length);
+
+      if(Length > End - Pos)
+      {
+        break;
+      }
+
+      if(Length > sizeof(SourceHashKey) && memcmp(Data.data() + Pos, SourceHashKey, sizeof(SourceHashKey)) == 0)
+      {
+        std::string Value(Data.data() + Pos + sizeof(SourceHashKey), Length - sizeof(SourceHashKey));
+        CookedHash = strtoull(Value.c_str(), nullptr, 16);
+      }
+
+      Pos += std::min((size_t)(Length + 3) & ~(size_t)3, End - Pos);
+    }
+
+    if(CookedHash != SourceHash)
+    {
+      return false;
+    }
+
+    Image = Ek::ImageData();
+    Image.Format = Format;
+    Image.Extent = VkExtent2D{Header.PixelWidth, Header.PixelHeight};
+    Image.MipLevels = Header.LevelCount;
+    Image.RowPitch = (Image.Extent.width + 3) / 4 * MipGenerator::GetBlockBytes(Format);
+
+    // every level has to be in the file before we size the chain by the header, or a broken one could ask for gigabytes
+    std::vector<Ktx2Level> Levels(Image.MipLevels);
+    uint64_t Total = 0;
+
+    for(uint32_t Level = 0; Level < Image.MipLevels && bValid; Level++)
+    {
+      memcpy(&Levels[Level], Data.data() + sizeof(Header) + Level * sizeof(Ktx2Level), sizeof(Ktx2Level));
+
+      uint64_t Size = (uint64_t)MipGenerator::GetRowPitch(Image, Level) * MipGenerator::GetRowCount(Image, Level);
+
+      bValid = Levels[Level].ByteLength == Size && Levels[Level].ByteOffset <= Data.size() && Levels[Level].ByteLength <= Data.size() - Levels[Level].ByteOffset;
+      Total += Size;
+    }
+
+    bValid = bValid && Total <= Data.size();
+
+    if(bValid)
+    {
+      Image.Pixels.resize(MipGenerator::GetOffset(Image, Image.MipLevels));
+
+      for(uint32_t Level = 0; Level < Image.MipLevels; Level++)
+      {
+        memcpy(Image.Pixels.data() + MipGenerator::GetOffset(Image, Level), Data.data() + Levels[Level].ByteOffset, Levels[Level].ByteLength);
+      }
+    }
+
+    if(!bValid)
+    {
+      std::cout << "cooked texture " << Path << " is damaged, cooking the source again\n";
+      Image = Ek::ImageData();
+      return false;
+    }
+
+    return true;
+  }
+
+  bool TextureCooker::Write(const std::string& Path, uint64_t SourceHash, const Ek::ImageData& Image)
+  {
+    bool bBC7 = Image.Format == VK_FORMAT_BC7_UNORM_BLOCK;
+
+    // a single basic data format descriptor block, its samples say where the channels are in the 128 bit block
+    uint32_t SampleCount = bBC7 ? 1 : 2;
+    uint32_t DescriptorSize = 24 + 16 * SampleCount;
+
+    std::vector<uint32_t> Dfd;
+    Dfd.push_back(4 + DescriptorSize);
+    Dfd.push_back(0);                                           // khronos vendor, basic descriptor type
+    Dfd.push_back(2 | (DescriptorSize << 16));                  // version 2
+    Dfd.push_back((bBC7 ? 134 : 132) | (1 << 8) | (1 << 16));  // BC7/BC5 color model, BT709 primaries, linear, straight alpha
+    Dfd.push_back(3 | (3 << 8));                                // 4x4 texel blocks, stored as size - 1
+    Dfd.push_back(16);                                          // bytes per block
+    Dfd.push_back(0);
+
+    for(uint32_t i = 0; i < SampleCount; i++)
+    {
+      // bit offset, bit length - 1 and channel (BC7 color, BC5 red then green)
+      Dfd.push_back((i * 64) | ((bBC7 ? 127 : 63) << 16) | (i << 24));
+      Dfd.push_back(0);
+      Dfd.push_back(0);
+      Dfd.push_back(UINT32_MAX);
+    }
+
+    char HashText[17];
+    snprintf(HashText, sizeof(HashText), "%016llx", (unsigned long long)SourceHash);
+
+    // sorted by key, which the spec asks for
+    std::string Kvd;
+    AppendKeyValue(Kvd, SourceHashKey, HashText);
+    AppendKeyValue(Kvd, WriterKey, "QuickRender TextureCooker");
+
+    Ktx2Header Header{};
+    memcpy(Header.Identifier, Ktx2Identifier, sizeof(Ktx2Identifier));
+    Header.Format = Image.Format;
+    Header.TypeSize = 1;
+    Header.PixelWidth = Image.Extent.width;
+    Header.PixelHeight = Image.Extent.height;
+    Header.FaceCount = 1;
+    Header.LevelCount = Image.MipLevels;
+
+    Header.DfdByteOffset = sizeof(Header) + Image.MipLevels * sizeof(Ktx2Level);
+    Header.DfdByteLength = Dfd.size() * sizeof(uint32_t);
+    Header.KvdByteOffset = Header.DfdByteOffset + Header.DfdByteLength;
+    Header.KvdByteLength = Kvd.size();
+
+    // the smallest level comes first in the file, every level starts on a block boundary
+    std::vector<Ktx2Level> Levels(Image.MipLevels);
+    uint64_t Offset = Header.KvdByteOffset + Header.KvdByteLength;
+
+    for(uint32_t Level = Image.MipLevels; Level-- > 0;)
+    {
+      Offset = (Offset + 15) & ~15ull;
+
+      Levels[Level].ByteOffset = Offset;
+      Levels[Level].ByteLength = (uint64_t)MipGenerator::GetRowPitch(Image, Level) * MipGenerator::GetRowCount(Image, Level);
+      Levels[Level].UncompressedByteLength = Levels[Level].ByteLength;
+
+      Offset += Levels[Level].ByteLength;
+    }
+
+    std::string Out;
+    Out.append((const char*)&Header, sizeof(Header));
+    Out.append((const char*)Levels.data(), Levels.size() * sizeof(Ktx2Level));
+    Out.append((const char*)Dfd.data(), Dfd.size() * sizeof(uint32_t));
+    Out.append(Kvd);
+
+    for(uint32_t Level = Image.MipLevels; Level-- > 0;)
+    {
+      Out.resize(Levels[Level].ByteOffset, '\0');
+      Out.append((const char*)Image.Pixels.data() + MipGenerator::GetOffset(Image, Level), Levels[Level].ByteLength);
+    }
+
+    std::string TempPath = MeshCache::GetTempPath(Path);
+    std::ofstream File(TempPath, std::ios::binary | std::ios::trunc);
+
+    if(!File.is_open())
+    {
+      return false;
+    }
+
+    File.write(Out.data(), Out.size());
+    File.close();
+
+    if(File.fail())
+    {
+      std::remove(TempPath.c_str());
+      return false;
+    }
+
+    // a unique temp name is never cleaned up by the next write, so don't leave it behind
+    if(std::rename(TempPath.c_str(), Path.c_str()) != 0)
+    {
+      std::remove(TempPath.c_str());
+      return false;
+    }
+
+    return true;
+  }
+}
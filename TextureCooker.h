@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Memory.h"
+
+namespace EkBackend
+{
+  /*
+    Turns decoded RGBA8 images into block compressed ones and keeps them in a .ktx2 file next to the source, the way
+    MeshCache does for models. Albedo goes to BC7 (mode 6 only: one subset, 7 bit endpoints with a shared p bit, 16
+    weights), normal maps to BC5 from their red and green channels. Both are 16 bytes per 4x4 block, a quarter of RGBA8.
+    The file holds the whole mip chain and the FNV-1a hash of the source in its key/value data, so editing the source
+    makes Read fail and the caller cooks it again.
+  */
+  class TextureCooker
+  {
+    public:
+      // Image has to be RGBA8 with its full mip chain, Out gets the same chain in Format
+      static void Encode(const Ek::ImageData& Image, VkFormat Format, Ek::ImageData& Out);
+
+      // false if there is no file, it was cooked from something else or into another format
+      static bool Read(const std::string& Path, uint64_t SourceHash, VkFormat Format, Ek::ImageData& Image);
+      // written to a MeshCache::GetTempPath and renamed over Path, so a crash halfway never leaves a broken file behind
+      static bool Write(const std::string& Path, uint64_t SourceHash, const Ek::ImageData& Image);
+
+    private:
+      static void EncodeBC7(const uint8_t Texels[64], uint8_t* pOut);
+      static void EncodeBC4(const uint8_t Texels[64], uint32_t Channel, uint8_t* pOut);
+  };
+}
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <vector>
+
+#include "MipGenerator.h"
+#include "TextureStreamer.h"
+
+namespace EkBackend
+{
+  void TextureStreamer::Init(AllocateInterface* inAlloc, UploadQueue* inUploads, uint32_t inTailSize, VkDeviceSize inBytesPerFrame)
+  {
+    pAlloc = inAlloc;
+    pUploads = inUploads;
+
+    TailSize = inTailSize;
+    BytesPerFrame = inBytesPerFrame;
+  }
+
+  void TextureStreamer::Destroy()
+  {
+    for(auto& Entry : Entries)
+    {
+      if(Entry.second.bPending)
+      {
+        pUploads->Wait(Entry.second.Token);
+      }
+    }
+
+    Entries.clear();
+  }
+
+  VkResult TextureStreamer::Load(Ek::ImageData& Image, Ek::Texture& Texture, VkImageLayout Layout, VkImageUsageFlags Usage)
+  {
+    VkResult Err;
+
+    // every level comes from the cpu, a blit would need the level above it to be there already
+    MipGenerator::Generate(Image);
+
+    // block compressed images can only be sampled and copied
+    if(MipGenerator::IsBlockCompressed(Image.Format))
+    {
+      Usage &= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    }
+
+    if((Err = pAlloc->CreateImage(Texture, Image.Format, Image.Extent, VK_IMAGE_USAGE_TRANSFER_DST_BIT | Usage, Image.MipLevels)) != VK_SUCCESS)
+    {
+      return Err;
+    }
+
+    if(Texture.Category == Ek::eMemoryOther)
+    {
+      Texture.Category = Ek::eMemoryTexture;
+    }
+
+    pAlloc->AllocateTexture(Texture, Ek::eGpuOnly);
+
+    // the tail is every level that fits in TailSize, at least the 1x1 one
+    uint32_t Tail = Image.MipLevels - 1;
+
+    while(Tail > 0)
+    {
+      VkExtent2D Extent = MipGenerator::GetExtent(Image.Extent, Tail - 1);
+
+      if(std::max(Extent.width, Extent.height) > TailSize)
+      {
+        break;
+      }
+
+      Tail--;
+    }
+
+    Texture.BaseLevel = Tail;
+    pUploads->UploadLevels(Texture, Image, Tail, Image.MipLevels - Tail, Layout);
+
+    if(Tail == 0)
+    {
+      Image = Ek::ImageData();
+      return VK_SUCCESS;
+    }
+
+    StreamEntry& Entry = Entries[&Texture];
+    Entry.Image = std::move(Image);
+    Entry.Layout = Layout;
+    Entry.Wanted = Texture.MipLevels;
+
+    Image = Ek::ImageData();
+
+    return VK_SUCCESS;
+  }
+
+  void TextureStreamer::Remove(Ek::Texture& Texture)
+  {
+    auto Found = Entries.find(&Texture);
+
+    if(Found == Entries.end())
+    {
+      return;
+    }
+
+    // the copy into the level in flight has to finish before the image goes
+    if(Found->second.bPending)
+    {
+      pUploads->Wait(Found->second.Token);
+    }
+
+    Entries.erase(Found);
+  }
+
+  void TextureStreamer::Request(Ek::Texture& Texture, uint32_t Level)
+  {
+    auto Found = Entries.find(&Texture);
+
+    if(Found != Entries.end())
+    {
+      Found->second.Wanted = std::min(Found->second.Wanted, std::min(Level, Texture.MipLevels - 1));
+    }
+  }
+
+  void TextureStreamer::Update()
+  {
+    // how many levels short of what it wants a texture is, and the texture
+    std::vector<std::pair<uint32_t, Ek::Texture*>> Queue;
+
+    for(auto Entry = Entries.begin(); Entry != Entries.end();)
+    {
+      Ek::Texture* pTexture = Entry->first;
+      StreamEntry& Stream = Entry->second;
+
+      if(Stream.bPending && pUploads->IsDone(Stream.Token))
+      {
+        Stream.bPending = false;
+        pTexture->BaseLevel = Stream.PendingLevel;
+
+        // the view starts at BaseLevel, whoever holds one has to make a new one
+        if(pTexture->pMoveListener != nullptr)
+        {
+          pTexture->pMoveListener->OnMove(pTexture);
+        }
+      }
+
+      // the whole chain is up, the cpu copy can go
+      if(pTexture->BaseLevel == 0)
+      {
+        Entry = Entries.erase(Entry);
+        continue;
+      }
+
+      if(!Stream.bPending && Stream.Wanted < pTexture->BaseLevel)
+      {
+        Queue.push_back({pTexture->BaseLevel - Stream.Wanted, pTexture});
+      }
+
+      // asked again every frame, anything that went off screen stops pulling levels in
+      Stream.Wanted = pTexture->MipLevels;
+
+      Entry++;
+    }
+
+    std::sort(Queue.begin(), Queue.end(), [](const std::pair<uint32_t, Ek::Texture*>& a, const std::pair<uint32_t, Ek::Texture*>& b)
+    {
+      return a.first > b.first;
+    });
+
+    // a level at a time per texture, the biggest gaps first. Always at least one, so a level bigger than the budget still goes
+    VkDeviceSize Sent = 0;
+
+    for(uint32_t i = 0; i < Queue.size() && (Sent == 0 || Sent < BytesPerFrame); i++)
+    {
+      Ek::Texture* pTexture = Queue[i].second;
+      StreamEntry& Stream = Entries.at(pTexture);
+
+      uint32_t Level = pTexture->BaseLevel - 1;
+
+      Stream.Token = pUploads->UploadLevels(*pTexture, Stream.Image, Level, 1, Stream.Layout);
+      Stream.PendingLevel = Level;
+      Stream.bPending = true;
+
+      Sent += (VkDeviceSize)MipGenerator::GetRowPitch(Stream.Image, Level) * MipGenerator::GetRowCount(Stream.Image, Level);
+    }
+  }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "Memory.h"
+#include "Upload.h"
+
+namespace EkBackend
+{
+  /*
+    Textures that show up right away and sharpen as they're needed. Load creates the whole mip chain but only uploads the
+    levels that are at most TailSize texels across, which is a few kilobytes, so the texture is usable as soon as that
+    upload is done. The rest of the chain waits on the cpu. Every frame Request says which level each texture needs for
+    what it covers on screen. Update sends off the next level of the textures furthest from what they need, up to
+    BytesPerFrame of them. Once a level has landed the texture's BaseLevel moves down to it and its MoveListener rebuilds
+    the view (which starts at BaseLevel) and the descriptor.
+    Levels only ever get added, a texture keeps whatever it has streamed in until it's destroyed.
+  */
+  class TextureStreamer
+  {
+    public:
+      void Init(AllocateInterface* inAlloc, UploadQueue* inUploads, uint32_t inTailSize, VkDeviceSize inBytesPerFrame);
+      void Destroy();
+
+      // Image is moved from, it's completed into a full chain first if it isn't one
+      VkResult Load(Ek::ImageData& Image, Ek::Texture& Texture, VkImageLayout Layout, VkImageUsageFlags Usage);
+      // before Texture is destroyed
+      void Remove(Ek::Texture& Texture);
+
+      // Texture should have Level this frame, the finest level asked for since the last Update counts
+      void Request(Ek::Texture& Texture, uint32_t Level);
+
+      // once a frame, where the last frame has finished with every view and descriptor: swaps in what landed, sends off more
+      void Update();
+
+    private:
+      struct StreamEntry
+      {
+        // the whole chain, the levels below Texture.BaseLevel are what's left to send
+        Ek::ImageData Image;
+        VkImageLayout Layout;
+
+        // MipLevels when nothing asked for the texture this frame
+        uint32_t Wanted;
+
+        bool bPending = false;
+        uint32_t PendingLevel = 0;
+        Ek::UploadToken Token = 0;
+      };
+
+      AllocateInterface* pAlloc = nullptr;
+      UploadQueue* pUploads = nullptr;
+
+      uint32_t TailSize = 0;
+      VkDeviceSize BytesPerFrame = 0;
+
+      std::unordered_map<Ek::Texture*, StreamEntry> Entries;
+  };
+}
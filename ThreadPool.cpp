@@ -0,0 +1,82 @@
+#include "ThreadPool.h"
+
+namespace EkBackend
+{
+  void ThreadPool::Init(uint32_t ThreadCount)
+  {
+    if(ThreadCount == 0)
+    {
+      uint32_t Cores = std::thread::hardware_concurrency();
+      ThreadCount = (Cores > 1) ? Cores - 1 : 1;
+    }
+
+    bStop = false;
+
+    for(uint32_t i = 0; i < ThreadCount; i++)
+    {
+      Threads.emplace_back(&ThreadPool::Work, this);
+    }
+  }
+
+  void ThreadPool::Destroy()
+  {
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      bStop = true;
+    }
+
+    Wake.notify_all();
+
+    for(uint32_t i = 0; i < Threads.size(); i++)
+    {
+      Threads[i].join();
+    }
+
+    Threads.clear();
+  }
+
+  std::future<void> ThreadPool::Push(std::function<void()> Job)
+  {
+    std::packaged_task<void()> Task(std::move(Job));
+    std::future<void> Ret = Task.get_future();
+
+    // no workers, the caller does the job itself
+    if(Threads.empty())
+    {
+      Task();
+      return Ret;
+    }
+
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Jobs.push_back(std::move(Task));
+    }
+
+    Wake.notify_one();
+
+    return Ret;
+  }
+
+  void ThreadPool::Work()
+  {
+    while(true)
+    {
+      std::packaged_task<void()> Task;
+
+      {
+        std::unique_lock<std::mutex> Guard(Lock);
+        Wake.wait(Guard, [this]{ return bStop || !Jobs.empty(); });
+
+        if(Jobs.empty())
+        {
+          return;
+        }
+
+        Task = std::move(Jobs.front());
+        Jobs.pop_front();
+      }
+
+      Task();
+    }
+  }
+}
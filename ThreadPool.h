@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace EkBackend
+{
+  /*
+    A fixed set of worker threads pulling jobs off one queue, used for the cpu side of asset loading.
+    Push hands back a future, an exception thrown by the job comes out of the future's get().
+  */
+  class ThreadPool
+  {
+    public:
+      // 0 picks one thread per core, minus the one that calls Push
+      void Init(uint32_t ThreadCount = 0);
+      // finishes the queued jobs before joining
+      void Destroy();
+
+      std::future<void> Push(std::function<void()> Job);
+
+      uint32_t GetThreadCount() { return Threads.size(); }
+
+    private:
+      void Work();
+
+      std::mutex Lock;
+      std::condition_variable Wake;
+      std::deque<std::packaged_task<void()>> Jobs;
+      std::vector<std::thread> Threads;
+      bool bStop = false;
+  };
+}
@@ -0,0 +1,462 @@
+#include "Upload.h"
+#include "MipGenerator.h"
+
+#include <cstring>
+#include <vulkan/vulkan_core.h>
+
+namespace EkBackend
+{
+  // everything we upload ends up as vertex/index data, uniforms, textures or meshlets the cull shader reads
+  static const VkPipelineStageFlags ConsumerStages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+  VkResult UploadQueue::Init(VkDevice& inDevice, AllocateInterface* pAlloc, VkQueue& TransferQueue, VkCommandPool& TransferPool, uint32_t inTransferFamily, VkQueue& GraphicsQueue, uint32_t inGraphicsFamily, uint32_t RingSize)
+  {
+    pDevice = &inDevice;
+    pGraphicsQueue = &GraphicsQueue;
+
+    TransferFamily = inTransferFamily;
+    GraphicsFamily = inGraphicsFamily;
+
+    return Ring.Init(inDevice, pAlloc, TransferQueue, TransferPool, RingSize);
+  }
+
+  void UploadQueue::Destroy()
+  {
+    Ring.Destroy();
+
+    BufferAcquires.clear();
+    ImageAcquires.clear();
+    MipJobs.clear();
+  }
+
+  Ek::UploadToken UploadQueue::GetToken()
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    return Ring.GetSerial();
+  }
+
+  Ek::UploadToken UploadQueue::UploadBuffer(Ek::Buffer& Dst, const void* pData, VkDeviceSize Size, VkDeviceSize DstOffset)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    for(VkDeviceSize Done = 0; Done < Size;)
+    {
+      uint32_t Chunk = (Size - Done < Ring.ChunkSize) ? (uint32_t)(Size - Done) : Ring.ChunkSize;
+
+      VkDeviceSize Offset;
+      void* pChunk = Ring.Acquire(Chunk, 16, Offset);
+
+      memcpy(pChunk, (const char*)pData + Done, Chunk);
+
+      VkBufferCopy CopyInfo{};
+      CopyInfo.srcOffset = Offset;
+      CopyInfo.dstOffset = DstOffset + Done;
+      CopyInfo.size = Chunk;
+
+      vkCmdCopyBuffer(Ring.GetCommand(), Ring.GetBuffer().Buffer, Dst.Buffer, 1, &CopyInfo);
+
+      Done += Chunk;
+    }
+
+    VkBufferMemoryBarrier Barrier{};
+    Barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    Barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    Barrier.buffer = Dst.Buffer;
+    Barrier.offset = DstOffset;
+    Barrier.size = Size;
+
+    Release(&Barrier, nullptr);
+
+    return Ring.GetSerial();
+  }
+
+  Ek::UploadToken UploadQueue::UploadImage(Ek::Texture& Dst, const Ek::ImageData& Image, VkImageLayout FinalLayout)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    VkImageMemoryBarrier toDst = Dst.Barrier(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    toDst.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    toDst.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+    vkCmdPipelineBarrier(Ring.GetCommand(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toDst);
+
+    uint32_t Levels = (Image.MipLevels < Dst.MipLevels) ? Image.MipLevels : Dst.MipLevels;
+
+    for(uint32_t Level = 0; Level < Levels; Level++)
+    {
+      CopyLevel(Dst, Image, Level);
+    }
+
+    if(Levels == Dst.MipLevels)
+    {
+      VkImageMemoryBarrier toFinal = Dst.Barrier(VK_IMAGE_ASPECT_COLOR_BIT, FinalLayout, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+      Release(nullptr, &toFinal);
+
+      return Ring.GetSerial();
+    }
+
+    // the transfer queue can't blit, the rest of the chain is made on the graphics side once this has landed
+    MipJob Job{};
+    Job.Serial = Ring.GetSerial();
+    Job.Image = Dst.Image;
+    Job.Extent = Dst.Extent;
+    Job.FirstLevel = Levels;
+    Job.MipLevels = Dst.MipLevels;
+    Job.FinalLayout = FinalLayout;
+
+    if(TransferFamily != GraphicsFamily)
+    {
+      // handed over as it is, every level stays in TRANSFER_DST until GenerateMips
+      VkImageMemoryBarrier Handover = Dst.Barrier(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+      Handover.srcQueueFamilyIndex = TransferFamily;
+      Handover.dstQueueFamilyIndex = GraphicsFamily;
+
+      Job.Acquire = Handover;
+      Job.Acquire.srcAccessMask = 0;
+      Job.Acquire.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+      vkCmdPipelineBarrier(Ring.GetCommand(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &Handover);
+    }
+
+    MipJobs.push_back(Job);
+
+    // where every level is by the time the token is done, which is the only point anyone may use the image
+    Dst.Layout = FinalLayout;
+
+    return Ring.GetSerial();
+  }
+
+  Ek::UploadToken UploadQueue::UploadLevels(Ek::Texture& Dst, const Ek::ImageData& Image, uint32_t FirstLevel, uint32_t LevelCount, VkImageLayout FinalLayout)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    // the other levels are in use, or hold nothing yet. These never had anything in them, so there's nothing to keep
+    VkImageMemoryBarrier Barrier{};
+    Barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    Barrier.image = Dst.Image;
+    Barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    Barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    Barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    Barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    Barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    Barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    Barrier.subresourceRange.baseMipLevel = FirstLevel;
+    Barrier.subresourceRange.levelCount = LevelCount;
+    Barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(Ring.GetCommand(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+
+    for(uint32_t Level = FirstLevel; Level < FirstLevel + LevelCount; Level++)
+    {
+      CopyLevel(Dst, Image, Level);
+    }
+
+    Barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    Barrier.newLayout = FinalLayout;
+    Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    Release(nullptr, &Barrier);
+
+    // the layout of every level that has something in it
+    Dst.Layout = FinalLayout;
+
+    return Ring.GetSerial();
+  }
+
+  void UploadQueue::CopyLevel(Ek::Texture& Dst, const Ek::ImageData& Image, uint32_t Level)
+  {
+    // rows of texels, or of 4x4 blocks for compressed formats
+    uint32_t Block = MipGenerator::GetBlockSize(Image.Format);
+
+    const uint8_t* pLevel = Image.Pixels.data() + MipGenerator::GetOffset(Image, Level);
+    uint32_t RowPitch = MipGenerator::GetRowPitch(Image, Level);
+    uint32_t RowCount = MipGenerator::GetRowCount(Image, Level);
+    VkExtent2D Extent = MipGenerator::GetExtent(Image.Extent, Level);
+
+    // a band of rows at a time, so images of any size fit through the ring
+    uint32_t RowsPerChunk = Ring.ChunkSize / RowPitch;
+
+    if(RowsPerChunk == 0)
+    {
+      RowsPerChunk = 1;
+    }
+
+    for(uint32_t Row = 0; Row < RowCount; Row += RowsPerChunk)
+    {
+      uint32_t Rows = (RowCount - Row < RowsPerChunk) ? RowCount - Row : RowsPerChunk;
+
+      VkDeviceSize Offset;
+      void* pChunk = Ring.Acquire(Rows * RowPitch, 16, Offset);
+
+      memcpy(pChunk, pLevel + (size_t)Row * RowPitch, (size_t)Rows * RowPitch);
+
+      // the last band of blocks may stick out past the edge of the level, the copy stops at the edge
+      uint32_t Top = Row * Block;
+      uint32_t Height = (Extent.height - Top < Rows * Block) ? Extent.height - Top : Rows * Block;
+
+      VkBufferImageCopy CopyInfo{};
+      CopyInfo.bufferOffset = Offset;
+      CopyInfo.bufferRowLength = RowPitch / MipGenerator::GetBlockBytes(Image.Format) * Block;
+      CopyInfo.imageOffset = {0, (int32_t)Top, 0};
+      CopyInfo.imageExtent = {Extent.width, Height, 1};
+      CopyInfo.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      CopyInfo.imageSubresource.mipLevel = Level;
+      CopyInfo.imageSubresource.layerCount = 1;
+      CopyInfo.imageSubresource.baseArrayLayer = 0;
+
+      vkCmdCopyBufferToImage(Ring.GetCommand(), Ring.GetBuffer().Buffer, Dst.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &CopyInfo);
+    }
+  }
+
+  void UploadQueue::GenerateMips(VkCommandBuffer GraphicsCmd, const MipJob& Job)
+  {
+    VkImageMemoryBarrier Barrier{};
+    Barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    Barrier.image = Job.Image;
+    Barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    Barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    Barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    Barrier.subresourceRange.levelCount = 1;
+    Barrier.subresourceRange.layerCount = 1;
+
+    VkExtent2D Extent = MipGenerator::GetExtent(Job.Extent, Job.FirstLevel - 1);
+
+    // every level is made from the one above it, which is done and can go to FinalLayout right after
+    for(uint32_t Level = Job.FirstLevel; Level < Job.MipLevels; Level++)
+    {
+      VkExtent2D Next = MipGenerator::GetExtent(Job.Extent, Level);
+
+      Barrier.subresourceRange.baseMipLevel = Level - 1;
+      Barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      Barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      Barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+      vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+
+      VkImageBlit Blit{};
+      Blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      Blit.srcSubresource.mipLevel = Level - 1;
+      Blit.srcSubresource.layerCount = 1;
+      Blit.srcOffsets[1] = {(int32_t)Extent.width, (int32_t)Extent.height, 1};
+      Blit.dstSubresource = Blit.srcSubresource;
+      Blit.dstSubresource.mipLevel = Level;
+      Blit.dstOffsets[1] = {(int32_t)Next.width, (int32_t)Next.height, 1};
+
+      vkCmdBlitImage(GraphicsCmd, Job.Image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, Job.Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Blit, VK_FILTER_LINEAR);
+
+      Barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      Barrier.newLayout = Job.FinalLayout;
+      Barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, ConsumerStages, 0, 0, nullptr, 0, nullptr, 1, &Barrier);
+
+      Extent = Next;
+    }
+
+    // the uploaded levels nothing was blitted from and the last one, which were only ever written
+    VkImageMemoryBarrier Rest[2] = {Barrier, Barrier};
+    uint32_t RestCount = 0;
+
+    if(Job.FirstLevel > 1)
+    {
+      Rest[RestCount].subresourceRange.baseMipLevel = 0;
+      Rest[RestCount].subresourceRange.levelCount = Job.FirstLevel - 1;
+      RestCount++;
+    }
+
+    Rest[RestCount].subresourceRange.baseMipLevel = Job.MipLevels - 1;
+    Rest[RestCount].subresourceRange.levelCount = 1;
+    RestCount++;
+
+    for(uint32_t i = 0; i < RestCount; i++)
+    {
+      Rest[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      Rest[i].newLayout = Job.FinalLayout;
+      Rest[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      Rest[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+
+    vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, ConsumerStages, 0, 0, nullptr, 0, nullptr, RestCount, Rest);
+  }
+
+  void UploadQueue::Release(VkBufferMemoryBarrier* pBuffer, VkImageMemoryBarrier* pImage)
+  {
+    if(TransferFamily == GraphicsFamily)
+    {
+      // nothing to hand over, images still need their layout change which is fine to do on the transfer side
+      if(pImage != nullptr)
+      {
+        pImage->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        pImage->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        pImage->dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(Ring.GetCommand(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, pImage);
+      }
+
+      return;
+    }
+
+    // both halves of an ownership transfer have to describe the same barrier, only the access masks differ
+    if(pBuffer != nullptr)
+    {
+      pBuffer->srcQueueFamilyIndex = TransferFamily;
+      pBuffer->dstQueueFamilyIndex = GraphicsFamily;
+
+      VkBufferMemoryBarrier Acquire = *pBuffer;
+      Acquire.srcAccessMask = 0;
+      BufferAcquires.push_back({Ring.GetSerial(), Acquire});
+
+      pBuffer->dstAccessMask = 0;
+    }
+
+    if(pImage != nullptr)
+    {
+      pImage->srcQueueFamilyIndex = TransferFamily;
+      pImage->dstQueueFamilyIndex = GraphicsFamily;
+
+      VkImageMemoryBarrier Acquire = *pImage;
+      Acquire.srcAccessMask = 0;
+      ImageAcquires.push_back({Ring.GetSerial(), Acquire});
+
+      pImage->dstAccessMask = 0;
+    }
+
+    vkCmdPipelineBarrier(Ring.GetCommand(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, (pBuffer != nullptr) ? 1 : 0, pBuffer, (pImage != nullptr) ? 1 : 0, pImage);
+  }
+
+  void UploadQueue::Process(VkCommandBuffer GraphicsCmd)
+  {
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    Acquire(GraphicsCmd);
+  }
+
+  void UploadQueue::Acquire(VkCommandBuffer GraphicsCmd)
+  {
+    Ring.Submit();
+    Ring.Reclaim();
+
+    uint64_t Completed = Ring.GetCompleted();
+
+    if(Completed <= Retired)
+    {
+      return;
+    }
+
+    if(TransferFamily == GraphicsFamily)
+    {
+      VkMemoryBarrier Barrier{};
+      Barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      Barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, ConsumerStages, 0, 1, &Barrier, 0, nullptr, 0, nullptr);
+    }
+    else
+    {
+      std::vector<VkBufferMemoryBarrier> Buffers;
+      std::vector<VkImageMemoryBarrier> Images;
+
+      for(uint32_t i = 0; i < BufferAcquires.size(); i++)
+      {
+        if(BufferAcquires[i].first <= Completed)
+        {
+          Buffers.push_back(BufferAcquires[i].second);
+          BufferAcquires.erase(BufferAcquires.begin()+i);
+          i--;
+        }
+      }
+
+      for(uint32_t i = 0; i < ImageAcquires.size(); i++)
+      {
+        if(ImageAcquires[i].first <= Completed)
+        {
+          Images.push_back(ImageAcquires[i].second);
+          ImageAcquires.erase(ImageAcquires.begin()+i);
+          i--;
+        }
+      }
+
+      if(Buffers.size() > 0 || Images.size() > 0)
+      {
+        vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, ConsumerStages, 0, 0, nullptr, Buffers.size(), Buffers.data(), Images.size(), Images.data());
+      }
+    }
+
+    std::vector<MipJob> Jobs;
+
+    for(uint32_t i = 0; i < MipJobs.size(); i++)
+    {
+      if(MipJobs[i].Serial <= Completed)
+      {
+        Jobs.push_back(MipJobs[i]);
+        MipJobs.erase(MipJobs.begin()+i);
+        i--;
+      }
+    }
+
+    if(Jobs.size() > 0 && TransferFamily != GraphicsFamily)
+    {
+      std::vector<VkImageMemoryBarrier> Images(Jobs.size());
+
+      for(uint32_t i = 0; i < Jobs.size(); i++)
+      {
+        Images[i] = Jobs[i].Acquire;
+      }
+
+      vkCmdPipelineBarrier(GraphicsCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, Images.size(), Images.data());
+    }
+
+    for(uint32_t i = 0; i < Jobs.size(); i++)
+    {
+      GenerateMips(GraphicsCmd, Jobs[i]);
+    }
+
+    Retired = Completed;
+  }
+
+  void UploadQueue::Wait(Ek::UploadToken Token)
+  {
+    if(IsDone(Token))
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> Guard(Lock);
+
+    // someone else may have acquired it while we waited for the lock
+    if(IsDone(Token))
+    {
+      return;
+    }
+
+    Ring.WaitFor(Token);
+
+    // loader threads wait too, so the one off submission gets a pool of its own instead of the render thread's
+    VkCommandPoolCreateInfo PoolCI{};
+    PoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    PoolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    PoolCI.queueFamilyIndex = GraphicsFamily;
+
+    VkCommandPool GraphicsPool;
+    vkCreateCommandPool(*pDevice, &PoolCI, nullptr, &GraphicsPool);
+
+    Ek::Wrappers::CommandBuffer cmdGraphics;
+    cmdGraphics.Allocate(*pDevice, *pGraphicsQueue, GraphicsPool, Ek::eGraphics);
+
+    cmdGraphics.BeginCommand();
+      Acquire(cmdGraphics.Buffer);
+    cmdGraphics.EndComand();
+
+    cmdGraphics.FenceWait();
+    cmdGraphics.Delete();
+
+    vkDestroyCommandPool(*pDevice, GraphicsPool, nullptr);
+  }
+}
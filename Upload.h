@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+#include "Staging.h"
+
+namespace EkBackend
+{
+  /*
+    Asynchronous uploads on the transfer queue.
+    Copies are recorded into the staging ring's current submission, which goes out once a frame (or once it is full).
+    When the transfer and graphics families differ the transfer side releases ownership and Process() records the
+    matching acquire on the graphics side once the submission's fence has signaled. A token is done after that acquire.
+    Mip levels an image upload doesn't bring along are blitted from the last one it does in that same graphics command.
+    Every call takes Lock, so loader threads can record uploads while the render thread processes them.
+  */
+  class UploadQueue
+  {
+    public:
+      VkResult Init(VkDevice& inDevice, AllocateInterface* pAlloc, VkQueue& TransferQueue, VkCommandPool& TransferPool, uint32_t inTransferFamily, VkQueue& GraphicsQueue, uint32_t inGraphicsFamily, uint32_t RingSize);
+      void Destroy();
+
+      Ek::UploadToken UploadBuffer(Ek::Buffer& Dst, const void* pData, VkDeviceSize Size, VkDeviceSize DstOffset = 0);
+      // copies every level Image has, Dst ends up in FinalLayout. If Dst has more levels they are blitted on the graphics side,
+      // so its format has to support that (vulkanInterface::CanBlitMips) and it needs TRANSFER_SRC usage
+      Ek::UploadToken UploadImage(Ek::Texture& Dst, const Ek::ImageData& Image, VkImageLayout FinalLayout);
+      // only LevelCount levels from FirstLevel on, which can't have been written before. The rest of Dst is left alone, so
+      // TextureStreamer can fill levels in while the ones it already has are being sampled
+      Ek::UploadToken UploadLevels(Ek::Texture& Dst, const Ek::ImageData& Image, uint32_t FirstLevel, uint32_t LevelCount, VkImageLayout FinalLayout);
+
+      // token that covers every upload recorded so far
+      Ek::UploadToken GetToken();
+
+      // sends off what has been recorded and acquires every finished upload in GraphicsCmd, which must be outside a renderpass
+      void Process(VkCommandBuffer GraphicsCmd);
+
+      bool IsDone(Ek::UploadToken Token) { return Token <= Retired; }
+      // blocks until Token is done, acquiring with a one off graphics submission if needed
+      void Wait(Ek::UploadToken Token);
+
+    private:
+      void Release(VkBufferMemoryBarrier* pBuffer, VkImageMemoryBarrier* pImage);
+      // one level of Image into the same level of Dst, which is in TRANSFER_DST
+      void CopyLevel(Ek::Texture& Dst, const Ek::ImageData& Image, uint32_t Level);
+      // Process without taking Lock
+      void Acquire(VkCommandBuffer GraphicsCmd);
+
+      // an image whose levels from FirstLevel on still have to be made, everything is in TRANSFER_DST until then
+      struct MipJob
+      {
+        uint64_t Serial;
+        VkImage Image;
+        VkExtent2D Extent;
+        uint32_t FirstLevel;
+        uint32_t MipLevels;
+        VkImageLayout FinalLayout;
+        VkImageMemoryBarrier Acquire; // only when the families differ
+      };
+
+      void GenerateMips(VkCommandBuffer GraphicsCmd, const MipJob& Job);
+
+      std::mutex Lock;
+
+      StagingRing Ring;
+
+      VkDevice* pDevice;
+      VkQueue* pGraphicsQueue;
+
+      uint32_t TransferFamily;
+      uint32_t GraphicsFamily;
+
+      // acquire halves of ownership transfers, waiting for their submission to finish
+      std::vector<std::pair<uint64_t, VkBufferMemoryBarrier>> BufferAcquires;
+      std::vector<std::pair<uint64_t, VkImageMemoryBarrier>> ImageAcquires;
+      std::vector<MipJob> MipJobs;
+
+      // highest token that graphics can use
+      std::atomic<uint64_t> Retired{0};
+  };
+}
@@ -0,0 +1,126 @@
+#include "VulkanBackend.h"
+
+#include <vulkan/vulkan_core.h>
+
+namespace EkBackend
+{
+  void VulkanMemoryBackend::Init(VkDevice& inDevice, VkPhysicalDevice& inPDevice, bool inMemoryBudget)
+  {
+    pDevice = &inDevice;
+    pPDevice = &inPDevice;
+    bMemoryBudget = inMemoryBudget;
+  }
+
+  VkResult VulkanMemoryBackend::AllocateMemory(uint32_t TypeIndex, VkDeviceSize Size, VkImage DedicatedImage, VkBuffer DedicatedBuffer, VkDeviceMemory& Memory)
+  {
+    VkMemoryAllocateInfo AllocInfo{};
+    AllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    AllocInfo.allocationSize = Size;
+    AllocInfo.memoryTypeIndex = TypeIndex;
+
+    VkMemoryDedicatedAllocateInfo DedicatedInfo{};
+    DedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    DedicatedInfo.image = DedicatedImage;
+    DedicatedInfo.buffer = DedicatedBuffer;
+
+    if(DedicatedImage != VK_NULL_HANDLE || DedicatedBuffer != VK_NULL_HANDLE)
+    {
+      AllocInfo.pNext = &DedicatedInfo;
+    }
+
+    return vkAllocateMemory(*pDevice, &AllocInfo, nullptr, &Memory);
+  }
+
+  void VulkanMemoryBackend::FreeMemory(VkDeviceMemory Memory)
+  {
+    vkFreeMemory(*pDevice, Memory, nullptr);
+  }
+
+  VkResult VulkanMemoryBackend::MapMemory(VkDeviceMemory Memory, VkDeviceSize Size, void** ppData)
+  {
+    return vkMapMemory(*pDevice, Memory, 0, Size, 0, ppData);
+  }
+
+  void VulkanMemoryBackend::UnmapMemory(VkDeviceMemory Memory)
+  {
+    vkUnmapMemory(*pDevice, Memory);
+  }
+
+  // the whole allocation, so we don't have to round to nonCoherentAtomSize
+  void VulkanMemoryBackend::FlushMemory(VkDeviceMemory Memory)
+  {
+    VkMappedMemoryRange Range{};
+    Range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    Range.memory = Memory;
+    Range.offset = 0;
+    Range.size = VK_WHOLE_SIZE;
+
+    vkFlushMappedMemoryRanges(*pDevice, 1, &Range);
+  }
+
+  void VulkanMemoryBackend::InvalidateMemory(VkDeviceMemory Memory)
+  {
+    VkMappedMemoryRange Range{};
+    Range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    Range.memory = Memory;
+    Range.offset = 0;
+    Range.size = VK_WHOLE_SIZE;
+
+    vkInvalidateMappedMemoryRanges(*pDevice, 1, &Range);
+  }
+
+  void VulkanMemoryBackend::GetBufferRequirements(VkBuffer Buffer, VkMemoryRequirements& MemReq)
+  {
+    vkGetBufferMemoryRequirements(*pDevice, Buffer, &MemReq);
+  }
+
+  void VulkanMemoryBackend::GetImageRequirements(VkImage Image, VkMemoryRequirements& MemReq)
+  {
+    vkGetImageMemoryRequirements(*pDevice, Image, &MemReq);
+  }
+
+  VkResult VulkanMemoryBackend::BindBuffer(VkBuffer Buffer, VkDeviceMemory Memory, VkDeviceSize Offset)
+  {
+    return vkBindBufferMemory(*pDevice, Buffer, Memory, Offset);
+  }
+
+  VkResult VulkanMemoryBackend::BindImage(VkImage Image, VkDeviceMemory Memory, VkDeviceSize Offset)
+  {
+    return vkBindImageMemory(*pDevice, Image, Memory, Offset);
+  }
+
+  void VulkanMemoryBackend::DestroyBuffer(VkBuffer Buffer)
+  {
+    vkDestroyBuffer(*pDevice, Buffer, nullptr);
+  }
+
+  void VulkanMemoryBackend::DestroyImage(VkImage Image)
+  {
+    vkDestroyImage(*pDevice, Image, nullptr);
+  }
+
+  bool VulkanMemoryBackend::GetHeapBudgets(VkDeviceSize* pBudgets, VkDeviceSize* pUsages)
+  {
+    if(!bMemoryBudget)
+    {
+      return false;
+    }
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT BudgetProps{};
+    BudgetProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 Props2{};
+    Props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    Props2.pNext = &BudgetProps;
+
+    vkGetPhysicalDeviceMemoryProperties2(*pPDevice, &Props2);
+
+    for(uint32_t i = 0; i < Props2.memoryProperties.memoryHeapCount; i++)
+    {
+      pBudgets[i] = BudgetProps.heapBudget[i];
+      pUsages[i] = BudgetProps.heapUsage[i];
+    }
+
+    return true;
+  }
+}
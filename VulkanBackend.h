@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "Memory.h"
+
+namespace EkBackend
+{
+  // the MemoryBackend the renderer uses, a thin layer over the vulkan calls
+  class VulkanMemoryBackend : public MemoryBackend
+  {
+    public:
+      // bMemoryBudget says whether VK_EXT_memory_budget was enabled on the device
+      void Init(VkDevice& inDevice, VkPhysicalDevice& inPDevice, bool inMemoryBudget);
+
+      VkResult AllocateMemory(uint32_t TypeIndex, VkDeviceSize Size, VkImage DedicatedImage, VkBuffer DedicatedBuffer, VkDeviceMemory& Memory);
+      void FreeMemory(VkDeviceMemory Memory);
+
+      VkResult MapMemory(VkDeviceMemory Memory, VkDeviceSize Size, void** ppData);
+      void UnmapMemory(VkDeviceMemory Memory);
+      void FlushMemory(VkDeviceMemory Memory);
+      void InvalidateMemory(VkDeviceMemory Memory);
+
+      void GetBufferRequirements(VkBuffer Buffer, VkMemoryRequirements& MemReq);
+      void GetImageRequirements(VkImage Image, VkMemoryRequirements& MemReq);
+      VkResult BindBuffer(VkBuffer Buffer, VkDeviceMemory Memory, VkDeviceSize Offset);
+      VkResult BindImage(VkImage Image, VkDeviceMemory Memory, VkDeviceSize Offset);
+
+      void DestroyBuffer(VkBuffer Buffer);
+      void DestroyImage(VkImage Image);
+
+      bool GetHeapBudgets(VkDeviceSize* pBudgets, VkDeviceSize* pUsages);
+
+    private:
+      VkDevice* pDevice;
+      VkPhysicalDevice* pPDevice;
+      bool bMemoryBudget;
+  };
+}
@@ -17,6 +17,8 @@ namespace Ek
 {
   namespace Wrappers
   {
+    std::mutex CommandBuffer::QueueLock;
+
     VkResult CommandBuffer::Allocate(VkDevice& Device, VkQueue& inQueue, VkCommandPool& Pool, eCommandType inType)
     {
       VkResult Err;
@@ -97,6 +99,7 @@ namespace Ek
         SubmitInfo.pSignalSemaphores = &Semaphore;
       }
 
+      std::lock_guard<std::mutex> Guard(QueueLock);
       vkQueueSubmit(*pQueue, 1, &SubmitInfo, Fence);
     }
 
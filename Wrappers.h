@@ -4,6 +4,7 @@
 #include <assimp/config.h>
 
 #include <cwchar>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <vector>
@@ -57,6 +58,10 @@ namespace Ek
         void EndComand(bool bSignalSem = false);
         void FenceWait();
 
+        // queues have to be externally synchronized and uploads can submit from loader threads,
+        // so every vkQueueSubmit/vkQueueWaitIdle/vkQueuePresentKHR goes through this
+        static std::mutex QueueLock;
+
       private:
         VkDevice* pDevice;
         VkQueue* pQueue;
@@ -85,6 +90,10 @@ namespace Ek
         VkAttachmentStoreOp StoreOp;
         VkAttachmentLoadOp StencilLoadOp;
         VkAttachmentStoreOp StencilStoreOp;
+
+        // nothing reads the attachment after the renderpass (depth most of the time). It's never stored, lives in lazily allocated
+        // memory where there is some, and every framebuffer shares the same memory for it
+        bool bTransient = false;
     };
   }
 }
@@ -154,6 +154,15 @@ int main()
   }
 
   Renderer.AddDevExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+
+  // half the vertex memory of the float layout
+  Renderer.VertexFormat = Ek::eVertexPackedQuantized;
+  // runs the demo through the gpu culling path so it gets exercised. The pawn loses its back facing meshlets, the sky
+  // sphere is seen from the inside so only the frustum test does anything for it
+  Renderer.bMeshletCulling = true;
+  // draw with the smallest mips as soon as the meshes are up, the detail follows as it comes into view
+  Renderer.bTextureStreaming = true;
+
   if(Renderer.CreateDevice() != VK_SUCCESS)
   {
     throw std::runtime_error("Failed to create vulkan device");
@@ -168,12 +177,15 @@ int main()
 
     Depth.Aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
 
-    Depth.StoreOp = VK_ATTACHMENT_STORE_OP_STORE;
+    // only the depth test reads it, so it never has to leave the renderpass
+    Depth.bTransient = true;
+
+    Depth.StoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     Depth.LoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    Depth.StencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-    Depth.StencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    Depth.StencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    Depth.StencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 
-    Depth.InitialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    Depth.InitialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     Depth.FinalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     Depth.SubpassLayouts.push_back(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
@@ -234,15 +246,23 @@ int main()
   fragConstants.offset = 0;
   fragConstants.size = sizeof(uint32_t) * 2;
 
+  // Ek::PositionDequant of the mesh being drawn, right after the fragment constants
+  VkPushConstantRange vertConstants{};
+  vertConstants.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  vertConstants.offset = 16;
+  vertConstants.size = sizeof(Ek::PositionDequant);
+
   Ek::Material MainMat = Renderer.CreateMaterial();
-  MainMat.LoadVertex("Shaders/Vert.spv");
+  MainMat.LoadVertex((Renderer.VertexFormat == Ek::eVertexFloat) ? "Shaders/Vert.spv" : "Shaders/VertPacked.spv");
   MainMat.LoadFragment("Shaders/Frag.spv");
   MainMat.AddPushConstant(fragConstants);
+  MainMat.AddPushConstant(vertConstants);
 
   Ek::PipelineInterface* pMainPipe = Renderer.CreatePipeline(MainMat, {0,0}, RenderExtent, true);
 
-  Ek::Mesh* MainMesh = Renderer.CreateMesh("Pawn.dae");
-  Ek::Mesh* envMesh = Renderer.CreateMesh("SkySphere.dae");
+  std::vector<Ek::Mesh*> Meshes = Renderer.CreateMeshes({"Pawn.dae", "SkySphere.dae"});
+  Ek::Mesh* MainMesh = Meshes[0];
+  Ek::Mesh* envMesh = Meshes[1];
 
   uint32_t MainMeshIdx = 0;
   uint32_t envMeshIdx = 1;
@@ -264,6 +284,8 @@ int main()
     User.Update(Renderer.Window);
   
     RenderBuffer.BeginCommand();
+      Renderer.SelectLods((Ek::Camera*)&User, Meshes);
+      Renderer.CullMeshes(RenderBuffer, (Ek::Camera*)&User, Meshes);
       Renderer.BeginRender(RenderBuffer);
 
         Renderer.BindShaderResources(RenderBuffer, pMainPipe);
@@ -272,9 +294,11 @@ int main()
           vkCmdPushConstants(RenderBuffer.Buffer, pMainPipe->PipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uint32_t), sizeof(uint32_t), &User.bShading);
 
           vkCmdPushConstants(RenderBuffer.Buffer, pMainPipe->PipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &envMeshIdx);
+          vkCmdPushConstants(RenderBuffer.Buffer, pMainPipe->PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 16, sizeof(Ek::PositionDequant), &envMesh->GetDequant());
           envMesh->Draw(RenderBuffer);
 
           vkCmdPushConstants(RenderBuffer.Buffer, pMainPipe->PipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &MainMeshIdx);
+          vkCmdPushConstants(RenderBuffer.Buffer, pMainPipe->PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 16, sizeof(Ek::PositionDequant), &MainMesh->GetDequant());
           MainMesh->Draw(RenderBuffer);
 
       Renderer.EndRender(RenderBuffer);